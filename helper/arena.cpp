@@ -0,0 +1,52 @@
+#include "arena.h"
+
+#include <new>
+
+MonotonicArena::MonotonicArena(size_t initialBytes) :
+    head(NULL), cursor(NULL), end(NULL), nextBlockSize(initialBytes > 0 ? initialBytes : 1024), blocks(0), reserved(0),
+    allocations(0)
+{
+}
+
+void MonotonicArena::addBlock(size_t minimumBytes)
+{
+    size_t size = nextBlockSize;
+    while (size < minimumBytes) size *= 2;
+    nextBlockSize = size * 2;
+
+    Block* block = static_cast<Block*>(::operator new(sizeof(Block) + size));
+    block->next = head;
+    block->size = size;
+    head = block;
+    cursor = reinterpret_cast<char*>(block + 1);
+    end = cursor + size;
+    blocks++;
+    reserved += size;
+}
+
+void* MonotonicArena::allocate(size_t bytes, size_t alignment)
+{
+    size_t padding = cursor ? (alignment - reinterpret_cast<size_t>(cursor) % alignment) % alignment : 0;
+    if (!cursor || size_t(end - cursor) < padding + bytes) {
+        // Block headers keep the start of a block aligned for any scalar
+        addBlock(bytes + alignment);
+        padding = (alignment - reinterpret_cast<size_t>(cursor) % alignment) % alignment;
+    }
+    void* result = cursor + padding;
+    cursor += padding + bytes;
+    allocations++;
+    return result;
+}
+
+void MonotonicArena::release()
+{
+    while (head) {
+        Block* next = head->next;
+        ::operator delete(head);
+        head = next;
+    }
+    cursor = end = NULL;
+    blocks = 0;
+    reserved = 0;
+    allocations = 0;
+}
@@ -0,0 +1,72 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+
+/////////////////////////////////////////////////////////////////////////////
+// Monotonic arena for short-lived temporaries, e.g. everything a mesh load
+// builds before the upload. Allocations are carved from large blocks and
+// never freed individually; release() (or the destructor) returns all
+// blocks at once. Blocks double in size, so a load that starts with a good
+// size estimate needs only one or two heap allocations. Not thread-safe.
+/////////////////////////////////////////////////////////////////////////////
+
+class MonotonicArena
+{
+private:
+    struct Block
+    {
+        Block* next;
+        size_t size;           // Usable bytes after the header
+    };
+
+    Block* head;
+    char* cursor;
+    char* end;
+    size_t nextBlockSize;
+    size_t blocks;
+    size_t reserved;
+    size_t allocations;
+
+    // Make these private in order to make the object non-copyable
+    MonotonicArena(const MonotonicArena& other);
+    MonotonicArena& operator=(const MonotonicArena& other) { return *this; }
+
+    void addBlock(size_t minimumBytes);
+
+public:
+    // The first block holds initialBytes (allocated on first use).
+    explicit MonotonicArena(size_t initialBytes = 64 * 1024);
+    ~MonotonicArena() { release(); }
+
+    void* allocate(size_t bytes, size_t alignment);
+    void release();
+
+    size_t blockCount() const { return blocks; }
+    size_t bytesReserved() const { return reserved; }
+    // allocate() calls since construction or release(), including those of
+    // ArenaAllocator containers; each is a heap allocation the arena saved.
+    size_t allocationCount() const { return allocations; }
+};
+
+// STL allocator drawing from a MonotonicArena; deallocate() is a no-op, so
+// containers using it must not outlive the arena.
+template <typename T>
+class ArenaAllocator
+{
+public:
+    typedef T value_type;
+
+    MonotonicArena* arena;
+
+    explicit ArenaAllocator(MonotonicArena& arena) : arena(&arena) {}
+    template <typename U> ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+    void deallocate(T*, size_t) {}
+
+    template <typename U> bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+    template <typename U> bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+#endif // ARENA_H
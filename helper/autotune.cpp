@@ -0,0 +1,137 @@
+#include "autotune.h"
+#include "ssbomesh.h"
+#include "glslprogram.h"
+#include "shadercache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+using std::ifstream;
+using std::ofstream;
+#include <sstream>
+#include <iostream>
+using std::cout;
+using std::cerr;
+using std::endl;
+
+DispatchConfig defaultDispatchConfig()
+{
+    DispatchConfig config = { 256, 1, 0.0 };
+    return config;
+}
+
+void appendDispatchDefines(const DispatchConfig& config, vector<string>& defines)
+{
+    defines.push_back("WORKGROUP_SIZE " + std::to_string(config.workgroupSize));
+    defines.push_back("VERTS_PER_THREAD " + std::to_string(config.vertsPerThread));
+}
+
+string dispatchConfigKey(const vector<string>& defines)
+{
+    const GLubyte* renderer = glGetString(GL_RENDERER);
+    string key = renderer ? string((const char*)renderer) : string("unknown");
+    key += '\t';
+    for (size_t i = 0; i < defines.size(); ++i) {
+        if (i) key += ';';
+        key += defines[i];
+    }
+    return key;
+}
+
+// Splits a tuning file line into its key (first two fields) and the rest.
+static bool splitLine(const string& line, string& key, string& rest)
+{
+    size_t first = line.find('\t');
+    if (first == string::npos) return false;
+    size_t second = line.find('\t', first + 1);
+    if (second == string::npos) return false;
+    key = line.substr(0, second);
+    rest = line.substr(second + 1);
+    return true;
+}
+
+bool loadDispatchConfig(const char* fileName, const string& key, DispatchConfig& config)
+{
+    ifstream file(fileName);
+    string line, lineKey, rest;
+    while (std::getline(file, line)) {
+        if (!splitLine(line, lineKey, rest) || lineKey != key) continue;
+        std::istringstream fields(rest);
+        DispatchConfig stored = defaultDispatchConfig();
+        if (fields >> stored.workgroupSize >> stored.vertsPerThread >> stored.ms &&
+            stored.workgroupSize > 0 && stored.vertsPerThread > 0) {
+            config = stored;
+            return true;
+        }
+    }
+    return false;
+}
+
+void saveDispatchConfig(const char* fileName, const string& key, const DispatchConfig& config)
+{
+    // Keep the entries of other devices and define sets
+    vector<string> lines;
+    {
+        ifstream file(fileName);
+        string line, lineKey, rest;
+        while (std::getline(file, line)) {
+            if (splitLine(line, lineKey, rest) && lineKey != key) lines.push_back(line);
+        }
+    }
+
+    std::ostringstream entry;
+    entry << key << '\t' << config.workgroupSize << '\t' << config.vertsPerThread << '\t' << config.ms;
+    lines.push_back(entry.str());
+
+    ofstream file(fileName, std::ios::out | std::ios::trunc);
+    if (!file) {
+        cerr << "Unable to write dispatch tuning file: " << fileName << endl;
+        return;
+    }
+    for (size_t i = 0; i < lines.size(); ++i) file << lines[i] << '\n';
+}
+
+DispatchConfig tuneDispatch(SSBOMesh& mesh, const char* shaderFile, const vector<string>& defines,
+    ShaderCache* cache, int repetitions)
+{
+    GLint maxSize = 0, maxInvocations = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &maxSize);
+    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+
+    DispatchConfig best = defaultDispatchConfig();
+    best.ms = -1.0;
+    cout << "Tuning dispatch (" << repetitions << " iterations per candidate):" << endl;
+    for (GLuint size = 32; size <= 1024; size *= 2) {
+        if (GLint(size) > maxSize || GLint(size) > maxInvocations) break;
+        for (GLuint perThread = 1; perThread <= 4; ++perThread) {
+            DispatchConfig candidate = { size, perThread, 0.0 };
+            vector<string> candidateDefines = defines;
+            appendDispatchDefines(candidate, candidateDefines);
+
+            GLSLProgram prog;
+            try {
+                if (cache) {
+                    cache->build(prog, shaderFile, GLSLShader::COMPUTE, candidateDefines);
+                }
+                else {
+                    prog.compileShader(shaderFile, GLSLShader::COMPUTE, candidateDefines);
+                    prog.link();
+                }
+            }
+            catch (GLSLProgramException& e) {
+                cerr << " " << size << "x" << perThread << ": " << e.what() << endl;
+                continue;
+            }
+
+            candidate.ms = mesh.timeKernel(&prog, candidate.verticesPerGroup(), repetitions);
+            if (candidate.ms < 0.0) continue;
+            printf(" %4u x %u: %.4f ms\n", size, perThread, candidate.ms);
+            if (best.ms < 0.0 || candidate.ms < best.ms) best = candidate;
+        }
+    }
+
+    if (best.ms < 0.0) return defaultDispatchConfig();
+    printf("Best: workgroup size %u, %u vertices per thread (%.4f ms/iteration).\n",
+        best.workgroupSize, best.vertsPerThread, best.ms);
+    return best;
+}
@@ -0,0 +1,49 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "gldecl.h"
+
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+class SSBOMesh;
+class ShaderCache;
+
+/////////////////////////////////////////////////////////////////////////////
+// Dispatch shape of shader.comp: invocations per workgroup (WORKGROUP_SIZE)
+// and vertices per invocation (VERTS_PER_THREAD). The best shape depends on
+// the device, so it is tuned once on a loaded mesh and stored in a text file
+// with one line per GL renderer and define set:
+//
+//     <renderer> TAB <defines> TAB <workgroup size> TAB <verts/thread> TAB <ms>
+/////////////////////////////////////////////////////////////////////////////
+
+struct DispatchConfig
+{
+    GLuint workgroupSize;
+    GLuint vertsPerThread;
+    double ms;                 // Time per iteration when tuned (0 = untuned default)
+
+    GLuint verticesPerGroup() const { return workgroupSize * vertsPerThread; }
+};
+
+DispatchConfig defaultDispatchConfig();
+
+// Appends the WORKGROUP_SIZE and VERTS_PER_THREAD defines for 'config'.
+void appendDispatchDefines(const DispatchConfig& config, vector<string>& defines);
+
+// Key of the current device and a define set in the tuning file.
+string dispatchConfigKey(const vector<string>& defines);
+
+bool loadDispatchConfig(const char* fileName, const string& key, DispatchConfig& config);
+void saveDispatchConfig(const char* fileName, const string& key, const DispatchConfig& config);
+
+// Times every workgroup size from 32 to 1024 (within the device limits) with
+// 1 to 4 vertices per thread on 'mesh' and returns the fastest. Candidates
+// are built from shaderFile with 'defines' plus the dispatch defines.
+DispatchConfig tuneDispatch(SSBOMesh& mesh, const char* shaderFile, const vector<string>& defines,
+    ShaderCache* cache, int repetitions);
+
+#endif // AUTOTUNE_H
@@ -0,0 +1,425 @@
+#include "batchpipeline.h"
+#include "ssbomesh.h"
+#include "glslprogram.h"
+#include "meshpreview.h"
+
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+using std::ifstream;
+#include <iostream>
+using std::cout;
+using std::cerr;
+using std::endl;
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+typedef std::chrono::steady_clock Clock;
+
+static double millisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Fixed-capacity FIFO between the parser, GL and writer threads.
+template <typename T>
+class BoundedQueue
+{
+private:
+    std::deque<T> items;
+    size_t capacity;
+    std::mutex lock;
+    std::condition_variable changed;
+
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    // Returns the time spent waiting for room, in milliseconds.
+    double push(T item)
+    {
+        Clock::time_point start = Clock::now();
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return items.size() < capacity; });
+        double waited = millisecondsSince(start);
+        items.push_back(std::move(item));
+        changed.notify_all();
+        return waited;
+    }
+
+    T pop(double* waited = NULL)
+    {
+        Clock::time_point start = Clock::now();
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return !items.empty(); });
+        if (waited) *waited += millisecondsSince(start);
+        T item = std::move(items.front());
+        items.pop_front();
+        changed.notify_all();
+        return item;
+    }
+};
+
+struct FinishedMesh
+{
+    SSBOMesh* mesh;            // NULL ends the writer thread
+    string output;
+    vector<float> positions;
+    vector<unsigned char> previews;    // Before and after images, empty without previews
+};
+
+bool readBatchList(const char* fileName, vector<BatchJob>& jobs)
+{
+    ifstream list(fileName);
+    if (!list) {
+        cerr << "Unable to open batch list: " << fileName << endl;
+        return false;
+    }
+
+    string line;
+    int lineNumber = 0;
+    while (std::getline(list, line)) {
+        lineNumber++;
+        std::istringstream fields(line);
+        BatchJob job;
+        if (!(fields >> job.input) || job.input[0] == '#') continue;
+        if (!(fields >> job.output)) {
+            cerr << fileName << ":" << lineNumber << ": expected an input and an output file" << endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+BatchPipeline::BatchPipeline(GLSLProgram* program, GLuint verticesPerGroup) :
+    program(program), verticesPerGroup(verticesPerGroup), creaseAngle(60.0f), welding(true), weldEpsilon(0.0f), lockMask(0), lambda(1.0f),
+    preview(NULL)
+{
+    // Core in 4.4; the context is 4.3, so it may only be an extension
+    persistentMapping = GLEW_ARB_buffer_storage != 0;
+
+    for (int s = 0; s < NUM_SLOTS; ++s) {
+        Slot& slot = slots[s];
+        glGenBuffers(NUM_BUFFERS, slot.bufferHandle);
+        std::fill(slot.bufferCapacity, slot.bufferCapacity + NUM_BUFFERS, size_t(0));
+        slot.stagingHandle = slot.readbackHandle = slot.previewHandle = 0;
+        slot.stagingCapacity = slot.readbackCapacity = 0;
+        slot.stagingData = NULL;
+        slot.readbackData = NULL;
+        slot.fence = 0;
+        slot.mesh = NULL;
+        slot.job = 0;
+        slot.resultBuffer = 3;
+        slot.previewed = false;
+    }
+}
+
+BatchPipeline::~BatchPipeline()
+{
+    for (int s = 0; s < NUM_SLOTS; ++s) {
+        Slot& slot = slots[s];
+        if (slot.fence) glDeleteSync(slot.fence);
+        glDeleteBuffers(NUM_BUFFERS, slot.bufferHandle);
+        if (slot.stagingHandle) glDeleteBuffers(1, &slot.stagingHandle);
+        if (slot.readbackHandle) glDeleteBuffers(1, &slot.readbackHandle);
+        if (slot.previewHandle) glDeleteBuffers(1, &slot.previewHandle);
+        delete slot.mesh;
+    }
+}
+
+void BatchPipeline::setPreview(MeshPreview* meshPreview)
+{
+    // Both images of a slot go to its pixel pack buffer, mapped after the readback fence
+    preview = meshPreview;
+    if (!preview) return;
+    for (int s = 0; s < NUM_SLOTS; ++s) {
+        Slot& slot = slots[s];
+        if (slot.previewHandle == 0) glGenBuffers(1, &slot.previewHandle);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.previewHandle);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 2 * preview->imageBytes(), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void BatchPipeline::reserveBuffer(Slot& slot, int index, size_t bytes)
+{
+    // Buffers only grow, so a slot settles at the largest mesh it has held.
+    if (bytes <= slot.bufferCapacity[index]) return;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.bufferHandle[index]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, NULL, GL_DYNAMIC_COPY);
+    slot.bufferCapacity[index] = bytes;
+}
+
+void BatchPipeline::reserveStaging(Slot& slot, size_t bytes)
+{
+    // Immutable storage cannot be resized; replace it. The slot is idle here.
+    if (bytes <= slot.stagingCapacity) return;
+    if (slot.stagingHandle) glDeleteBuffers(1, &slot.stagingHandle);
+    glGenBuffers(1, &slot.stagingHandle);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, slot.stagingHandle);
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, NULL, flags);
+    slot.stagingData = (char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, flags);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    slot.stagingCapacity = bytes;
+}
+
+void BatchPipeline::reserveReadback(Slot& slot, size_t bytes)
+{
+    if (bytes <= slot.readbackCapacity) return;
+    if (slot.readbackHandle) glDeleteBuffers(1, &slot.readbackHandle);
+    glGenBuffers(1, &slot.readbackHandle);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, slot.readbackHandle);
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, NULL, flags | GL_CLIENT_STORAGE_BIT);
+    slot.readbackData = (const float*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, flags);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    slot.readbackCapacity = bytes;
+}
+
+void BatchPipeline::upload(Slot& slot)
+{
+    const SSBOMesh& mesh = *slot.mesh;
+    GLuint count = mesh.numVertices();
+    const void* sources[NUM_BUFFERS] = {
+        mesh.getHostNeighbors().data(), mesh.getHostSpans().data(), mesh.getHostOffsets().data(),
+        mesh.getHostPositions().data(), NULL, mesh.getHostFlags().data(), preview ? mesh.getHostFaces().data() : NULL
+    };
+    size_t sizes[NUM_BUFFERS] = {
+        std::max<size_t>(mesh.getHostNeighbors().size(), 1) * sizeof(GLuint), count * sizeof(GLuint),
+        count * sizeof(GLuint), 3 * size_t(count) * sizeof(float), 3 * size_t(count) * sizeof(float),
+        count * sizeof(VertexFlags), preview ? 3 * size_t(mesh.numFaces()) * sizeof(GLuint) : 0
+    };
+    if (mesh.getHostNeighbors().empty()) sources[0] = NULL;
+    if (mesh.numFaces() == 0) sources[6] = NULL;
+    for (int i = 0; i < NUM_BUFFERS; ++i) reserveBuffer(slot, i, std::max<size_t>(sizes[i], 4));
+
+    // Iterations write every vertex, so only the first position buffer is filled
+    if (!persistentMapping) {
+        for (int i = 0; i < NUM_BUFFERS; ++i) {
+            if (!sources[i]) continue;
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.bufferHandle[i]);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizes[i], sources[i]);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        return;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < NUM_BUFFERS; ++i) if (sources[i]) total += sizes[i];
+    reserveStaging(slot, total);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, slot.stagingHandle);
+    size_t offset = 0;
+    for (int i = 0; i < NUM_BUFFERS; ++i) {
+        if (!sources[i]) continue;
+        memcpy(slot.stagingData + offset, sources[i], sizes[i]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, slot.bufferHandle[i]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, 0, sizes[i]);
+        offset += sizes[i];
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void BatchPipeline::smooth(Slot& slot, int numIterations)
+{
+    GLuint count = slot.mesh->numVertices();
+    size_t positionBytes = 3 * size_t(count) * sizeof(float);
+    slot.previewed = preview && drawPreview(slot, 3, 0);
+
+    program->use();
+    program->setUniform("useActiveList", false);
+    program->setUniform("copyOnly", false);
+    program->setUniform("lockMask", lockMask);
+    program->setUniform("lambda", lambda);
+    for (int i = 0; i < 3; ++i) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, slot.bufferHandle[i]);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, slot.bufferHandle[5]);
+
+    // Bind exact ranges so positions.length() is this mesh's vertex count.
+    int readIdx = 3;
+    for (int it = 0; it < numIterations && count > 0; ++it) {
+        int writeIdx = readIdx == 3 ? 4 : 3;
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, slot.bufferHandle[readIdx], 0, positionBytes);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, slot.bufferHandle[writeIdx], 0, positionBytes);
+        glDispatchCompute((count + verticesPerGroup - 1) / verticesPerGroup, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        readIdx = writeIdx;
+    }
+    slot.resultBuffer = readIdx;
+    if (slot.previewed) slot.previewed = drawPreview(slot, readIdx, 1);
+}
+
+bool BatchPipeline::drawPreview(Slot& slot, int positionBuffer, int image)
+{
+    // Framed by the box as loaded, so both images of a mesh line up
+    vec3 lo, hi;
+    slot.mesh->getBoundingBox(lo, hi);
+    if (!preview->begin(POSITIONS_FP32, lo, hi)) return false;
+    preview->draw(slot.bufferHandle[positionBuffer], slot.bufferHandle[6], slot.mesh->numFaces());
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.previewHandle);
+    preview->finish(reinterpret_cast<void*>(image * preview->imageBytes()));
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+}
+
+void BatchPipeline::startReadback(Slot& slot)
+{
+    size_t positionBytes = 3 * size_t(slot.mesh->numVertices()) * sizeof(float);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    if (persistentMapping && positionBytes > 0) {
+        reserveReadback(slot, positionBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, slot.bufferHandle[slot.resultBuffer]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, slot.readbackHandle);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, positionBytes);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    // Also covers the upload copies, which were issued earlier
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+}
+
+void BatchPipeline::finishReadback(Slot& slot, vector<float>& positions, vector<unsigned char>& previews)
+{
+    GLuint count = slot.mesh->numVertices();
+    positions.resize(3 * size_t(count));
+    if (slot.fence) {
+        while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull) == GL_TIMEOUT_EXPIRED) {
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+    }
+    if (slot.previewed) {
+        previews.resize(2 * preview->imageBytes());
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.previewHandle);
+        const void* images = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, previews.size(), GL_MAP_READ_BIT);
+        if (images) {
+            memcpy(previews.data(), images, previews.size());
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else {
+            previews.clear();
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    if (count == 0) return;
+
+    if (persistentMapping) {
+        memcpy(positions.data(), slot.readbackData, positions.size() * sizeof(float));
+    }
+    else {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, slot.bufferHandle[slot.resultBuffer]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, positions.size() * sizeof(float), positions.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+}
+
+bool BatchPipeline::run(const vector<BatchJob>& jobs, int numIterations, BatchStageTimes& times)
+{
+    memset(&times, 0, sizeof(times));
+    Clock::time_point batchStart = Clock::now();
+
+    // Meshes are parsed at most two ahead of the upload and written at most
+    // two behind the readback, which bounds host memory.
+    BoundedQueue<SSBOMesh*> parsed(2);
+    BoundedQueue<FinishedMesh> finished(2);
+    bool ok = true;
+
+    std::thread parser([&] {
+        for (size_t j = 0; j < jobs.size(); ++j) {
+            Clock::time_point start = Clock::now();
+            SSBOMesh* mesh = NULL;
+            if (ifstream(jobs[j].input.c_str())) {
+                mesh = new SSBOMesh();
+                mesh->setHostOnly(true);
+                mesh->setCreaseAngle(creaseAngle);
+                mesh->setWelding(welding, weldEpsilon);
+                mesh->loadOBJ(jobs[j].input.c_str());
+            }
+            else {
+                cerr << "Unable to open OBJ file: " << jobs[j].input << endl;
+            }
+            times.parse += millisecondsSince(start);
+            parsed.push(mesh);
+        }
+    });
+
+    std::thread writer([&] {
+        for (;;) {
+            FinishedMesh done = finished.pop();
+            if (!done.mesh) break;
+            Clock::time_point start = Clock::now();
+            done.mesh->writeOBJ(done.output.c_str(), done.positions.data(), done.mesh->getHostFaces().data());
+            if (!done.previews.empty()) {
+                preview->writePNG(previewFileName(done.output, "before").c_str(), done.previews.data());
+                preview->writePNG(previewFileName(done.output, "after").c_str(), done.previews.data() + preview->imageBytes());
+            }
+            delete done.mesh;
+            times.write += millisecondsSince(start);
+        }
+    });
+
+    // Round r uploads job r, smooths job r - 1 and starts reading back job
+    // r - 2. Slot r % 3 last held job r - 3, whose readback started a round
+    // ago, so it is retired first.
+    for (size_t r = 0; r < jobs.size() + NUM_SLOTS; ++r) {
+        Slot& current = slots[r % NUM_SLOTS];
+        if (current.mesh) {
+            Clock::time_point start = Clock::now();
+            FinishedMesh done;
+            done.mesh = current.mesh;
+            done.output = jobs[current.job].output;
+            finishReadback(current, done.positions, done.previews);
+            current.mesh = NULL;
+            times.readback += millisecondsSince(start);
+            times.writeStall += finished.push(std::move(done));
+        }
+
+        if (r < jobs.size()) {
+            current.mesh = parsed.pop(&times.parseStall);
+            current.job = r;
+            if (current.mesh) {
+                Clock::time_point start = Clock::now();
+                upload(current);
+                times.upload += millisecondsSince(start);
+            }
+            else {
+                ok = false;
+            }
+        }
+
+        if (r >= 1 && r - 1 < jobs.size()) {
+            Slot& previous = slots[(r - 1) % NUM_SLOTS];
+            if (previous.mesh) {
+                Clock::time_point start = Clock::now();
+                smooth(previous, numIterations);
+                times.smooth += millisecondsSince(start);
+            }
+        }
+
+        if (r >= 2 && r - 2 < jobs.size()) {
+            Slot& older = slots[(r - 2) % NUM_SLOTS];
+            if (older.mesh) {
+                Clock::time_point start = Clock::now();
+                startReadback(older);
+                times.readback += millisecondsSince(start);
+            }
+        }
+    }
+
+    FinishedMesh end;
+    end.mesh = NULL;
+    finished.push(std::move(end));
+    parser.join();
+    writer.join();
+
+    times.total = millisecondsSince(batchStart);
+    return ok;
+}
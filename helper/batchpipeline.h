@@ -0,0 +1,119 @@
+#ifndef BATCHPIPELINE_H
+#define BATCHPIPELINE_H
+
+#include "gldecl.h"
+
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+class GLSLProgram;
+class SSBOMesh;
+class MeshPreview;
+
+struct BatchJob
+{
+    string input;
+    string output;
+};
+
+// Reads a batch list: one "input.obj output.obj" pair per line, blank lines
+// and lines starting with '#' are skipped.
+bool readBatchList(const char* fileName, vector<BatchJob>& jobs);
+
+// Milliseconds spent in each stage, summed over the batch. The GL stages
+// measure host time (submission, fence waits and copies), not GPU time.
+struct BatchStageTimes
+{
+    double parse;              // Parser thread: OBJ parsing and adjacency
+    double upload;             // GL thread: staging copy and upload commands
+    double smooth;             // GL thread: dispatches
+    double readback;           // GL thread: fence waits and copy out
+    double write;              // Writer thread: OBJ output
+    double parseStall;         // GL thread waiting for the parser
+    double writeStall;         // GL thread waiting for the writer
+    double total;              // Wall-clock time of the whole batch
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// Smooths a list of meshes with the host and GPU stages overlapped. A parser
+// thread loads upcoming meshes (host-only SSBOMesh), the GL thread cycles
+// three mesh slots so that in each round one slot is uploaded, the previous
+// one smoothed and the one before that read back, and a writer thread writes
+// the finished meshes. Uploads and readbacks go through persistently mapped
+// staging buffers (ARB_buffer_storage; plain buffer updates otherwise), and
+// a fence per slot keeps its staging memory from being reused before the GPU
+// is done with it. In steady state a round costs the slowest stage rather
+// than the sum of all of them. Jacobi with fp32 positions and uncompressed
+// neighbors only.
+/////////////////////////////////////////////////////////////////////////////
+
+class BatchPipeline
+{
+private:
+    static const int NUM_SLOTS = 3;
+    static const int NUM_BUFFERS = 7;
+
+    struct Slot
+    {
+        GLuint bufferHandle[NUM_BUFFERS];  // Neighbors, spans, offsets, positions x2, flags, faces (previews only)
+        size_t bufferCapacity[NUM_BUFFERS];
+        GLuint stagingHandle;          // Upload staging (CSR, positions, flags)
+        size_t stagingCapacity;
+        char* stagingData;             // Persistent mapping, NULL without buffer storage
+        GLuint readbackHandle;         // Result positions
+        size_t readbackCapacity;
+        const float* readbackData;
+        GLuint previewHandle;          // Pixel pack buffer of the before and after images
+        GLsync fence;                  // Set after the readback copy
+        SSBOMesh* mesh;                // Mesh in flight, NULL if the slot is free
+        size_t job;
+        int resultBuffer;              // Position buffer (3 or 4) holding the result
+        bool previewed;                // previewHandle holds both images of the mesh
+    };
+
+    GLSLProgram* program;
+    GLuint verticesPerGroup;
+    float creaseAngle;
+    bool welding;
+    float weldEpsilon;
+    GLuint lockMask;
+    float lambda;
+    bool persistentMapping;
+    MeshPreview* preview;
+    Slot slots[NUM_SLOTS];
+
+    // Make these private in order to make the object non-copyable
+    BatchPipeline(const BatchPipeline& other);
+    BatchPipeline& operator=(const BatchPipeline& other) { return *this; }
+
+    void reserveBuffer(Slot& slot, int index, size_t bytes);
+    void reserveStaging(Slot& slot, size_t bytes);
+    void reserveReadback(Slot& slot, size_t bytes);
+    void upload(Slot& slot);
+    void smooth(Slot& slot, int numIterations);
+    bool drawPreview(Slot& slot, int positionBuffer, int image);
+    void startReadback(Slot& slot);
+    void finishReadback(Slot& slot, vector<float>& positions, vector<unsigned char>& previews);
+
+public:
+    // Requires a current GL context; the pipeline must be used on its thread.
+    BatchPipeline(GLSLProgram* program, GLuint verticesPerGroup);
+    ~BatchPipeline();
+
+    void setCreaseAngle(float degrees) { creaseAngle = degrees; }
+    void setWelding(bool enabled, float epsilon) { welding = enabled; weldEpsilon = epsilon; }
+    void setLockMask(GLuint mask) { lockMask = mask; }
+    void setLambda(float value) { lambda = value; }
+    // Draws every mesh before and after smoothing with 'meshPreview' (NULL =
+    // off). The images are read back along with the positions and written
+    // by the writer thread next to the output (see previewFileName).
+    void setPreview(MeshPreview* meshPreview);
+
+    // Smooths every job with numIterations iterations. Returns false if a
+    // mesh could not be loaded (the other jobs still complete).
+    bool run(const vector<BatchJob>& jobs, int numIterations, BatchStageTimes& times);
+};
+
+#endif // BATCHPIPELINE_H
@@ -0,0 +1,439 @@
+#include "benchmark.h"
+
+#include "ssbomesh.h"
+#include "meshgen.h"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+using std::cerr;
+using std::cout;
+using std::endl;
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// Phases in report order; a mesh sample holds one time per phase.
+static const int NUM_PHASES = 7;
+static const char* const phaseNames[NUM_PHASES] = { "parse", "cleanup", "adjacency", "upload", "smooth", "readback", "write" };
+
+// Medians below this difference are never flagged (timer resolution and noise).
+static const double MIN_REGRESSION_MS = 0.05;
+
+struct PhaseStats
+{
+    double median;
+    double p95;
+    double min;
+};
+
+struct MeshResult
+{
+    string name;
+    GLuint vertices;
+    GLuint triangles;
+    PhaseStats phases[NUM_PHASES];
+};
+
+static double elapsedMs(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+static PhaseStats summarize(vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    size_t n = samples.size();
+    PhaseStats stats;
+    stats.median = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    stats.p95 = samples[size_t(std::ceil(0.95 * n)) - 1];  // Nearest rank
+    stats.min = samples[0];
+    return stats;
+}
+
+static bool listModels(const string& directory, vector<string>& files)
+{
+#ifdef _WIN32
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA((directory + "\\*.obj").c_str(), &entry);
+    if (find == INVALID_HANDLE_VALUE) return false;
+    do {
+        files.push_back(entry.cFileName);
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    DIR* dir = opendir(directory.c_str());
+    if (!dir) return false;
+    while (dirent* entry = readdir(dir)) {
+        size_t length = strlen(entry->d_name);
+        if (length > 4 && !strcmp(entry->d_name + length - 4, ".obj")) files.push_back(entry->d_name);
+    }
+    closedir(dir);
+#endif
+    // The working files of the single-mesh mode are copies of other models
+    files.erase(std::remove_if(files.begin(), files.end(),
+        [](const string& f) { return f == "in.obj" || f == "out.obj"; }), files.end());
+    std::sort(files.begin(), files.end());
+    return true;
+}
+
+// 'load' fills a fresh mesh from an OBJ file or from memory.
+static bool benchmarkMesh(const std::function<void(SSBOMesh*)>& load, const string& name, const BenchmarkOptions& options,
+    const MeshFactory& makeMesh, const string& scratchFile, MeshResult& result)
+{
+    vector<double> samples[NUM_PHASES];
+    vector<float> positions;
+    vector<GLuint> faces;
+
+    for (int rep = 0; rep < options.repetitions; ++rep) {
+        SSBOMesh* mesh = makeMesh();
+        load(mesh);
+        if (mesh->numVertices() == 0) {
+            delete mesh;
+            cerr << "Benchmark: no vertices in " << name << endl;
+            return false;
+        }
+        const LoadTimings& load = mesh->loadTimings();
+        samples[0].push_back(load.parse);
+        samples[1].push_back(load.cleanup);
+        samples[2].push_back(load.adjacency);
+        samples[3].push_back(load.upload);
+
+        glFinish();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        mesh->smoothVertices(options.iterations);
+        glFinish();
+        samples[4].push_back(elapsedMs(start));
+
+        positions.resize(3 * size_t(mesh->numVertices()));
+        faces.resize(3 * size_t(mesh->numFaces()));
+        start = std::chrono::steady_clock::now();
+        mesh->readPositions(positions.data());
+        mesh->readFaces(faces.data());
+        samples[5].push_back(elapsedMs(start));
+
+        start = std::chrono::steady_clock::now();
+        mesh->writeOBJ(scratchFile.c_str(), positions.data(), faces.data());
+        samples[6].push_back(elapsedMs(start));
+
+        result.vertices = mesh->numVertices();
+        result.triangles = mesh->numFaces();
+        delete mesh;
+    }
+    remove(scratchFile.c_str());
+
+    result.name = name;
+    for (int p = 0; p < NUM_PHASES; ++p) result.phases[p] = summarize(samples[p]);
+    return true;
+}
+
+// JSON string literal; names and renderer strings need no more than this.
+static string quoted(const string& text)
+{
+    string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (c == '\n') out += "\\n";
+        else out += c;
+    }
+    return out + "\"";
+}
+
+static bool writeReport(const BenchmarkOptions& options, const vector<MeshResult>& results)
+{
+    FILE* file = fopen(options.outputFile.c_str(), "w");
+    if (!file) {
+        cerr << "Unable to write benchmark report: " << options.outputFile << endl;
+        return false;
+    }
+    fprintf(file, "{\n  \"schema\": \"%s\",\n  \"version\": %d,\n", BENCHMARK_SCHEMA, BENCHMARK_VERSION);
+    fprintf(file, "  \"renderer\": %s,\n", quoted((const char*)glGetString(GL_RENDERER)).c_str());
+    fprintf(file, "  \"config\": %s,\n", quoted(options.config).c_str());
+    fprintf(file, "  \"iterations\": %d,\n  \"repetitions\": %d,\n  \"meshes\": [", options.iterations, options.repetitions);
+    for (size_t m = 0; m < results.size(); ++m) {
+        const MeshResult& r = results[m];
+        fprintf(file, "%s\n    {\n      \"name\": %s,\n      \"vertices\": %u,\n      \"triangles\": %u,\n      \"phases\": {",
+            m ? "," : "", quoted(r.name).c_str(), r.vertices, r.triangles);
+        for (int p = 0; p < NUM_PHASES; ++p) {
+            fprintf(file, "%s\n        \"%s\": { \"median_ms\": %.4f, \"p95_ms\": %.4f, \"min_ms\": %.4f }",
+                p ? "," : "", phaseNames[p], r.phases[p].median, r.phases[p].p95, r.phases[p].min);
+        }
+        fprintf(file, "\n      }\n    }");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+bool runBenchmark(const BenchmarkOptions& options, const MeshFactory& makeMesh)
+{
+    vector<string> models;
+    if (!options.modelDirectory.empty() && !listModels(options.modelDirectory, models)) {
+        cerr << "Unable to list models in: " << options.modelDirectory << endl;
+        return false;
+    }
+
+    string scratchFile = options.outputFile + ".out.obj";
+    vector<MeshResult> results;
+    bool ok = true;
+
+    for (size_t i = 0; i < models.size(); ++i) {
+        MeshResult result;
+        string path = options.modelDirectory + "/" + models[i];
+        auto load = [&path](SSBOMesh* mesh) { mesh->loadOBJ(path.c_str()); };
+        if (benchmarkMesh(load, models[i], options, makeMesh, scratchFile, result)) results.push_back(result);
+        else ok = false;
+    }
+
+    // Generated meshes are loaded from memory (generation is not timed), so
+    // their parse phase is 0.
+    for (size_t i = 0; i < options.synthetic.size(); ++i) {
+        GeneratedMesh generated;
+        if (!generateFromSpec(options.synthetic[i], generated)) {
+            ok = false;
+            continue;
+        }
+        const string& spec = options.synthetic[i];
+        auto load = [&generated, &spec](SSBOMesh* mesh) {
+            mesh->loadArrays(generated.positions.data(), generated.faces.data(), generated.numVertices(), generated.numFaces(), spec.c_str());
+        };
+        MeshResult result;
+        if (benchmarkMesh(load, spec, options, makeMesh, scratchFile, result)) results.push_back(result);
+        else ok = false;
+    }
+
+    printf("\nBenchmark: %d iterations, median (p95) ms over %d repetitions\n", options.iterations, options.repetitions);
+    printf("%-20s %10s", "mesh", "triangles");
+    for (int p = 0; p < NUM_PHASES; ++p) printf(" %17s", phaseNames[p]);
+    printf("\n");
+    for (size_t m = 0; m < results.size(); ++m) {
+        printf("%-20s %10u", results[m].name.c_str(), results[m].triangles);
+        for (int p = 0; p < NUM_PHASES; ++p) {
+            char cell[32];
+            snprintf(cell, sizeof(cell), "%.2f (%.2f)", results[m].phases[p].median, results[m].phases[p].p95);
+            printf(" %17s", cell);
+        }
+        printf("\n");
+    }
+
+    if (!writeReport(options, results)) return false;
+    printf("Wrote %s.\n", options.outputFile.c_str());
+    return ok;
+}
+
+// === Reading reports back ===
+// A minimal JSON reader: enough for the reports written above (objects,
+// arrays, strings, numbers, true/false/null).
+
+struct JsonValue
+{
+    enum Type { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT } type;
+    double number;
+    string text;
+    vector<JsonValue> items;
+    vector<std::pair<string, JsonValue> > members;
+
+    JsonValue() : type(NUL), number(0.0) {}
+
+    const JsonValue* find(const char* key) const
+    {
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (members[i].first == key) return &members[i].second;
+        }
+        return NULL;
+    }
+};
+
+class JsonParser
+{
+private:
+    const char* p;
+    const char* end;
+
+    void skipSpace() { while (p < end && isspace((unsigned char)*p)) ++p; }
+    bool expect(char c)
+    {
+        skipSpace();
+        if (p >= end || *p != c) return false;
+        ++p;
+        return true;
+    }
+
+    bool parseString(string& out)
+    {
+        if (!expect('"')) return false;
+        out.clear();
+        while (p < end && *p != '"') {
+            if (*p == '\\' && p + 1 < end) {
+                ++p;
+                out += *p == 'n' ? '\n' : *p == 't' ? '\t' : *p;  // \uXXXX is not written by runBenchmark
+            }
+            else {
+                out += *p;
+            }
+            ++p;
+        }
+        return expect('"');
+    }
+
+public:
+    JsonParser(const char* text, size_t length) : p(text), end(text + length) {}
+
+    bool parse(JsonValue& value)
+    {
+        skipSpace();
+        if (p >= end) return false;
+        if (*p == '{') {
+            ++p;
+            value.type = JsonValue::OBJECT;
+            if (expect('}')) return true;
+            do {
+                std::pair<string, JsonValue> member;
+                if (!parseString(member.first) || !expect(':') || !parse(member.second)) return false;
+                value.members.push_back(member);
+            } while (expect(','));
+            return expect('}');
+        }
+        if (*p == '[') {
+            ++p;
+            value.type = JsonValue::ARRAY;
+            if (expect(']')) return true;
+            do {
+                value.items.push_back(JsonValue());
+                if (!parse(value.items.back())) return false;
+            } while (expect(','));
+            return expect(']');
+        }
+        if (*p == '"') {
+            value.type = JsonValue::STRING;
+            return parseString(value.text);
+        }
+        if (!strncmp(p, "true", std::min<size_t>(4, end - p)) || !strncmp(p, "false", std::min<size_t>(5, end - p))) {
+            value.type = JsonValue::BOOLEAN;
+            value.number = *p == 't';
+            p += *p == 't' ? 4 : 5;
+            return true;
+        }
+        if (!strncmp(p, "null", std::min<size_t>(4, end - p))) {
+            p += 4;
+            return true;
+        }
+        char* numberEnd = NULL;
+        value.type = JsonValue::NUMBER;
+        value.number = strtod(p, &numberEnd);
+        if (numberEnd == p) return false;
+        p = numberEnd;
+        return true;
+    }
+};
+
+static bool readReport(const char* fileName, JsonValue& report)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    if (!file) {
+        cerr << "Unable to open benchmark report: " << fileName << endl;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    string text = buffer.str();
+    JsonParser parser(text.data(), text.size());
+    const JsonValue* schema;
+    const JsonValue* version;
+    if (!parser.parse(report) || report.type != JsonValue::OBJECT ||
+        !(schema = report.find("schema")) || schema->text != BENCHMARK_SCHEMA ||
+        !(version = report.find("version")) || int(version->number) != BENCHMARK_VERSION ||
+        !report.find("meshes")) {
+        cerr << "Not a version " << BENCHMARK_VERSION << " benchmark report: " << fileName << endl;
+        return false;
+    }
+    return true;
+}
+
+static string reportField(const JsonValue& report, const char* key)
+{
+    const JsonValue* value = report.find(key);
+    if (!value) return "";
+    if (value->type == JsonValue::STRING) return value->text;
+    std::ostringstream out;
+    out << value->number;
+    return out.str();
+}
+
+static double phaseMedian(const JsonValue& mesh, const char* phase)
+{
+    const JsonValue* phases = mesh.find("phases");
+    const JsonValue* entry = phases ? phases->find(phase) : NULL;
+    const JsonValue* median = entry ? entry->find("median_ms") : NULL;
+    return median && median->type == JsonValue::NUMBER ? median->number : -1.0;
+}
+
+int compareBenchmarks(const char* baselineFile, const char* currentFile, double thresholdPercent)
+{
+    JsonValue baseline, current;
+    if (!readReport(baselineFile, baseline) || !readReport(currentFile, current)) return -1;
+
+    const char* const context[] = { "renderer", "config", "iterations", "repetitions" };
+    for (const char* key : context) {
+        if (reportField(baseline, key) != reportField(current, key)) {
+            cout << "Warning: " << key << " differs (" << reportField(baseline, key) << " vs "
+                << reportField(current, key) << "); timings may not be comparable." << endl;
+        }
+    }
+
+    const vector<JsonValue>& baseMeshes = baseline.find("meshes")->items;
+    const vector<JsonValue>& newMeshes = current.find("meshes")->items;
+    double limit = 1.0 + thresholdPercent / 100.0;
+    int regressions = 0;
+    int compared = 0;
+
+    printf("%-20s %-10s %12s %12s %9s\n", "mesh", "phase", "base ms", "new ms", "change");
+    for (size_t i = 0; i < newMeshes.size(); ++i) {
+        string name = reportField(newMeshes[i], "name");
+        const JsonValue* base = NULL;
+        for (size_t j = 0; j < baseMeshes.size() && !base; ++j) {
+            if (reportField(baseMeshes[j], "name") == name) base = &baseMeshes[j];
+        }
+        if (!base) {
+            printf("%-20s (not in baseline)\n", name.c_str());
+            continue;
+        }
+        if (reportField(*base, "triangles") != reportField(newMeshes[i], "triangles")) {
+            printf("%-20s (different mesh: %s vs %s triangles)\n", name.c_str(),
+                reportField(*base, "triangles").c_str(), reportField(newMeshes[i], "triangles").c_str());
+            continue;
+        }
+        for (int p = 0; p < NUM_PHASES; ++p) {
+            double before = phaseMedian(*base, phaseNames[p]);
+            double after = phaseMedian(newMeshes[i], phaseNames[p]);
+            if (before < 0.0 || after < 0.0) continue;
+            compared++;
+            bool regressed = after > before * limit && after - before >= MIN_REGRESSION_MS;
+            if (regressed) regressions++;
+            printf("%-20s %-10s %12.3f %12.3f %+8.1f%%%s\n", name.c_str(), phaseNames[p], before, after,
+                before > 0.0 ? 100.0 * (after - before) / before : 0.0, regressed ? "  REGRESSION" : "");
+        }
+    }
+    for (size_t j = 0; j < baseMeshes.size(); ++j) {
+        string name = reportField(baseMeshes[j], "name");
+        bool found = false;
+        for (size_t i = 0; i < newMeshes.size() && !found; ++i) found = reportField(newMeshes[i], "name") == name;
+        if (!found) printf("%-20s (missing from %s)\n", name.c_str(), currentFile);
+    }
+
+    printf("%d of %d phase medians regressed by more than %g%%.\n", regressions, compared, thresholdPercent);
+    return regressions;
+}
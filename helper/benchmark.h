@@ -0,0 +1,54 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <functional>
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+class SSBOMesh;
+
+/////////////////////////////////////////////////////////////////////////////
+// Benchmark of the whole mesh path, phase by phase: parse, cleanup (welding,
+// 0 if disabled), adjacency, upload, smoothing (N iterations), readback and
+// write. Every mesh is run
+// 'repetitions' times and each phase reports its median, 95th percentile
+// and minimum. Generated meshes skip parsing (parse is 0). Results are
+// written as JSON:
+//
+//   { "schema": "laplacian-smoothing-benchmark", "version": 1,
+//     "renderer": ..., "config": ..., "iterations": N, "repetitions": R,
+//     "meshes": [ { "name": ..., "vertices": V, "triangles": T,
+//                   "phases": { "parse": { "median_ms": ..., "p95_ms": ...,
+//                                          "min_ms": ... }, ... } }, ... ] }
+//
+// New fields may be added; existing ones keep their meaning while the
+// version stays the same.
+/////////////////////////////////////////////////////////////////////////////
+
+#define BENCHMARK_SCHEMA  "laplacian-smoothing-benchmark"
+#define BENCHMARK_VERSION 1
+
+struct BenchmarkOptions
+{
+    string modelDirectory;     // Every *.obj in it, except the in.obj/out.obj working files
+    vector<string> synthetic;  // Generated meshes (see meshgen.h), e.g. "sphere:8"; loaded from memory
+    int repetitions;
+    int iterations;
+    string outputFile;         // JSON report
+    string config;             // Recorded as is (shader defines, modes)
+};
+
+// Creates a mesh configured for smoothing (program, modes, lock mask) but not loaded.
+typedef std::function<SSBOMesh*()> MeshFactory;
+
+// Requires a current GL context.
+bool runBenchmark(const BenchmarkOptions& options, const MeshFactory& makeMesh);
+
+// Prints every phase whose median grew by more than thresholdPercent (and
+// by at least 0.05 ms) from baselineFile to currentFile. Returns the number
+// of regressions, or -1 if a file cannot be read.
+int compareBenchmarks(const char* baselineFile, const char* currentFile, double thresholdPercent);
+
+#endif // BENCHMARK_H
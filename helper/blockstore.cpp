@@ -0,0 +1,644 @@
+#include "blockstore.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <utility>
+#include <glm/gtc/type_ptr.hpp>
+using std::cerr;
+using std::endl;
+
+// RAM the conversion takes besides one block: a sort run, or the buffers
+// that scatter a stream into per-block regions.
+static const size_t SORT_RUN_BYTES = size_t(64) << 20;
+static const size_t BUCKET_BYTES = size_t(64) << 20;
+
+// The Morton grid that assigns vertices to blocks has about CELLS_PER_BLOCK
+// cells per block, and at most 2^MAX_CELL_BITS cells per axis.
+static const uint64_t CELLS_PER_BLOCK = 64;
+static const int MAX_CELL_BITS = 8;
+
+// Records of the scratch files
+struct Point { float position[3]; };
+struct Triangle { GLuint corners[3]; };
+struct CornerRecord { GLuint vertex; GLuint unused; uint64_t corner; };
+struct CornerPoint { uint64_t corner; float position[3]; GLuint unused; };
+struct BlockVertex { GLuint id; float position[3]; };
+struct Incidence { GLuint vertex; GLuint corners[3]; float positions[9]; };
+
+static bool seekFile(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, int64_t(offset), SEEK_SET) == 0;
+#else
+    return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+static bool readAt(FILE* file, uint64_t offset, void* data, size_t bytes) {
+    return bytes == 0 || (seekFile(file, offset) && fread(data, 1, bytes, file) == bytes);
+}
+
+static bool writeAt(FILE* file, uint64_t offset, const void* data, size_t bytes) {
+    return bytes == 0 || (seekFile(file, offset) && fwrite(data, 1, bytes, file) == bytes);
+}
+
+bool ScratchFile::open(const string& path) {
+    close();
+    handle = fopen(path.c_str(), "w+b");
+    if (handle) filePath = path;
+    return handle != NULL;
+}
+
+void ScratchFile::close() {
+    if (!handle) return;
+    fclose(handle);
+    remove(filePath.c_str());
+    handle = NULL;
+}
+
+// Reads 'count' records starting at record 'first' front to back, in chunks
+// of 'chunk' records. Every chunk is read with its own seek, so several
+// readers can share one file.
+template <typename Record>
+class RecordReader
+{
+private:
+    FILE* file;
+    uint64_t offset;
+    uint64_t remaining;
+    size_t chunk;
+    vector<Record> buffer;
+    size_t position;
+    bool error;
+
+public:
+    RecordReader(FILE* file, uint64_t first, uint64_t count, size_t chunk = 65536)
+        : file(file), offset(first * sizeof(Record)), remaining(count), chunk(std::max<size_t>(chunk, 1)), position(0), error(false) { }
+
+    bool next(Record& record) {
+        if (position == buffer.size()) {
+            if (remaining == 0 || error) return false;
+            buffer.resize(size_t(std::min<uint64_t>(remaining, chunk)));
+            if (!readAt(file, offset, buffer.data(), buffer.size() * sizeof(Record))) {
+                error = true;
+                return false;
+            }
+            offset += buffer.size() * sizeof(Record);
+            remaining -= buffer.size();
+            position = 0;
+        }
+        record = buffer[position++];
+        return true;
+    }
+
+    bool failed() const { return error; }
+};
+
+// Scatters records into consecutive regions of a file, one per bucket. Each
+// bucket is buffered, so a region is written in large sequential pieces.
+template <typename Record>
+class BucketWriter
+{
+private:
+    FILE* file;
+    vector<uint64_t> cursor;       // Next record of each bucket
+    vector<vector<Record>> pending;
+    size_t capacity;
+    bool ok;
+
+    void flush(size_t bucket) {
+        vector<Record>& records = pending[bucket];
+        ok = writeAt(file, cursor[bucket] * sizeof(Record), records.data(), records.size() * sizeof(Record)) && ok;
+        cursor[bucket] += records.size();
+        records.clear();
+    }
+
+public:
+    BucketWriter(FILE* file, const vector<uint64_t>& starts)
+        : file(file), cursor(starts), pending(starts.size()), ok(true)
+    {
+        capacity = std::max<size_t>(BUCKET_BYTES / (sizeof(Record) * std::max<size_t>(starts.size(), 1)), 16);
+    }
+
+    void put(size_t bucket, const Record& record) {
+        pending[bucket].push_back(record);
+        if (pending[bucket].size() >= capacity) flush(bucket);
+    }
+
+    bool finish() {
+        for (size_t bucket = 0; bucket < pending.size(); ++bucket) flush(bucket);
+        return ok && fflush(file) == 0;
+    }
+};
+
+// Sorts the 'count' records of 'in' into 'out'. Runs of SORT_RUN_BYTES are
+// sorted in memory and written to 'runs', then merged in a single pass that
+// reads every run through a buffer of about SORT_RUN_BYTES / runs. One merge
+// pass covers a few thousand runs (hundreds of GB) before the buffers get
+// small enough for the seeks to dominate.
+template <typename Record, typename Less>
+static bool sortRecords(FILE* in, FILE* out, FILE* runs, uint64_t count, Less less)
+{
+    const uint64_t runRecords = std::max<uint64_t>(SORT_RUN_BYTES / sizeof(Record), 1);
+    FILE* target = count <= runRecords ? out : runs;
+    vector<Record> buffer;
+    for (uint64_t start = 0; start < count; start += runRecords) {
+        buffer.resize(size_t(std::min(runRecords, count - start)));
+        size_t bytes = buffer.size() * sizeof(Record);
+        if (!readAt(in, start * sizeof(Record), buffer.data(), bytes)) return false;
+        std::sort(buffer.begin(), buffer.end(), less);
+        if (!writeAt(target, start * sizeof(Record), buffer.data(), bytes)) return false;
+    }
+    if (target == out) return fflush(out) == 0;
+    vector<Record>().swap(buffer);
+    if (fflush(runs) != 0) return false;
+
+    size_t numRuns = size_t((count + runRecords - 1) / runRecords);
+    size_t chunk = size_t(runRecords / numRuns);
+    vector<RecordReader<Record>> readers;
+    readers.reserve(numRuns);
+    for (size_t r = 0; r < numRuns; ++r) {
+        readers.push_back(RecordReader<Record>(runs, r * runRecords, std::min(runRecords, count - r * runRecords), chunk));
+    }
+
+    typedef std::pair<Record, size_t> Head; // Smallest unmerged record of a run
+    auto later = [&](const Head& a, const Head& b) { return less(b.first, a.first); };
+    std::priority_queue<Head, vector<Head>, decltype(later)> heads(later);
+    Record record;
+    for (size_t r = 0; r < numRuns; ++r) {
+        if (readers[r].next(record)) heads.push(Head(record, r));
+    }
+    if (!seekFile(out, 0)) return false;
+    while (!heads.empty()) {
+        Head head = heads.top();
+        heads.pop();
+        if (fwrite(&head.first, sizeof(Record), 1, out) != 1) return false;
+        if (readers[head.second].next(record)) heads.push(Head(record, head.second));
+    }
+    for (size_t r = 0; r < numRuns; ++r) {
+        if (readers[r].failed()) return false;
+    }
+    return fflush(out) == 0;
+}
+
+// OBJ whitespace, as in loadOBJ()
+static bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static char* skipBlanks(char* p) {
+    while (isBlank(*p)) ++p;
+    return p;
+}
+
+static char* skipToken(char* p) {
+    while (*p && !isBlank(*p)) ++p;
+    return p;
+}
+
+// Cells of a Morton grid over the bounding box, 2^bits per axis. Cell codes
+// interleave the x, y and z cell coordinates, so consecutive codes are
+// spatially close.
+struct MortonGrid
+{
+    vec3 lo;
+    vec3 scale;
+    int bits;
+
+    MortonGrid(vec3 lo, vec3 hi, int bits)
+        : lo(lo), scale(float(1u << bits) / glm::max(hi - lo, vec3(1e-30f))), bits(bits) { }
+
+    GLuint cells() const { return 1u << (3 * bits); }
+
+    GLuint cell(const float* position) const {
+        const float last = float((1u << bits) - 1);
+        GLuint code = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            float t = (position[axis] - lo[axis]) * scale[axis];
+            GLuint q = t > 0.0f ? GLuint(std::min(t, last)) : 0u; // NaN goes to cell 0
+            for (int bit = 0; bit < bits; ++bit) code |= ((q >> bit) & 1u) << (3 * bit + axis);
+        }
+        return code;
+    }
+};
+
+static vec3 faceNormal(const float* positions) {
+    vec3 a = glm::make_vec3(positions);
+    vec3 b = glm::make_vec3(positions + 3);
+    vec3 c = glm::make_vec3(positions + 6);
+    vec3 n = glm::cross(b - a, c - a);
+    float len = glm::length(n);
+    return len > 0.0f ? n / len : n;
+}
+
+BlockStore::BlockStore() : current(0), vertices(0), faces(0)
+{
+}
+
+bool BlockStore::openScratch(ScratchFile& file, const char* name) {
+    string path = prefix + "." + name + ".tmp";
+    if (!file.open(path)) {
+        cerr << "Unable to create scratch file: " << path << endl;
+        return false;
+    }
+    return true;
+}
+
+bool BlockStore::build(const char* fileName, const char* scratchPrefix, GLuint blockVertices, float creaseAngle)
+{
+    prefix = scratchPrefix;
+    blockVertices = std::max<GLuint>(blockVertices, 1);
+    blocks.clear();
+    current = 0;
+    vertices = 0;
+    faces = 0;
+
+    std::ifstream objStream(fileName, std::ios::in | std::ios::binary);
+    if (!objStream) {
+        cerr << "Unable to open OBJ file: " << fileName << endl;
+        return false;
+    }
+
+    ScratchFile pointFile, cornerFile, sortedFile, runFile, vertexFile, incidenceFile;
+    if (!openScratch(pointFile, "points") || !openScratch(faceFile, "faces") || !openScratch(cornerFile, "corners")) {
+        return false;
+    }
+
+    // Points and fan-triangulated faces to scratch files, one line at a time.
+    // Every corner is also recorded with its vertex, for the join below.
+    vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    uint64_t numPoints = 0;
+    string lineText;
+    vector<int> face;
+    while (std::getline(objStream, lineText)) {
+        char* p = skipBlanks(&lineText[0]);
+        if (*p == '\0' || *p == '#') continue;
+
+        char* token = p;
+        p = skipBlanks(skipToken(p));
+        size_t tokenLength = skipToken(token) - token;
+
+        if (tokenLength == 1 && token[0] == 'v') {
+            Point point;
+            point.position[0] = strtof(p, &p);
+            point.position[1] = strtof(p, &p);
+            point.position[2] = strtof(p, &p);
+            fwrite(&point, sizeof(point), 1, pointFile.file());
+            lo = glm::min(lo, glm::make_vec3(point.position));
+            hi = glm::max(hi, glm::make_vec3(point.position));
+            numPoints++;
+        }
+        else if (tokenLength == 1 && token[0] == 'f') {
+            face.clear();
+            while (*p) {
+                int pIndex = atoi(p) - 1; // Stops at '/' (texture and normal indices)
+                if (pIndex == -1) printf("Missing point index!!!");
+                else face.push_back(pIndex);
+                p = skipBlanks(skipToken(p));
+            }
+            // Triangle fan (v0, v1, v2), (v0, v2, v3), ...
+            for (size_t i = 2; i < face.size(); ++i) {
+                Triangle triangle = { { GLuint(face[0]), GLuint(face[i - 1]), GLuint(face[i]) } };
+                fwrite(&triangle, sizeof(triangle), 1, faceFile.file());
+                for (int c = 0; c < 3; ++c) {
+                    CornerRecord corner = { triangle.corners[c], 0u, 3 * faces + c };
+                    fwrite(&corner, sizeof(corner), 1, cornerFile.file());
+                }
+                faces++;
+            }
+        }
+    }
+    objStream.close();
+    if (numPoints >= UINT32_MAX) {
+        cerr << "OBJ file has too many vertices for 32-bit indices: " << fileName << endl;
+        return false;
+    }
+    vertices = GLuint(numPoints);
+    if (fflush(pointFile.file()) != 0 || fflush(faceFile.file()) != 0 || fflush(cornerFile.file()) != 0) {
+        cerr << "Failed to write scratch files: " << prefix << ".*.tmp" << endl;
+        return false;
+    }
+    if (vertices == 0 && faces == 0) return true;
+
+    // Blocks: runs of Morton cells of about blockVertices vertices. A cell
+    // is never split, so a block may exceed blockVertices by one cell.
+    int cellBits = 1;
+    uint64_t wantedCells = CELLS_PER_BLOCK * (vertices / blockVertices + 1);
+    while (cellBits < MAX_CELL_BITS && (uint64_t(1) << (3 * cellBits)) < wantedCells) ++cellBits;
+    MortonGrid grid(lo, hi, cellBits);
+
+    vector<GLuint> cellBlock(grid.cells(), 0); // Vertex count first, then owning block
+    RecordReader<Point> points(pointFile.file(), 0, vertices);
+    Point point;
+    while (points.next(point)) cellBlock[grid.cell(point.position)]++;
+
+    Block block = { 0, 0, 0, 0 };
+    for (GLuint cell = 0; cell < grid.cells(); ++cell) {
+        GLuint count = cellBlock[cell];
+        if (count > 0 && block.numVertices > 0 && block.numVertices + uint64_t(count) > blockVertices) {
+            blocks.push_back(block);
+            block.firstVertex += block.numVertices;
+            block.numVertices = 0;
+        }
+        block.numVertices += count;
+        cellBlock[cell] = GLuint(blocks.size());
+    }
+    blocks.push_back(block);
+
+    // Vertices into their blocks, ascending ids within each block
+    if (!openScratch(vertexFile, "vertices")) return false;
+    vector<uint64_t> starts(blocks.size());
+    for (size_t b = 0; b < blocks.size(); ++b) starts[b] = blocks[b].firstVertex;
+    BucketWriter<BlockVertex> vertexWriter(vertexFile.file(), starts);
+    RecordReader<Point> pointsById(pointFile.file(), 0, vertices);
+    for (GLuint v = 0; pointsById.next(point); ++v) {
+        BlockVertex vertex = { v, { point.position[0], point.position[1], point.position[2] } };
+        vertexWriter.put(cellBlock[grid.cell(point.position)], vertex);
+    }
+    if (points.failed() || pointsById.failed() || !vertexWriter.finish()) {
+        cerr << "Failed to write scratch files: " << prefix << ".*.tmp" << endl;
+        return false;
+    }
+
+    // Positions of all corners: sort the corners by vertex, join them with
+    // the points, and sort the result back into face order.
+    if (!openScratch(sortedFile, "sorted") || !openScratch(runFile, "runs")) return false;
+    bool ok = sortRecords<CornerRecord>(cornerFile.file(), sortedFile.file(), runFile.file(), 3 * faces,
+        [](const CornerRecord& a, const CornerRecord& b) { return a.vertex != b.vertex ? a.vertex < b.vertex : a.corner < b.corner; });
+    if (!ok || !openScratch(cornerFile, "corners")) {
+        cerr << "Failed to sort scratch files: " << prefix << ".*.tmp" << endl;
+        return false;
+    }
+    RecordReader<CornerRecord> cornersByVertex(sortedFile.file(), 0, 3 * faces);
+    RecordReader<Point> joinPoints(pointFile.file(), 0, vertices);
+    CornerRecord corner;
+    GLuint joined = 0; // Vertex of 'point' plus one
+    while (cornersByVertex.next(corner)) {
+        if (corner.vertex >= vertices) {
+            cerr << "Face refers to vertex " << uint64_t(corner.vertex) + 1 << " of " << vertices << " in OBJ file: " << fileName << endl;
+            return false;
+        }
+        while (joined <= corner.vertex && joinPoints.next(point)) joined++;
+        CornerPoint cornerPoint = { corner.corner, { point.position[0], point.position[1], point.position[2] }, 0u };
+        fwrite(&cornerPoint, sizeof(cornerPoint), 1, cornerFile.file());
+    }
+    pointFile.close();
+    ok = !cornersByVertex.failed() && !joinPoints.failed() && fflush(cornerFile.file()) == 0 &&
+        openScratch(sortedFile, "sorted") && openScratch(runFile, "runs") &&
+        sortRecords<CornerPoint>(cornerFile.file(), sortedFile.file(), runFile.file(), 3 * faces,
+            [](const CornerPoint& a, const CornerPoint& b) { return a.corner < b.corner; });
+    cornerFile.close();
+    runFile.close();
+    if (!ok) {
+        cerr << "Failed to sort scratch files: " << prefix << ".*.tmp" << endl;
+        return false;
+    }
+
+    // Every face goes to the blocks owning its vertices, with the corner
+    // positions that its normal and the owners of its vertices need.
+    auto forEachIncidence = [&](const std::function<void(GLuint, const Incidence&)>& visit) {
+        RecordReader<Triangle> triangles(faceFile.file(), 0, faces);
+        RecordReader<CornerPoint> cornerPoints(sortedFile.file(), 0, 3 * faces);
+        Triangle triangle;
+        CornerPoint cornerPoint;
+        Incidence incidence;
+        while (triangles.next(triangle)) {
+            for (int c = 0; c < 3; ++c) {
+                if (!cornerPoints.next(cornerPoint)) return false;
+                incidence.corners[c] = triangle.corners[c];
+                std::copy(cornerPoint.position, cornerPoint.position + 3, incidence.positions + 3 * c);
+            }
+            for (int c = 0; c < 3; ++c) {
+                GLuint v = triangle.corners[c];
+                if ((c > 0 && v == triangle.corners[0]) || (c > 1 && v == triangle.corners[1])) continue;
+                incidence.vertex = v;
+                visit(cellBlock[grid.cell(incidence.positions + 3 * c)], incidence);
+            }
+        }
+        return !triangles.failed() && !cornerPoints.failed();
+    };
+    vector<uint64_t> incidenceCount(blocks.size(), 0);
+    ok = forEachIncidence([&](GLuint b, const Incidence&) { incidenceCount[b]++; });
+    starts[0] = 0;
+    for (size_t b = 0; b + 1 < blocks.size(); ++b) starts[b + 1] = starts[b] + incidenceCount[b];
+    if (!ok || !openScratch(incidenceFile, "incidences")) return false;
+    BucketWriter<Incidence> incidenceWriter(incidenceFile.file(), starts);
+    ok = forEachIncidence([&](GLuint b, const Incidence& incidence) { incidenceWriter.put(b, incidence); });
+    sortedFile.close();
+    if (!incidenceWriter.finish() || !ok) {
+        cerr << "Failed to write scratch files: " << prefix << ".*.tmp" << endl;
+        return false;
+    }
+
+    // Block topology, one block at a time: the CSR and feature flags of
+    // generateAdjacencyList(), from the faces incident to each vertex. All
+    // faces around an edge contain both of its vertices, so each vertex sees
+    // every face that decides its boundary and crease bits.
+    if (!openScratch(topologyFile, "topology") || !openScratch(positionFiles[0], "positions0") ||
+        !openScratch(positionFiles[1], "positions1")) {
+        return false;
+    }
+    const float cosCrease = cosf(glm::radians(creaseAngle));
+    uint64_t topologyOffset = 0;
+    vector<BlockVertex> blockVertexRecords;
+    vector<Incidence> incidences;
+    BlockTopology topology;
+    vector<float> positions;
+    vector<std::pair<GLuint, GLuint>> ring;   // Neighbor id and owning block
+    vector<std::pair<uint64_t, size_t>> edges; // Edge key and incidence
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        Block& entry = blocks[b];
+        blockVertexRecords.resize(entry.numVertices);
+        incidences.resize(size_t(incidenceCount[b]));
+        if (!readAt(vertexFile.file(), entry.firstVertex * sizeof(BlockVertex), blockVertexRecords.data(), blockVertexRecords.size() * sizeof(BlockVertex)) ||
+            !readAt(incidenceFile.file(), starts[b] * sizeof(Incidence), incidences.data(), incidences.size() * sizeof(Incidence))) {
+            cerr << "Failed to read scratch files: " << prefix << ".*.tmp" << endl;
+            return false;
+        }
+        std::sort(incidences.begin(), incidences.end(), [](const Incidence& x, const Incidence& y) { return x.vertex < y.vertex; });
+
+        topology.ids.resize(entry.numVertices);
+        topology.spans.assign(entry.numVertices, 0);
+        topology.offsets.assign(entry.numVertices, 0);
+        topology.flags.assign(entry.numVertices, VertexFlags{ 0u, 1.0f });
+        topology.neighbors.clear();
+        topology.neighborBlocks.clear();
+        positions.resize(3 * size_t(entry.numVertices));
+
+        size_t first = 0;
+        for (GLuint s = 0; s < entry.numVertices; ++s) {
+            GLuint v = blockVertexRecords[s].id;
+            topology.ids[s] = v;
+            std::copy(blockVertexRecords[s].position, blockVertexRecords[s].position + 3, positions.begin() + 3 * s);
+            size_t last = first;
+            while (last < incidences.size() && incidences[last].vertex == v) ++last;
+
+            // The other vertices of every incident face, ascending and without duplicates
+            ring.clear();
+            edges.clear();
+            for (size_t k = first; k < last; ++k) {
+                const Incidence& f = incidences[k];
+                for (int c = 0; c < 3; ++c) {
+                    if (f.corners[c] != v) ring.push_back(std::make_pair(f.corners[c], cellBlock[grid.cell(f.positions + 3 * c)]));
+                    GLuint a = f.corners[(c + 1) % 3];
+                    GLuint e = f.corners[(c + 2) % 3];
+                    if (a == v || e == v) edges.push_back(std::make_pair((uint64_t(std::min(a, e)) << 32) | std::max(a, e), k));
+                }
+            }
+            std::sort(ring.begin(), ring.end());
+            ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+            topology.offsets[s] = GLuint(topology.neighbors.size());
+            topology.spans[s] = GLuint(ring.size());
+            for (size_t i = 0; i < ring.size(); ++i) {
+                topology.neighbors.push_back(ring[i].first);
+                topology.neighborBlocks.push_back(ring[i].second);
+            }
+
+            // Edges used by one face are boundaries; by two, creases if the
+            // faces meet at more than the crease angle; by more, non-manifold
+            // features.
+            std::sort(edges.begin(), edges.end());
+            for (size_t i = 0; i < edges.size(); ) {
+                size_t j = i + 1;
+                while (j < edges.size() && edges[j].first == edges[i].first) ++j;
+                if (j - i == 1) {
+                    topology.flags[s].bits |= VERTEX_BOUNDARY;
+                }
+                else if (j - i > 2 || glm::dot(faceNormal(incidences[edges[i].second].positions),
+                    faceNormal(incidences[edges[i + 1].second].positions)) < cosCrease) {
+                    topology.flags[s].bits |= VERTEX_CREASE;
+                }
+                i = j;
+            }
+            first = last;
+        }
+
+        entry.topologyOffset = topologyOffset;
+        entry.numNeighbors = GLuint(topology.neighbors.size());
+        FILE* file = topologyFile.file();
+        size_t n = entry.numVertices, m = entry.numNeighbors;
+        ok = writeAt(file, topologyOffset, topology.ids.data(), n * sizeof(GLuint)) &&
+            fwrite(topology.spans.data(), sizeof(GLuint), n, file) == n &&
+            fwrite(topology.offsets.data(), sizeof(GLuint), n, file) == n &&
+            fwrite(topology.flags.data(), sizeof(VertexFlags), n, file) == n &&
+            fwrite(topology.neighbors.data(), sizeof(GLuint), m, file) == m &&
+            fwrite(topology.neighborBlocks.data(), sizeof(GLuint), m, file) == m &&
+            writeAt(positionFiles[0].file(), entry.firstVertex * 3 * sizeof(float), positions.data(), positions.size() * sizeof(float));
+        if (!ok) {
+            cerr << "Failed to write scratch files: " << prefix << ".*.tmp" << endl;
+            return false;
+        }
+        topologyOffset += n * (3 * sizeof(GLuint) + sizeof(VertexFlags)) + m * 2 * sizeof(GLuint);
+    }
+    return fflush(topologyFile.file()) == 0 && fflush(positionFiles[0].file()) == 0;
+}
+
+bool BlockStore::readIds(size_t block, vector<GLuint>& ids) {
+    ids.resize(blocks[block].numVertices);
+    return readAt(topologyFile.file(), blocks[block].topologyOffset, ids.data(), ids.size() * sizeof(GLuint));
+}
+
+bool BlockStore::readTopology(size_t block, BlockTopology& topology) {
+    const Block& b = blocks[block];
+    size_t n = b.numVertices, m = b.numNeighbors;
+    topology.ids.resize(n);
+    topology.spans.resize(n);
+    topology.offsets.resize(n);
+    topology.flags.resize(n);
+    topology.neighbors.resize(m);
+    topology.neighborBlocks.resize(m);
+    FILE* file = topologyFile.file();
+    return readAt(file, b.topologyOffset, topology.ids.data(), n * sizeof(GLuint)) &&
+        fread(topology.spans.data(), sizeof(GLuint), n, file) == n &&
+        fread(topology.offsets.data(), sizeof(GLuint), n, file) == n &&
+        fread(topology.flags.data(), sizeof(VertexFlags), n, file) == n &&
+        fread(topology.neighbors.data(), sizeof(GLuint), m, file) == m &&
+        fread(topology.neighborBlocks.data(), sizeof(GLuint), m, file) == m;
+}
+
+bool BlockStore::readPositions(size_t block, float* positions) {
+    return readAt(positionFiles[current].file(), blocks[block].firstVertex * 3 * sizeof(float),
+        positions, 3 * size_t(blocks[block].numVertices) * sizeof(float));
+}
+
+bool BlockStore::writePositions(size_t block, const float* positions) {
+    return writeAt(positionFiles[1 - current].file(), blocks[block].firstVertex * 3 * sizeof(float),
+        positions, 3 * size_t(blocks[block].numVertices) * sizeof(float));
+}
+
+bool BlockStore::readAllPositions(float* positions) {
+    vector<GLuint> ids;
+    vector<float> blockPositions;
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        blockPositions.resize(3 * size_t(blocks[b].numVertices));
+        if (!readIds(b, ids) || !readPositions(b, blockPositions.data())) return false;
+        for (size_t s = 0; s < ids.size(); ++s) std::copy(&blockPositions[3 * s], &blockPositions[3 * s] + 3, positions + 3 * size_t(ids[s]));
+    }
+    return true;
+}
+
+bool BlockStore::readAllFaces(GLuint* faceData) {
+    return readAt(faceFile.file(), 0, faceData, size_t(3 * faces * sizeof(GLuint)));
+}
+
+bool BlockStore::writeOBJ(const char* fileName) {
+    // Block order back to id order
+    ScratchFile unsortedFile, sortedFile, runFile;
+    if (!openScratch(unsortedFile, "output") || !openScratch(sortedFile, "sorted") || !openScratch(runFile, "runs")) {
+        return false;
+    }
+    vector<GLuint> ids;
+    vector<float> positions;
+    for (size_t b = 0; b < blocks.size(); ++b) {
+        positions.resize(3 * size_t(blocks[b].numVertices));
+        if (!readIds(b, ids) || !readPositions(b, positions.data()) || !seekFile(unsortedFile.file(), blocks[b].firstVertex * sizeof(BlockVertex))) {
+            cerr << "Failed to read scratch files: " << prefix << ".*.tmp" << endl;
+            return false;
+        }
+        for (size_t s = 0; s < ids.size(); ++s) {
+            BlockVertex vertex = { ids[s], { positions[3 * s], positions[3 * s + 1], positions[3 * s + 2] } };
+            fwrite(&vertex, sizeof(vertex), 1, unsortedFile.file());
+        }
+    }
+    if (fflush(unsortedFile.file()) != 0 || !sortRecords<BlockVertex>(unsortedFile.file(), sortedFile.file(), runFile.file(), vertices,
+        [](const BlockVertex& a, const BlockVertex& b) { return a.id < b.id; })) {
+        cerr << "Failed to sort scratch files: " << prefix << ".*.tmp" << endl;
+        return false;
+    }
+    unsortedFile.close();
+    runFile.close();
+
+    std::ofstream outFile(fileName);
+    if (!outFile) {
+        cerr << "Failed to open OBJ file for writing: " << fileName << endl;
+        return false;
+    }
+
+    RecordReader<BlockVertex> vertexReader(sortedFile.file(), 0, vertices);
+    BlockVertex vertex;
+    while (vertexReader.next(vertex)) {
+        outFile << "v " << vertex.position[0] << " "
+            << vertex.position[1] << " "
+            << vertex.position[2] << "\n";
+    }
+
+    // === Write face information (Remember OBJ file indices are 1-indexed) ===
+    RecordReader<Triangle> faceReader(faceFile.file(), 0, faces);
+    Triangle triangle;
+    while (faceReader.next(triangle)) {
+        outFile << "f " << triangle.corners[0] + 1 << " "
+            << triangle.corners[1] + 1 << " "
+            << triangle.corners[2] + 1 << "\n";
+    }
+
+    outFile.close();
+    if (vertexReader.failed() || faceReader.failed() || !outFile) {
+        cerr << "Failed to write OBJ file: " << fileName << endl;
+        return false;
+    }
+    return true;
+}
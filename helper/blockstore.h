@@ -0,0 +1,127 @@
+#ifndef BLOCKSTORE_H
+#define BLOCKSTORE_H
+
+#include "gldecl.h"
+#include "ssbomesh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+using std::string;
+using std::vector;
+
+// Scratch file that is deleted again when closed
+class ScratchFile
+{
+private:
+    FILE* handle;
+    string filePath;
+
+    // Make these private in order to make the object non-copyable
+    ScratchFile(const ScratchFile& other);
+    ScratchFile& operator=(const ScratchFile& other) { return *this; }
+
+public:
+    ScratchFile() : handle(NULL) { }
+    ~ScratchFile() { close(); }
+
+    bool open(const string& path);
+    void close();
+
+    FILE* file() const { return handle; }
+    const string& path() const { return filePath; }
+};
+
+// One block read back from the block file. Neighbor lists hold global
+// vertex ids in the order of the in-core CSR (ascending), together with the
+// block that owns each neighbor.
+struct BlockTopology
+{
+    vector<GLuint> ids;            // Global ids of the block's vertices, ascending
+    vector<GLuint> spans;
+    vector<GLuint> offsets;
+    vector<VertexFlags> flags;
+    vector<GLuint> neighbors;
+    vector<GLuint> neighborBlocks;
+
+    // Index of global vertex 'id' within the block, which must own it
+    GLuint slot(GLuint id) const { return GLuint(std::lower_bound(ids.begin(), ids.end(), id) - ids.begin()); }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// On-disk, Morton-ordered block file for meshes larger than host memory
+// (see StreamingSmoother). build() converts an OBJ file in sequential passes
+// and external sorts over scratch files, holding at most one block and one
+// sort run in RAM, so the mesh size is bounded by disk.
+//
+// Vertices are binned into the cells of a Morton grid over the bounding
+// box, and a block is a run of consecutive cells; blocks are thus spatially
+// coherent and the owner of any vertex follows from its position. The
+// topology (CSR and feature flags, as generateAdjacencyList() would build
+// them) is written once; positions live in two files that the passes of a
+// Jacobi run read and write alternately.
+/////////////////////////////////////////////////////////////////////////////
+
+class BlockStore
+{
+private:
+    struct Block
+    {
+        uint64_t topologyOffset;   // Byte offset of the block in the topology file
+        uint64_t firstVertex;      // Offset of the block in the position files, in vertices
+        GLuint numVertices;
+        GLuint numNeighbors;
+    };
+
+    string prefix;
+    ScratchFile topologyFile;
+    ScratchFile positionFiles[2];
+    ScratchFile faceFile;          // Triangles in input order, for the output OBJ
+    int current;                   // Position file holding the latest positions
+    vector<Block> blocks;
+    GLuint vertices;
+    uint64_t faces;
+
+    // Make these private in order to make the object non-copyable
+    BlockStore(const BlockStore& other);
+    BlockStore& operator=(const BlockStore& other) { return *this; }
+
+    bool openScratch(ScratchFile& file, const char* name);
+    bool readIds(size_t block, vector<GLuint>& ids);
+
+public:
+    BlockStore();
+
+    // Converts an OBJ file (parsed as loadOBJ() does, without welding) into
+    // blocks of about blockVertices vertices. Scratch files are named
+    // scratchPrefix + ".<part>.tmp"; the ones backing the store are removed
+    // when it is destroyed.
+    bool build(const char* fileName, const char* scratchPrefix, GLuint blockVertices, float creaseAngle);
+
+    size_t numBlocks() const { return blocks.size(); }
+    GLuint blockSize(size_t block) const { return blocks[block].numVertices; }
+    GLuint numVertices() const { return vertices; }
+    uint64_t numFaces() const { return faces; }
+
+    bool readTopology(size_t block, BlockTopology& topology);
+
+    // Latest positions of a block (fp32 xyz, in slot order) and those of the
+    // next pass; swapPositions() makes the next pass current.
+    bool readPositions(size_t block, float* positions);
+    bool writePositions(size_t block, const float* positions);
+    void swapPositions() { current = 1 - current; }
+
+    // Whole-mesh copies in vertex id order. These take O(V) memory and are
+    // meant for verification against the in-core path only.
+    bool readAllPositions(float* positions);
+    bool readAllFaces(GLuint* faces);
+
+    // Writes the latest positions and the faces as loadOBJ() numbered them,
+    // formatted like SSBOMesh::writeOBJ(). Sorts the vertices back into id
+    // order on disk.
+    bool writeOBJ(const char* fileName);
+};
+
+#endif // BLOCKSTORE_H
@@ -0,0 +1,130 @@
+#include "cornertable.h"
+#include "arena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Undirected edge facing a corner, keyed by (min << 32 | max)
+struct EdgeKey
+{
+    uint64_t key;
+    GLuint corner;
+    GLuint unused;
+
+    bool operator<(const EdgeKey& other) const
+    {
+        return key != other.key ? key < other.key : corner < other.corner;
+    }
+};
+
+void parallelTasks(size_t count, const std::function<void(size_t)>& task) {
+    vector<std::thread> workers;
+    for (size_t i = 1; i < count; ++i) workers.emplace_back(task, i);
+    if (count > 0) task(0);
+    for (std::thread& worker : workers) worker.join();
+}
+
+void parallelRanges(size_t count, unsigned threads, const std::function<void(size_t, size_t)>& body) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = unsigned(std::min<size_t>(threads, std::max<size_t>(count / 1024, 1)));
+    vector<std::thread> workers;
+    size_t chunk = (count + threads - 1) / threads;
+    for (unsigned t = 1; t < threads; ++t) {
+        workers.emplace_back(body, std::min(count, t * chunk), std::min(count, (t + 1) * chunk));
+    }
+    body(0, std::min(count, chunk));
+    for (std::thread& worker : workers) worker.join();
+}
+
+void CornerTable::clear() {
+    opposites.clear();
+    vertexCornerOffsets.clear();
+    vertexCorners.clear();
+    boundaryEdges = 0;
+    nonManifoldEdges = 0;
+}
+
+void CornerTable::build(const GLuint* elements, GLuint numFaces, GLuint numVertices, unsigned threads, MonotonicArena* scratch) {
+    clear();
+    const size_t n = 3 * size_t(numFaces);
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Sort keys and the merge buffer
+    vector<EdgeKey> owned;
+    EdgeKey* keys;
+    if (scratch) {
+        keys = static_cast<EdgeKey*>(scratch->allocate(2 * std::max<size_t>(n, 1) * sizeof(EdgeKey), alignof(EdgeKey)));
+    }
+    else {
+        owned.resize(2 * std::max<size_t>(n, 1));
+        keys = owned.data();
+    }
+    EdgeKey* spare = keys + n;
+
+    parallelRanges(n, threads, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            GLuint a = elements[next(GLuint(c))];
+            GLuint b = elements[prev(GLuint(c))];
+            keys[c].key = (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+            keys[c].corner = GLuint(c);
+            keys[c].unused = 0;
+        }
+    });
+
+    // Sort one chunk per thread, then merge neighbouring chunks pairwise
+    size_t chunks = std::min<size_t>(threads, std::max<size_t>(n / 4096, 1));
+    vector<size_t> bounds(chunks + 1);
+    for (size_t i = 0; i <= chunks; ++i) bounds[i] = n * i / chunks;
+    parallelTasks(chunks, [&](size_t i) { std::sort(keys + bounds[i], keys + bounds[i + 1]); });
+    while (bounds.size() > 2) {
+        size_t runs = bounds.size() - 1;
+        parallelTasks((runs + 1) / 2, [&](size_t j) {
+            size_t lo = bounds[2 * j], mid = bounds[std::min(2 * j + 1, runs)], hi = bounds[std::min(2 * j + 2, runs)];
+            std::merge(keys + lo, keys + mid, keys + mid, keys + hi, spare + lo);
+        });
+        vector<size_t> merged;
+        for (size_t i = 0; i < bounds.size(); i += 2) merged.push_back(bounds[i]);
+        if (merged.back() != n) merged.push_back(n);
+        bounds.swap(merged);
+        std::swap(keys, spare);
+    }
+
+    // Runs of equal keys are the corners facing one edge. A thread handles the
+    // runs starting in its range.
+    opposites.assign(n, CORNER_BOUNDARY);
+    std::atomic<size_t> boundary(0), nonManifold(0);
+    parallelRanges(n, threads, [&](size_t begin, size_t end) {
+        size_t i = begin, single = 0, shared = 0;
+        while (i > 0 && i < end && keys[i].key == keys[i - 1].key) ++i;
+        while (i < end) {
+            size_t j = i + 1;
+            while (j < n && keys[j].key == keys[i].key) ++j;
+            if (j - i == 1) {
+                ++single;
+            }
+            else if (j - i == 2) {
+                opposites[keys[i].corner] = keys[i + 1].corner;
+                opposites[keys[i + 1].corner] = keys[i].corner;
+            }
+            else {
+                for (size_t k = i; k < j; ++k) opposites[keys[k].corner] = CORNER_NON_MANIFOLD;
+                ++shared;
+            }
+            i = j;
+        }
+        boundary += single;
+        nonManifold += shared;
+    });
+    boundaryEdges = boundary;
+    nonManifoldEdges = nonManifold;
+
+    // Corners of every vertex (counting sort, ascending corners)
+    vertexCornerOffsets.assign(size_t(numVertices) + 1, 0);
+    for (size_t c = 0; c < n; ++c) vertexCornerOffsets[elements[c] + 1]++;
+    for (GLuint v = 0; v < numVertices; ++v) vertexCornerOffsets[v + 1] += vertexCornerOffsets[v];
+    vertexCorners.resize(n);
+    vector<GLuint> cursor(vertexCornerOffsets.begin(), vertexCornerOffsets.end() - 1);
+    for (size_t c = 0; c < n; ++c) vertexCorners[cursor[elements[c]]++] = GLuint(c);
+}
@@ -0,0 +1,64 @@
+#ifndef CORNERTABLE_H
+#define CORNERTABLE_H
+
+#include "gldecl.h"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+using std::vector;
+
+class MonotonicArena;
+
+/////////////////////////////////////////////////////////////////////////////
+// Corner table (Rossignac) of a triangle mesh. Corner c = 3 * f + k is the
+// k-th corner of face f; next() and prev() walk around the face. Every
+// corner faces the edge between its next and previous corner, and
+// opposites[c] is the corner facing the same edge from the other face, or
+// CORNER_BOUNDARY if no other face uses the edge, or CORNER_NON_MANIFOLD if
+// more than one does. The corners of every vertex are listed in a CSR, so
+// faces around a vertex (corner / 3) and its neighbours (the vertices at
+// next and prev) need no searching.
+//
+// build() pairs the corners by sorting 64-bit edge keys, in parallel chunks
+// merged pairwise. All arrays are flat GLuint arrays that upload as SSBOs
+// as they are; the face elements serve as the vertex of every corner.
+/////////////////////////////////////////////////////////////////////////////
+
+#define CORNER_BOUNDARY     0xFFFFFFFFu
+#define CORNER_NON_MANIFOLD 0xFFFFFFFEu
+
+class CornerTable
+{
+public:
+    vector<GLuint> opposites;            // 3 * faces
+    vector<GLuint> vertexCornerOffsets;  // vertices + 1
+    vector<GLuint> vertexCorners;        // 3 * faces, ascending per vertex
+    size_t boundaryEdges;
+    size_t nonManifoldEdges;             // Edges shared by three or more faces
+
+    CornerTable() : boundaryEdges(0), nonManifoldEdges(0) {}
+
+    // 'threads' = 0 uses every hardware thread. The sort keys are carved
+    // from 'scratch' if given.
+    void build(const GLuint* elements, GLuint numFaces, GLuint numVertices,
+        unsigned threads = 0, MonotonicArena* scratch = NULL);
+    void clear();
+
+    static GLuint next(GLuint c) { return c % 3 == 2 ? c - 2 : c + 1; }
+    static GLuint prev(GLuint c) { return c % 3 == 0 ? c + 2 : c - 1; }
+    static GLuint face(GLuint c) { return c / 3; }
+    bool hasOpposite(GLuint c) const { return opposites[c] < CORNER_NON_MANIFOLD; }
+
+    GLuint cornerBegin(GLuint v) const { return vertexCornerOffsets[v]; }
+    GLuint cornerEnd(GLuint v) const { return vertexCornerOffsets[v + 1]; }
+};
+
+// Runs body(begin, end) over [0, count) split into one contiguous range per
+// thread (0 = every hardware thread); small counts run on fewer threads.
+void parallelRanges(size_t count, unsigned threads, const std::function<void(size_t, size_t)>& body);
+
+// Runs task(i) for i in [0, count), each on its own thread.
+void parallelTasks(size_t count, const std::function<void(size_t)>& task);
+
+#endif // CORNERTABLE_H
@@ -6,6 +6,8 @@ class Drawable
 public:
     Drawable();
 
+    virtual ~Drawable() {}
+
     virtual void render() const = 0;
 };
 
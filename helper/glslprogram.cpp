@@ -115,6 +115,15 @@ string GLSLProgram::getExtension( const char * name ) {
 void GLSLProgram::compileShader( const char * fileName,
     GLSLShader::GLSLShaderType type )
 throw( GLSLProgramException )
+{
+  compileShader( fileName, type, std::vector<string>() );
+}
+
+
+void GLSLProgram::compileShader( const char * fileName,
+    GLSLShader::GLSLShaderType type,
+    const std::vector<string> & defines )
+throw( GLSLProgramException )
 {
   if( ! fileExists(fileName) )
   {
@@ -140,7 +149,24 @@ throw( GLSLProgramException )
   code << inFile.rdbuf();
   inFile.close();
 
-  compileShader(code.str(), type, fileName);
+  compileShader(injectDefines(code.str(), defines), type, fileName);
+}
+
+
+string GLSLProgram::injectDefines( const string & source, const std::vector<string> & defines )
+{
+  if( defines.empty() ) return source;
+
+  string block;
+  for( size_t i = 0; i < defines.size(); i++ )
+    block += "#define " + defines[i] + "\n";
+
+  // #version must stay the first directive
+  size_t pos = source.find("#version");
+  if( pos == string::npos ) return block + source;
+  pos = source.find('\n', pos);
+  if( pos == string::npos ) return source + "\n" + block;
+  return source.substr(0, pos + 1) + block + source.substr(pos + 1);
 }
 
 
@@ -229,6 +255,48 @@ void GLSLProgram::link() throw(GLSLProgramException)
 }
 
 
+void GLSLProgram::setBinaryRetrievable()
+{
+  if( handle <= 0 ) handle = glCreateProgram();
+  glProgramParameteri(handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+
+bool GLSLProgram::getBinary( GLenum & format, std::vector<unsigned char> & data )
+{
+  if( handle <= 0 || !linked ) return false;
+
+  GLint length = 0;
+  glGetProgramiv(handle, GL_PROGRAM_BINARY_LENGTH, &length);
+  if( length <= 0 ) return false;
+
+  data.resize(length);
+  GLsizei written = 0;
+  glGetProgramBinary(handle, length, &written, &format, &data[0]);
+  data.resize(written);
+  return written > 0;
+}
+
+
+bool GLSLProgram::loadBinary( GLenum format, const void * data, GLsizei length )
+{
+  if( handle <= 0 ) {
+    handle = glCreateProgram();
+    if( handle == 0 ) return false;
+  }
+
+  glProgramBinary(handle, format, data, length);
+
+  GLint status = 0;
+  glGetProgramiv( handle, GL_LINK_STATUS, &status );
+  if( status == GL_FALSE ) return false;
+
+  uniformLocations.clear();
+  linked = true;
+  return true;
+}
+
+
 void GLSLProgram::use() throw(GLSLProgramException)
 {
   if( handle <= 0 || (! linked) )
@@ -10,6 +10,7 @@
 #include <string>
 using std::string;
 #include <map>
+#include <vector>
 
 #include <glm/glm.hpp>
 using glm::vec2;
@@ -73,8 +74,20 @@ class GLSLProgram
     void   compileShader( const char * fileName, GLSLShader::GLSLShaderType type ) throw (GLSLProgramException);
     void   compileShader( const string & source, GLSLShader::GLSLShaderType type, 
         const char *fileName = NULL ) throw (GLSLProgramException);
+    void   compileShader( const char * fileName, GLSLShader::GLSLShaderType type,
+        const std::vector<string> & defines ) throw (GLSLProgramException);
+
+    // Inserts "#define <entry>" lines right after the #version directive.
+    static string injectDefines( const string & source, const std::vector<string> & defines );
 
     void   link() throw (GLSLProgramException);
+
+    // Linked program binaries (see ShaderCache). loadBinary() returns false if
+    // the driver rejects the binary; the program can still be compiled normally.
+    // Call setBinaryRetrievable() before link() on programs to be saved.
+    void   setBinaryRetrievable();
+    bool   getBinary( GLenum & format, std::vector<unsigned char> & data );
+    bool   loadBinary( GLenum format, const void * data, GLsizei length );
     void   validate() throw(GLSLProgramException);
     void   use() throw (GLSLProgramException);
 
@@ -0,0 +1,206 @@
+#include "halotransport.h"
+#include "partition.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
+
+struct HaloSegmentHeader
+{
+    GLuint magic;                    // HALO_SEGMENT_MAGIC
+    GLuint ranks;
+    GLuint capacity;                 // Vertices per global array
+    std::atomic<GLuint> aborted;     // Set by a rank that exits early
+    std::atomic<GLuint> arrived;     // Ranks waiting at the barrier
+    std::atomic<GLuint> generation;  // Bumped each time the barrier opens
+};
+
+static HaloSegmentHeader* haloHeader(const SharedMemorySegment& segment)
+{
+    return static_cast<HaloSegmentHeader*>(segment.data());
+}
+
+bool SharedMemoryTransport::create(const char* name, int ranks, GLuint capacity)
+{
+    size_t bytes = sizeof(HaloSegmentHeader) + 2 * 3 * size_t(capacity) * sizeof(float);
+    if (!segment.create(name, bytes)) return false;
+
+    HaloSegmentHeader* header = new (segment.data()) HaloSegmentHeader;
+    header->magic = HALO_SEGMENT_MAGIC;
+    header->ranks = GLuint(ranks);
+    header->capacity = capacity;
+    header->aborted.store(0);
+    header->arrived.store(0);
+    header->generation.store(0);
+    rankId = 0;
+    parity = 0;
+    return true;
+}
+
+GLuint SharedMemoryTransport::capacity() const
+{
+    return haloHeader(segment)->capacity;
+}
+
+int SharedMemoryTransport::size() const
+{
+    return int(haloHeader(segment)->ranks);
+}
+
+float* SharedMemoryTransport::globalPositions(int which)
+{
+    float* first = reinterpret_cast<float*>(haloHeader(segment) + 1);
+    return first + which * 3 * size_t(capacity());
+}
+
+void SharedMemoryTransport::publish(const MeshPartition& part, const vector<float>& local)
+{
+    float* global = globalPositions(parity);
+    for (GLuint i = 0; i < part.numOwned; ++i) {
+        size_t v = part.localToGlobal[i];
+        global[3 * v] = local[3 * i];
+        global[3 * v + 1] = local[3 * i + 1];
+        global[3 * v + 2] = local[3 * i + 2];
+    }
+}
+
+void SharedMemoryTransport::abort()
+{
+    haloHeader(segment)->aborted.store(1);
+}
+
+// True once a forked rank has terminated, for any reason; the child is left
+// for waitpid() to reap and report.
+static bool rankTerminated()
+{
+#ifdef _WIN32
+    return false;
+#else
+    siginfo_t info;
+    info.si_pid = 0;
+    return waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid != 0;
+#endif
+}
+
+void SharedMemoryTransport::barrier()
+{
+    HaloSegmentHeader* header = haloHeader(segment);
+    GLuint generation = header->generation.load();
+    if (header->arrived.fetch_add(1) + 1 == header->ranks) {
+        header->arrived.store(0);
+        header->generation.fetch_add(1);
+    }
+    else {
+        // A rank that is gone never arrives. Ranks that exit through exit()
+        // set the abort flag; rank 0 also notices ranks killed by a signal.
+        while (header->generation.load() == generation) {
+            if (header->aborted.load() || (rankId == 0 && rankTerminated())) {
+                fprintf(stderr, "Error: rank %d: another rank failed, giving up.\n", rankId);
+                exit(EXIT_FAILURE);
+            }
+            std::this_thread::yield();
+        }
+    }
+}
+
+void SharedMemoryTransport::exchange(const MeshPartition& part, vector<float>& local)
+{
+    publish(part, local);
+    barrier();
+
+    const float* global = globalPositions(parity);
+    for (GLuint i = part.numOwned; i < GLuint(part.localToGlobal.size()); ++i) {
+        size_t v = part.localToGlobal[i];
+        local[3 * i] = global[3 * v];
+        local[3 * i + 1] = global[3 * v + 1];
+        local[3 * i + 2] = global[3 * v + 2];
+    }
+    parity ^= 1;
+}
+
+void SharedMemoryTransport::gather(const MeshPartition& part, const vector<float>& local, vector<float>& global)
+{
+    publish(part, local);
+    barrier();
+
+    if (rankId == 0) {
+        const float* all = globalPositions(parity);
+        global.assign(all, all + global.size());
+    }
+    parity ^= 1;
+}
+
+#ifdef HAVE_MPI
+
+MpiTransport::MpiTransport(MPI_Comm communicator) : comm(communicator)
+{
+    MPI_Comm_rank(comm, &rankId);
+    MPI_Comm_size(comm, &ranks);
+}
+
+void MpiTransport::exchange(const MeshPartition& part, vector<float>& local)
+{
+    size_t numPeers = part.peers.size();
+    vector<vector<float> > sendBuffers(numPeers), recvBuffers(numPeers);
+    vector<MPI_Request> requests(2 * numPeers);
+
+    for (size_t p = 0; p < numPeers; ++p) {
+        const vector<GLuint>& recv = part.recvLocal[p];
+        recvBuffers[p].resize(3 * recv.size());
+        MPI_Irecv(recvBuffers[p].data(), int(recvBuffers[p].size()), MPI_FLOAT, part.peers[p], 0, comm, &requests[2 * p]);
+
+        const vector<GLuint>& send = part.sendLocal[p];
+        sendBuffers[p].resize(3 * send.size());
+        for (size_t i = 0; i < send.size(); ++i) {
+            sendBuffers[p][3 * i] = local[3 * send[i]];
+            sendBuffers[p][3 * i + 1] = local[3 * send[i] + 1];
+            sendBuffers[p][3 * i + 2] = local[3 * send[i] + 2];
+        }
+        MPI_Isend(sendBuffers[p].data(), int(sendBuffers[p].size()), MPI_FLOAT, part.peers[p], 0, comm, &requests[2 * p + 1]);
+    }
+    MPI_Waitall(int(requests.size()), requests.data(), MPI_STATUSES_IGNORE);
+
+    for (size_t p = 0; p < numPeers; ++p) {
+        const vector<GLuint>& recv = part.recvLocal[p];
+        for (size_t i = 0; i < recv.size(); ++i) {
+            local[3 * recv[i]] = recvBuffers[p][3 * i];
+            local[3 * recv[i] + 1] = recvBuffers[p][3 * i + 1];
+            local[3 * recv[i] + 2] = recvBuffers[p][3 * i + 2];
+        }
+    }
+}
+
+void MpiTransport::gather(const MeshPartition& part, const vector<float>& local, vector<float>& global)
+{
+    int owned = int(part.numOwned);
+    vector<int> counts(ranks), displs(ranks);
+    MPI_Gather(&owned, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm);
+
+    int total = 0;
+    for (int r = 0; r < ranks; ++r) {
+        displs[r] = total;
+        total += counts[r];
+    }
+    vector<GLuint> ids(rankId == 0 ? total : 0);
+    MPI_Gatherv(part.localToGlobal.data(), owned, MPI_UNSIGNED, ids.data(), counts.data(), displs.data(), MPI_UNSIGNED, 0, comm);
+
+    for (int r = 0; r < ranks; ++r) {
+        counts[r] *= 3;
+        displs[r] *= 3;
+    }
+    vector<float> values(rankId == 0 ? 3 * size_t(total) : 0);
+    MPI_Gatherv(local.data(), 3 * owned, MPI_FLOAT, values.data(), counts.data(), displs.data(), MPI_FLOAT, 0, comm);
+
+    for (size_t i = 0; i < ids.size(); ++i) {
+        global[3 * size_t(ids[i])] = values[3 * i];
+        global[3 * size_t(ids[i]) + 1] = values[3 * i + 1];
+        global[3 * size_t(ids[i]) + 2] = values[3 * i + 2];
+    }
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef HALOTRANSPORT_H
+#define HALOTRANSPORT_H
+
+#include "gldecl.h"
+#include "sharedmem.h"
+
+#include <vector>
+using std::vector;
+
+#ifdef HAVE_MPI
+#include <mpi.h>
+#endif
+
+struct MeshPartition;
+
+/////////////////////////////////////////////////////////////////////////////
+// Moves ghost positions between the ranks of a distributed smoothing run
+// (see DistributedSmoother). 'local' is a rank's fp32 xyz array in the local
+// order of its MeshPartition: owned vertices first, then ghosts. Both calls
+// are collective; every rank must make them in the same order.
+/////////////////////////////////////////////////////////////////////////////
+
+class HaloTransport
+{
+public:
+    virtual ~HaloTransport() { }
+
+    virtual int rank() const = 0;
+    virtual int size() const = 0;
+
+    // Publishes the owned positions of 'local' and overwrites its ghosts with
+    // the current positions from their owners.
+    virtual void exchange(const MeshPartition& part, vector<float>& local) = 0;
+
+    // Scatters every rank's owned positions into 'global' on rank 0.
+    virtual void gather(const MeshPartition& part, const vector<float>& local, vector<float>& global) = 0;
+};
+
+// Identifies a halo segment ("LSHX")
+#define HALO_SEGMENT_MAGIC 0x5848534Cu
+
+/////////////////////////////////////////////////////////////////////////////
+// Transport for ranks on one machine. The segment holds two global position
+// arrays used on alternate calls: every rank writes its owned vertices into
+// the current array, waits on a barrier in the segment and reads its ghosts
+// back. Alternating arrays makes one barrier per iteration enough. The
+// segment is created before the ranks are forked (see main.cpp) and sized
+// for at most 'capacity' vertices. A rank that exits early calls abort();
+// ranks waiting at a barrier then exit with EXIT_FAILURE instead of waiting
+// forever.
+/////////////////////////////////////////////////////////////////////////////
+
+class SharedMemoryTransport : public HaloTransport
+{
+private:
+    SharedMemorySegment segment;
+    int rankId;
+    int parity;                // Global array used by the next call
+
+    // Make these private in order to make the object non-copyable
+    SharedMemoryTransport(const SharedMemoryTransport& other) { }
+    SharedMemoryTransport& operator=(const SharedMemoryTransport& other) { return *this; }
+
+    float* globalPositions(int which);
+    void publish(const MeshPartition& part, const vector<float>& local);
+    void barrier();
+
+public:
+    SharedMemoryTransport() : rankId(0), parity(0) { }
+
+    bool create(const char* name, int ranks, GLuint capacity);
+    void setRank(int r) { rankId = r; }
+    GLuint capacity() const;
+    void abort();
+
+    int rank() const { return rankId; }
+    int size() const;
+    void exchange(const MeshPartition& part, vector<float>& local);
+    void gather(const MeshPartition& part, const vector<float>& local, vector<float>& global);
+};
+
+#ifdef HAVE_MPI
+/////////////////////////////////////////////////////////////////////////////
+// Transport over MPI: point-to-point messages with each peer rank carrying
+// only the positions on the shared boundary.
+/////////////////////////////////////////////////////////////////////////////
+
+class MpiTransport : public HaloTransport
+{
+private:
+    MPI_Comm comm;
+    int rankId;
+    int ranks;
+
+public:
+    MpiTransport(MPI_Comm communicator = MPI_COMM_WORLD);
+
+    int rank() const { return rankId; }
+    int size() const { return ranks; }
+    void exchange(const MeshPartition& part, vector<float>& local);
+    void gather(const MeshPartition& part, const vector<float>& local, vector<float>& global);
+};
+#endif
+
+#endif // HALOTRANSPORT_H
@@ -0,0 +1,254 @@
+#include "meshclean.h"
+#include "cornertable.h"
+#include "arena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+template <typename T>
+static T* scratchArray(MonotonicArena& scratch, size_t count)
+{
+    return static_cast<T*>(scratch.allocate(std::max<size_t>(count, 1) * sizeof(T), alignof(T)));
+}
+
+static uint64_t mixKey(uint64_t h)
+{
+    // SplitMix64 finalizer
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+static uint64_t cellKey(int64_t x, int64_t y, int64_t z)
+{
+    return mixKey(uint64_t(x) * 0x9e3779b97f4a7c15ull ^ mixKey(uint64_t(y) + 0x632be59bd9b4e019ull * uint64_t(z)));
+}
+
+// Items [0, count) grouped by bucket(i) & mask as a CSR: the items of bucket b
+// are items[offsets[b] .. offsets[b + 1]), in no particular order.
+struct BucketIndex
+{
+    GLuint* offsets;
+    GLuint* items;
+};
+
+static BucketIndex buildBuckets(size_t count, size_t buckets, const std::function<size_t(size_t)>& bucket,
+    MonotonicArena& scratch, unsigned threads)
+{
+    BucketIndex index;
+    index.offsets = scratchArray<GLuint>(scratch, buckets + 1);
+    index.items = scratchArray<GLuint>(scratch, count);
+    std::atomic<GLuint>* cursor = scratchArray<std::atomic<GLuint>>(scratch, buckets);
+    for (size_t b = 0; b < buckets; ++b) new (&cursor[b]) std::atomic<GLuint>(0);
+
+    GLuint* itemBucket = scratchArray<GLuint>(scratch, count);
+    parallelRanges(count, threads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            itemBucket[i] = GLuint(bucket(i));
+            cursor[itemBucket[i]].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    index.offsets[0] = 0;
+    for (size_t b = 0; b < buckets; ++b) {
+        index.offsets[b + 1] = index.offsets[b] + cursor[b].load(std::memory_order_relaxed);
+        cursor[b].store(index.offsets[b], std::memory_order_relaxed);
+    }
+    parallelRanges(count, threads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            index.items[cursor[itemBucket[i]].fetch_add(1, std::memory_order_relaxed)] = GLuint(i);
+        }
+    });
+    return index;
+}
+
+// Power of two at least 'count', so a bucket is a mask of the hash
+static size_t bucketCount(size_t count)
+{
+    size_t buckets = 1;
+    while (buckets < count) buckets <<= 1;
+    return buckets;
+}
+
+CleanupPlan planCleanup(const float* positions, GLuint numVertices, const GLuint* faces, GLuint numFaces, float epsilon,
+    MonotonicArena& scratch, unsigned threads)
+{
+    CleanupPlan plan = { { 0, 0, 0 }, NULL, NULL };
+    const size_t n = numVertices;
+
+    // === Welding ===
+    GLuint* root = scratchArray<GLuint>(scratch, n);
+    if (n > 0) {
+        float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        std::mutex boundsLock;
+        parallelRanges(n, threads, [&](size_t begin, size_t end) {
+            float rangeLo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, rangeHi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+            for (size_t v = begin; v < end; ++v) {
+                for (int k = 0; k < 3; ++k) {
+                    rangeLo[k] = std::min(rangeLo[k], positions[3 * v + k]);
+                    rangeHi[k] = std::max(rangeHi[k], positions[3 * v + k]);
+                }
+            }
+            std::lock_guard<std::mutex> guard(boundsLock);
+            for (int k = 0; k < 3; ++k) {
+                lo[k] = std::min(lo[k], rangeLo[k]);
+                hi[k] = std::max(hi[k], rangeHi[k]);
+            }
+        });
+
+        double diagonal = std::sqrt(double(hi[0] - lo[0]) * (hi[0] - lo[0]) + double(hi[1] - lo[1]) * (hi[1] - lo[1]) +
+            double(hi[2] - lo[2]) * (hi[2] - lo[2]));
+        if (epsilon <= 0.0f) epsilon = float(1e-6 * diagonal);
+
+        // Cells of at least epsilon, so any vertex in reach lies in one of the
+        // 27 cells around; never so small that cell coordinates get out of range
+        double extent = std::max(double(hi[0] - lo[0]), std::max(double(hi[1] - lo[1]), double(hi[2] - lo[2])));
+        double cell = std::max(std::max(double(epsilon), extent * 1e-12), 1e-30);
+        auto cellOf = [&](size_t v, int k) { return int64_t(std::floor((positions[3 * v + k] - lo[k]) / cell)); };
+        const size_t mask = bucketCount(n) - 1;
+        BucketIndex grid = buildBuckets(n, mask + 1, [&](size_t v) {
+            return size_t(cellKey(cellOf(v, 0), cellOf(v, 1), cellOf(v, 2))) & mask;
+        }, scratch, threads);
+
+        // Each vertex points at the lowest vertex in reach (possibly itself)
+        GLuint* jumped = scratchArray<GLuint>(scratch, n);
+        const float reach = epsilon * epsilon;
+        parallelRanges(n, threads, [&](size_t begin, size_t end) {
+            for (size_t v = begin; v < end; ++v) {
+                int64_t cx = cellOf(v, 0), cy = cellOf(v, 1), cz = cellOf(v, 2);
+                GLuint best = GLuint(v);
+                for (int dx = -1; dx <= 1; ++dx) for (int dy = -1; dy <= 1; ++dy) for (int dz = -1; dz <= 1; ++dz) {
+                    size_t b = size_t(cellKey(cx + dx, cy + dy, cz + dz)) & mask;
+                    for (GLuint k = grid.offsets[b]; k < grid.offsets[b + 1]; ++k) {
+                        GLuint u = grid.items[k];
+                        if (u >= best) continue;
+                        float ex = positions[3 * u] - positions[3 * v];
+                        float ey = positions[3 * u + 1] - positions[3 * v + 1];
+                        float ez = positions[3 * u + 2] - positions[3 * v + 2];
+                        if (ex * ex + ey * ey + ez * ez <= reach) best = u;
+                    }
+                }
+                root[v] = best;
+            }
+        });
+
+        // Pointer jumping until every vertex points at the root of its chain
+        for (bool changed = true; changed; ) {
+            std::atomic<bool> any(false);
+            parallelRanges(n, threads, [&](size_t begin, size_t end) {
+                bool moved = false;
+                for (size_t v = begin; v < end; ++v) {
+                    jumped[v] = root[root[v]];
+                    moved |= jumped[v] != root[v];
+                }
+                if (moved) any = true;
+            });
+            std::swap(root, jumped);
+            changed = any;
+        }
+        for (size_t v = 0; v < n; ++v) {
+            if (root[v] != v) plan.stats.weldedVertices++;
+        }
+    }
+    plan.root = root;
+
+    // === Degenerate and duplicate faces ===
+    // Faces are compared over the roots of their vertices, i.e. as they are
+    // after welding, without rewriting them.
+    const size_t f = numFaces;
+    uint8_t* degenerate = scratchArray<uint8_t>(scratch, f);
+    plan.dropFace = degenerate;
+    if (f == 0) return plan;
+    uint8_t* duplicate = scratchArray<uint8_t>(scratch, f);
+    uint64_t* sortedKey = scratchArray<uint64_t>(scratch, f);
+    auto sortedCorners = [&](size_t face, GLuint* s) {
+        s[0] = root[faces[3 * face]]; s[1] = root[faces[3 * face + 1]]; s[2] = root[faces[3 * face + 2]];
+        if (s[0] > s[1]) std::swap(s[0], s[1]);
+        if (s[1] > s[2]) std::swap(s[1], s[2]);
+        if (s[0] > s[1]) std::swap(s[0], s[1]);
+    };
+    parallelRanges(f, threads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            GLuint s[3];
+            sortedCorners(i, s);
+            degenerate[i] = s[0] == s[1] || s[1] == s[2];
+            duplicate[i] = 0;
+            sortedKey[i] = mixKey((uint64_t(s[0]) << 32 | s[1]) ^ mixKey(s[2]));
+        }
+    });
+    const size_t faceMask = bucketCount(f) - 1;
+    BucketIndex same = buildBuckets(f, faceMask + 1, [&](size_t i) { return size_t(sortedKey[i]) & faceMask; }, scratch, threads);
+
+    // A face is a duplicate if a lower-index face has the same vertices
+    parallelRanges(f, threads, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (degenerate[i]) continue;
+            GLuint s[3], t[3];
+            sortedCorners(i, s);
+            size_t b = size_t(sortedKey[i]) & faceMask;
+            for (GLuint k = same.offsets[b]; k < same.offsets[b + 1]; ++k) {
+                GLuint g = same.items[k];
+                if (g >= i || degenerate[g] || sortedKey[g] != sortedKey[i]) continue;
+                sortedCorners(g, t);
+                if (s[0] == t[0] && s[1] == t[1] && s[2] == t[2]) {
+                    duplicate[i] = 1;
+                    break;
+                }
+            }
+        }
+    });
+
+    for (size_t i = 0; i < f; ++i) {
+        if (degenerate[i]) plan.stats.degenerateFaces++;
+        else if (duplicate[i]) {
+            plan.stats.duplicateFaces++;
+            degenerate[i] = 1;
+        }
+    }
+    return plan;
+}
+
+void applyCleanup(const CleanupPlan& plan, const float* positions, GLuint& numVertices, const GLuint* faces,
+    GLuint& numFaces, float* cleanPositions, GLuint* cleanFaces, MonotonicArena& scratch)
+{
+    // Compact the roots in order; every vertex takes its root's new index.
+    // Entries only move down, so the output may be the input.
+    const size_t n = numVertices;
+    GLuint* remap = scratchArray<GLuint>(scratch, n);
+    GLuint kept = 0;
+    for (size_t v = 0; v < n; ++v) {
+        if (plan.root[v] != v) continue;
+        remap[v] = kept;
+        if (cleanPositions != positions || kept != v) {
+            std::copy(positions + 3 * v, positions + 3 * v + 3, cleanPositions + 3 * size_t(kept));
+        }
+        kept++;
+    }
+    for (size_t v = 0; v < n; ++v) remap[v] = remap[plan.root[v]];
+    numVertices = kept;
+
+    GLuint keptFaces = 0;
+    for (size_t i = 0; i < numFaces; ++i) {
+        if (plan.dropFace[i]) continue;
+        GLuint a = remap[faces[3 * i]], b = remap[faces[3 * i + 1]], c = remap[faces[3 * i + 2]];
+        cleanFaces[3 * size_t(keptFaces)] = a;
+        cleanFaces[3 * size_t(keptFaces) + 1] = b;
+        cleanFaces[3 * size_t(keptFaces) + 2] = c;
+        keptFaces++;
+    }
+    numFaces = keptFaces;
+}
+
+CleanupStats cleanMesh(float* positions, GLuint& numVertices, GLuint* faces, GLuint& numFaces, float epsilon,
+    MonotonicArena& scratch, unsigned threads)
+{
+    CleanupPlan plan = planCleanup(positions, numVertices, faces, numFaces, epsilon, scratch, threads);
+    if (cleanupNeeded(plan.stats)) applyCleanup(plan, positions, numVertices, faces, numFaces, positions, faces, scratch);
+    return plan.stats;
+}
@@ -0,0 +1,86 @@
+#ifndef MESHCLEAN_H
+#define MESHCLEAN_H
+
+#include "gldecl.h"
+
+#include <cstdint>
+
+class MonotonicArena;
+
+/////////////////////////////////////////////////////////////////////////////
+// Load-time cleanup of a triangle soup, so seams duplicated by STL and OBJ
+// exporters do not become disconnected islands:
+//
+//  1. Welding: vertices within 'epsilon' of each other are merged (<= 0:
+//     1e-6 times the bounding box diagonal, which catches seams written as
+//     repeated coordinates). Vertices are hashed into a grid of
+//     epsilon-sized cells; each one is joined to the lowest-index vertex in
+//     reach in the 27 surrounding cells, and the resulting chains are
+//     collapsed to their lowest vertex, so the result does not depend on the
+//     number of threads. A welded vertex keeps the position of that lowest
+//     vertex.
+//  2. Faces that collapse to an edge or a point (repeated vertices) are
+//     dropped, as are faces over the same three vertices as an earlier
+//     face (either orientation).
+//
+// cleanMesh() compacts both arrays in place, keeping the order of what
+// remains, and updates the counts. Unreferenced vertices are kept. Every
+// pass is a linear sweep, multithreaded but for the final compaction;
+// temporaries come from 'scratch'.
+//
+// The detection (planCleanup) only reads the arrays, so a caller that does
+// not own them (e.g. a shared memory segment) copies them only when
+// cleanupNeeded() says there is something to weld or drop.
+/////////////////////////////////////////////////////////////////////////////
+
+struct CleanupStats
+{
+    GLuint weldedVertices;     // Vertices merged into another one
+    GLuint degenerateFaces;
+    GLuint duplicateFaces;
+};
+
+inline bool cleanupNeeded(const CleanupStats& stats)
+{
+    return stats.weldedVertices > 0 || stats.degenerateFaces > 0 || stats.duplicateFaces > 0;
+}
+
+// What cleanMesh() would do, in arrays carved from the scratch arena
+struct CleanupPlan
+{
+    CleanupStats stats;
+    const GLuint* root;        // Per vertex: the vertex it is welded into (itself if kept)
+    const uint8_t* dropFace;   // Per face: degenerate or duplicate
+};
+
+CleanupPlan planCleanup(
+    const float* positions,
+    GLuint numVertices,
+    const GLuint* faces,
+    GLuint numFaces,
+    float epsilon,
+    MonotonicArena& scratch,
+    unsigned threads = 0);
+
+// Writes the cleaned mesh to cleanPositions/cleanFaces (which may be the
+// input arrays) and updates the counts.
+void applyCleanup(
+    const CleanupPlan& plan,
+    const float* positions,
+    GLuint& numVertices,
+    const GLuint* faces,
+    GLuint& numFaces,
+    float* cleanPositions,
+    GLuint* cleanFaces,
+    MonotonicArena& scratch);
+
+CleanupStats cleanMesh(
+    float* positions,
+    GLuint& numVertices,
+    GLuint* faces,
+    GLuint& numFaces,
+    float epsilon,
+    MonotonicArena& scratch,
+    unsigned threads = 0);
+
+#endif // MESHCLEAN_H
@@ -0,0 +1,266 @@
+#include "meshgen.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include <iostream>
+using std::cerr;
+using std::endl;
+
+// SplitMix64: tiny, and unlike the <random> distributions it produces the
+// same sequence with every standard library.
+class MeshRandom
+{
+private:
+    uint64_t state;
+
+public:
+    explicit MeshRandom(uint64_t seed) : state(seed) {}
+
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [-1, 1)
+    float signedUnit() { return float(next() >> 40) / float(1 << 23) - 1.0f; }
+    // Uniform in [0, n)
+    GLuint below(GLuint n) { return GLuint(next() % n); }
+};
+
+void generateGrid(GLuint cellsPerSide, GeneratedMesh& mesh)
+{
+    GLuint n = std::max<GLuint>(cellsPerSide, 1);
+    GLuint side = n + 1;
+    mesh.positions.resize(3 * size_t(side) * side);
+    mesh.faces.clear();
+    mesh.faces.reserve(6 * size_t(n) * n);
+
+    for (GLuint y = 0; y < side; ++y) {
+        for (GLuint x = 0; x < side; ++x) {
+            float* p = &mesh.positions[3 * (size_t(y) * side + x)];
+            p[0] = float(x) / n;
+            p[1] = float(y) / n;
+            p[2] = 0.0f;
+        }
+    }
+    for (GLuint y = 0; y < n; ++y) {
+        for (GLuint x = 0; x < n; ++x) {
+            GLuint v = y * side + x;
+            const GLuint quad[6] = { v, v + 1, v + side + 1, v, v + side + 1, v + side };
+            mesh.faces.insert(mesh.faces.end(), quad, quad + 6);
+        }
+    }
+}
+
+void generateNoisyGrid(GLuint cellsPerSide, float amplitude, unsigned seed, GeneratedMesh& mesh)
+{
+    generateGrid(cellsPerSide, mesh);
+    MeshRandom random(seed);
+    float scale = amplitude / std::max<GLuint>(cellsPerSide, 1);
+    for (size_t i = 0; i < mesh.positions.size(); ++i) {
+        mesh.positions[i] += scale * random.signedUnit();
+    }
+}
+
+void generateRandomValence(GLuint cellsPerSide, unsigned seed, GeneratedMesh& mesh)
+{
+    generateGrid(cellsPerSide, mesh);
+    MeshRandom random(seed);
+    GLuint n = std::max<GLuint>(cellsPerSide, 1);
+    GLuint side = n + 1;
+
+    // Jitter in the plane by less than half a cell, so no triangle flips
+    float scale = 0.3f / n;
+    for (size_t i = 0; i < mesh.positions.size(); i += 3) {
+        mesh.positions[i] += scale * random.signedUnit();
+        mesh.positions[i + 1] += scale * random.signedUnit();
+    }
+    for (GLuint y = 0; y < n; ++y) {
+        for (GLuint x = 0; x < n; ++x) {
+            if (random.next() & 1) continue;
+            // Split along the other diagonal
+            GLuint v = y * side + x;
+            const GLuint quad[6] = { v, v + 1, v + side, v + 1, v + side + 1, v + side };
+            std::copy(quad, quad + 6, &mesh.faces[6 * (size_t(y) * n + x)]);
+        }
+    }
+}
+
+void generateTorus(GLuint ringSegments, GLuint tubeSegments, GeneratedMesh& mesh)
+{
+    const float majorRadius = 1.0f, minorRadius = 0.3f;
+    const float twoPi = 6.28318530718f;
+    GLuint ring = std::max<GLuint>(ringSegments, 3);
+    GLuint tube = std::max<GLuint>(tubeSegments, 3);
+    mesh.positions.resize(3 * size_t(ring) * tube);
+    mesh.faces.clear();
+    mesh.faces.reserve(6 * size_t(ring) * tube);
+
+    for (GLuint i = 0; i < ring; ++i) {
+        float u = twoPi * i / ring;
+        for (GLuint j = 0; j < tube; ++j) {
+            float w = twoPi * j / tube;
+            float* p = &mesh.positions[3 * (size_t(i) * tube + j)];
+            p[0] = (majorRadius + minorRadius * cosf(w)) * cosf(u);
+            p[1] = (majorRadius + minorRadius * cosf(w)) * sinf(u);
+            p[2] = minorRadius * sinf(w);
+        }
+    }
+    for (GLuint i = 0; i < ring; ++i) {
+        GLuint i1 = (i + 1) % ring;
+        for (GLuint j = 0; j < tube; ++j) {
+            GLuint j1 = (j + 1) % tube;
+            const GLuint quad[6] = { i * tube + j, i1 * tube + j, i1 * tube + j1, i * tube + j, i1 * tube + j1, i * tube + j1 };
+            mesh.faces.insert(mesh.faces.end(), quad, quad + 6);
+        }
+    }
+}
+
+void generateIcosphere(int subdivisions, GeneratedMesh& mesh)
+{
+    const float t = (1.0f + sqrtf(5.0f)) / 2.0f;
+    const float corners[12][3] = {
+        { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+        { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+        { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 }
+    };
+    const GLuint triangles[20][3] = {
+        { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+        { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+        { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+        { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+    };
+
+    // Unit-sphere vertices; each subdivision splits every triangle in four
+    // at the (projected) edge midpoints, shared through an edge map.
+    vector<float>& positions = mesh.positions;
+    positions.clear();
+    auto addVertex = [&](float x, float y, float z) {
+        float length = sqrtf(x * x + y * y + z * z);
+        positions.push_back(x / length);
+        positions.push_back(y / length);
+        positions.push_back(z / length);
+        return GLuint(positions.size() / 3 - 1);
+    };
+    for (int i = 0; i < 12; ++i) addVertex(corners[i][0], corners[i][1], corners[i][2]);
+    mesh.faces.assign(&triangles[0][0], &triangles[0][0] + 60);
+
+    for (int level = 0; level < subdivisions; ++level) {
+        std::unordered_map<uint64_t, GLuint> midpoints;
+        midpoints.reserve(mesh.faces.size());
+        auto midpoint = [&](GLuint a, GLuint b) {
+            uint64_t key = (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+            auto found = midpoints.find(key);
+            if (found != midpoints.end()) return found->second;
+            GLuint m = addVertex((positions[3 * a] + positions[3 * b]) / 2,
+                (positions[3 * a + 1] + positions[3 * b + 1]) / 2,
+                (positions[3 * a + 2] + positions[3 * b + 2]) / 2);
+            midpoints[key] = m;
+            return m;
+        };
+
+        vector<GLuint> next;
+        next.reserve(4 * mesh.faces.size());
+        for (size_t f = 0; f < mesh.faces.size(); f += 3) {
+            GLuint a = mesh.faces[f], b = mesh.faces[f + 1], c = mesh.faces[f + 2];
+            GLuint ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            const GLuint split[12] = { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca };
+            next.insert(next.end(), split, split + 12);
+        }
+        mesh.faces.swap(next);
+    }
+}
+
+void shuffleVertices(GeneratedMesh& mesh, unsigned seed)
+{
+    GLuint count = mesh.numVertices();
+    vector<GLuint> newIndex(count);
+    for (GLuint i = 0; i < count; ++i) newIndex[i] = i;
+    MeshRandom random(seed);
+    for (GLuint i = count; i > 1; --i) {
+        std::swap(newIndex[i - 1], newIndex[random.below(i)]);
+    }
+
+    vector<float> positions(mesh.positions.size());
+    for (GLuint i = 0; i < count; ++i) {
+        std::copy(&mesh.positions[3 * size_t(i)], &mesh.positions[3 * size_t(i)] + 3, &positions[3 * size_t(newIndex[i])]);
+    }
+    mesh.positions.swap(positions);
+    for (size_t i = 0; i < mesh.faces.size(); ++i) mesh.faces[i] = newIndex[mesh.faces[i]];
+}
+
+bool generateFromSpec(const string& spec, GeneratedMesh& mesh)
+{
+    size_t colon = spec.find(':');
+    size_t comma = spec.find(',');
+    string kind = spec.substr(0, std::min(colon, comma));
+    long size = colon == string::npos || colon > comma ? -1 : strtol(spec.c_str() + colon + 1, NULL, 10);
+
+    bool shuffle = false;
+    unsigned seed = 1;
+    while (comma != string::npos) {
+        size_t next = spec.find(',', comma + 1);
+        string option = spec.substr(comma + 1, next == string::npos ? string::npos : next - comma - 1);
+        if (option == "shuffle") {
+            shuffle = true;
+        }
+        else if (option.compare(0, 5, "seed=") == 0) {
+            seed = unsigned(strtoul(option.c_str() + 5, NULL, 10));
+        }
+        else {
+            cerr << "Unknown mesh option: " << option << " in " << spec << endl;
+            return false;
+        }
+        comma = next;
+    }
+
+    // Sizes are capped so that the index count (3 per triangle, 6N^2 for the
+    // quad meshes, 60 * 4^K for the sphere) fits in 32 bits
+    bool quadsFit = size >= 1 && 6 * uint64_t(size) * uint64_t(size) <= UINT32_MAX;
+    if (kind == "grid" && quadsFit) {
+        generateGrid(GLuint(size), mesh);
+    }
+    else if (kind == "noisy" && quadsFit) {
+        generateNoisyGrid(GLuint(size), 0.5f, seed, mesh);
+    }
+    else if (kind == "random" && quadsFit) {
+        generateRandomValence(GLuint(size), seed, mesh);
+    }
+    else if (kind == "torus" && size >= 3 && quadsFit) {
+        generateTorus(GLuint(size), GLuint(size), mesh);
+    }
+    else if (kind == "sphere" && size >= 0 && size <= 12) {
+        generateIcosphere(int(size), mesh);
+    }
+    else {
+        cerr << "Unknown mesh spec: " << spec << " (expected grid:N, noisy:N, random:N or torus:N with N <= 26754, or sphere:K with K <= 12)" << endl;
+        return false;
+    }
+    if (shuffle) shuffleVertices(mesh, seed);
+    return true;
+}
+
+bool writeGeneratedOBJ(const char* fileName, const GeneratedMesh& mesh)
+{
+    FILE* file = fopen(fileName, "w");
+    if (!file) {
+        cerr << "Unable to write OBJ file: " << fileName << endl;
+        return false;
+    }
+    for (size_t i = 0; i < mesh.positions.size(); i += 3) {
+        fprintf(file, "v %.7g %.7g %.7g\n", mesh.positions[i], mesh.positions[i + 1], mesh.positions[i + 2]);
+    }
+    for (size_t i = 0; i < mesh.faces.size(); i += 3) {
+        fprintf(file, "f %u %u %u\n", mesh.faces[i] + 1, mesh.faces[i + 1] + 1, mesh.faces[i + 2] + 1);
+    }
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
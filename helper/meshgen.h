@@ -0,0 +1,52 @@
+#ifndef MESHGEN_H
+#define MESHGEN_H
+
+#include "gldecl.h"
+
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+/////////////////////////////////////////////////////////////////////////////
+// Synthetic meshes for scaling studies, as flat fp32 xyz positions and
+// 0-indexed triangle corners: the arrays SSBOMesh::loadArrays() takes, so a
+// mesh of any size is smoothed without going through an OBJ file. A mesh is
+// named by a spec string "<kind>:<size>[,shuffle][,seed=S]":
+//
+//     grid:N      N x N quads on the unit square, 2N^2 triangles
+//     noisy:N     grid:N with every vertex displaced by up to half a cell
+//     random:N    grid:N with jittered vertices and a random diagonal in
+//                 each quad, so interior valences range from 4 to 8
+//     torus:N     N x N quads around a torus, 2N^2 triangles, no boundary
+//     sphere:K    icosphere with K subdivisions, 20 * 4^K triangles
+//
+// 'shuffle' randomly permutes the vertex order to destroy the locality of
+// the generated layout. Random choices come from a fixed-seed generator, so
+// a spec always yields the same mesh on every platform.
+/////////////////////////////////////////////////////////////////////////////
+
+struct GeneratedMesh
+{
+    vector<float> positions;
+    vector<GLuint> faces;
+
+    GLuint numVertices() const { return GLuint(positions.size() / 3); }
+    GLuint numFaces() const { return GLuint(faces.size() / 3); }
+};
+
+void generateGrid(GLuint cellsPerSide, GeneratedMesh& mesh);
+void generateNoisyGrid(GLuint cellsPerSide, float amplitude, unsigned seed, GeneratedMesh& mesh);
+void generateRandomValence(GLuint cellsPerSide, unsigned seed, GeneratedMesh& mesh);
+void generateTorus(GLuint ringSegments, GLuint tubeSegments, GeneratedMesh& mesh);
+void generateIcosphere(int subdivisions, GeneratedMesh& mesh);
+
+// Renumbers the vertices in a random order (faces are remapped to match).
+void shuffleVertices(GeneratedMesh& mesh, unsigned seed);
+
+// Returns false (with a message) for an unknown kind, option or a bad size.
+bool generateFromSpec(const string& spec, GeneratedMesh& mesh);
+
+bool writeGeneratedOBJ(const char* fileName, const GeneratedMesh& mesh);
+
+#endif // MESHGEN_H
@@ -0,0 +1,179 @@
+#include "meshpreview.h"
+#include "glslprogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+using std::cerr;
+using std::endl;
+#include <vector>
+using std::vector;
+#include <glm/gtc/matrix_transform.hpp>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+// Samples of the multisampled target (fewer if the driver has fewer)
+static const GLint PREVIEW_SAMPLES = 4;
+
+MeshPreview::MeshPreview(const char* vertexShaderFileName, const char* fragmentShaderFileName, int width, int height) :
+    width(std::max(width, 1)), height(std::max(height, 1)), vertexShaderFile(vertexShaderFileName),
+    fragmentShaderFile(fragmentShaderFileName), vaoHandle(0), format(POSITIONS_FP32), previousProgram(0)
+{
+    std::fill(previousViewport, previousViewport + 4, 0);
+
+    GLint maxSamples = 0;
+    glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+    GLsizei samples = std::min(PREVIEW_SAMPLES, maxSamples);
+
+    glGenRenderbuffers(3, renderbufferHandle);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbufferHandle[0]);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, this->width, this->height);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbufferHandle[1]);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, this->width, this->height);
+    glBindRenderbuffer(GL_RENDERBUFFER, renderbufferHandle[2]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, this->width, this->height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(2, framebufferHandle);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferHandle[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbufferHandle[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbufferHandle[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        cerr << "Preview framebuffer is incomplete!" << endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferHandle[1]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbufferHandle[2]);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenVertexArrays(1, &vaoHandle);
+}
+
+MeshPreview::~MeshPreview()
+{
+    glDeleteFramebuffers(2, framebufferHandle);
+    glDeleteRenderbuffers(3, renderbufferHandle);
+    glDeleteVertexArrays(1, &vaoHandle);
+    for (std::map<int, GLSLProgram*>::iterator it = programs.begin(); it != programs.end(); ++it) {
+        delete it->second;
+    }
+}
+
+GLSLProgram* MeshPreview::formatProgram(PositionFormat positionFormat) {
+    std::map<int, GLSLProgram*>::iterator found = programs.find(int(positionFormat));
+    if (found != programs.end()) return found->second;
+
+    std::vector<string> defines(1, SSBOMesh::positionFormatDefine(positionFormat));
+    GLSLProgram* program = new GLSLProgram();
+    try {
+        program->compileShader(vertexShaderFile.c_str(), GLSLShader::VERTEX, defines);
+        program->compileShader(fragmentShaderFile.c_str(), GLSLShader::FRAGMENT, defines);
+        program->link();
+    }
+    catch (GLSLProgramException& e) {
+        cerr << "Preview program: " << e.what() << endl;
+        delete program;
+        program = NULL;
+    }
+    programs[int(positionFormat)] = program;
+    return program;
+}
+
+bool MeshPreview::begin(PositionFormat positionFormat, const vec3& lo, const vec3& hi) {
+    GLSLProgram* program = formatProgram(positionFormat);
+    if (!program) return false;
+    format = positionFormat;
+
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+    // Positions and faces may just have been written by compute dispatches
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebufferHandle[0]);
+    glViewport(0, 0, width, height);
+    glClearColor(0.96f, 0.96f, 0.96f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+
+    // Bounding sphere seen from above front right, filling the shorter side
+    vec3 center = 0.5f * (lo + hi);
+    float radius = 0.5f * glm::length(hi - lo);
+    if (!(radius > 0.0f)) radius = 1.0f;
+    const float fieldOfView = glm::radians(30.0f);
+    float aspect = float(width) / float(height);
+    float distance = radius / std::sin(0.5f * fieldOfView * std::min(aspect, 1.0f));
+    vec3 eye = center + distance * glm::normalize(vec3(0.5f, 0.4f, 1.0f));
+    mat4 view = glm::lookAt(eye, center, vec3(0.0f, 1.0f, 0.0f));
+    mat4 projection = glm::perspective(fieldOfView, aspect, std::max(distance - 1.01f * radius, 1e-3f * distance),
+        distance + 1.01f * radius);
+
+    program->use();
+    program->setUniform("viewProjection", projection * view);
+    program->setUniform("eye", eye);
+    program->setUniform("bboxMin", lo);
+    program->setUniform("bboxExtent", hi - lo);
+    return true;
+}
+
+void MeshPreview::draw(GLuint positionBuffer, GLuint elementBuffer, GLuint numFaces) {
+    glBindVertexArray(vaoHandle);
+    SSBOMesh::setPositionAttribute(0, format);
+    glBindVertexBuffer(0, positionBuffer, 0, GLsizei(format == POSITIONS_FP32 ? 3 * sizeof(float) : 2 * sizeof(GLuint)));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+    glDrawElements(GL_TRIANGLES, GLsizei(3 * size_t(numFaces)), GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+}
+
+void MeshPreview::finish(void* pixels) {
+    glDisable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebufferHandle[0]);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebufferHandle[1]);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebufferHandle[1]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glUseProgram(GLuint(previousProgram));
+    glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+}
+
+bool MeshPreview::capture(const SSBOMesh& mesh, const char* pngFile) {
+    vec3 lo, hi;
+    mesh.getBoundingBox(lo, hi);
+    if (!begin(mesh.getPositionFormat(), lo, hi)) return false;
+    mesh.render();
+    vector<unsigned char> pixels(imageBytes());
+    finish(pixels.data());
+    return writePNG(pngFile, pixels.data());
+}
+
+bool MeshPreview::writePNG(const char* fileName, const unsigned char* pixels) const {
+    // GL rows run bottom to top, PNG rows top to bottom; the alpha is dropped
+    size_t rowBytes = 3 * size_t(width);
+    vector<unsigned char> rows(rowBytes * size_t(height));
+    for (int y = 0; y < height; ++y) {
+        const unsigned char* src = pixels + 4 * size_t(width) * size_t(y);
+        unsigned char* dst = &rows[size_t(height - 1 - y) * rowBytes];
+        for (int x = 0; x < width; ++x) {
+            dst[3 * x] = src[4 * x];
+            dst[3 * x + 1] = src[4 * x + 1];
+            dst[3 * x + 2] = src[4 * x + 2];
+        }
+    }
+    if (!stbi_write_png(fileName, width, height, 3, rows.data(), int(rowBytes))) {
+        cerr << "Unable to write preview image: " << fileName << endl;
+        return false;
+    }
+    return true;
+}
+
+string previewFileName(const string& modelFileName, const char* suffix) {
+    size_t dot = modelFileName.find_last_of('.');
+    size_t slash = modelFileName.find_last_of("/\\");
+    string stem = dot != string::npos && (slash == string::npos || dot > slash) ? modelFileName.substr(0, dot) : modelFileName;
+    return stem + "-" + suffix + ".png";
+}
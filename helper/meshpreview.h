@@ -0,0 +1,76 @@
+#ifndef MESHPREVIEW_H
+#define MESHPREVIEW_H
+
+#include "gldecl.h"
+#include "ssbomesh.h"
+
+#include <cstddef>
+#include <map>
+#include <string>
+using std::string;
+
+class GLSLProgram;
+
+/////////////////////////////////////////////////////////////////////////////
+// Offscreen preview images of meshes on the GPU. The position SSBO is bound
+// as the vertex buffer and the face SSBO as the element buffer, so nothing
+// but the finished image crosses to the host; packed positions (fp16,
+// quant21) are decoded in the vertex shader. The mesh is drawn flat shaded
+// into a multisampled framebuffer object, resolved, and read back with
+// glReadPixels, into host memory or into a pixel pack buffer that can be
+// mapped after a later fence without stalling (see batchpipeline.h).
+//
+// The camera looks at the given bounding box from a fixed direction, so
+// images of the same mesh before and after smoothing line up when they are
+// framed by the same box (the box of the mesh as loaded).
+/////////////////////////////////////////////////////////////////////////////
+
+class MeshPreview
+{
+private:
+    int width;
+    int height;
+    string vertexShaderFile;
+    string fragmentShaderFile;
+    std::map<int, GLSLProgram*> programs;  // Per PositionFormat, NULL if the build failed
+    GLuint framebufferHandle[2];           // Multisampled target, resolved image
+    GLuint renderbufferHandle[3];          // Multisampled color and depth, resolved color
+    GLuint vaoHandle;                      // Vertex array of draw()
+    PositionFormat format;                 // Of the image being drawn
+    GLint previousProgram;
+    GLint previousViewport[4];
+
+    // Make these private in order to make the object non-copyable
+    MeshPreview(const MeshPreview& other);
+    MeshPreview& operator=(const MeshPreview& other) { return *this; }
+
+    GLSLProgram* formatProgram(PositionFormat positionFormat);
+
+public:
+    // Requires a current GL context. The programs are built from the two
+    // shader files on first use, one per position format.
+    MeshPreview(const char* vertexShaderFileName, const char* fragmentShaderFileName, int width, int height);
+    ~MeshPreview();
+
+    // Draws an in-core mesh with SSBOMesh::render() and writes the image to pngFile.
+    bool capture(const SSBOMesh& mesh, const char* pngFile);
+
+    // Step by step: begin() clears the framebuffer and installs the program
+    // for 'positionFormat', framing the box lo..hi (also the quantization
+    // frame of POSITIONS_QUANT21); then draw calls; then finish() reads the
+    // image to 'pixels' (a byte offset if a buffer is bound to
+    // GL_PIXEL_PACK_BUFFER) and restores the program and viewport.
+    bool begin(PositionFormat positionFormat, const vec3& lo, const vec3& hi);
+    void draw(GLuint positionBuffer, GLuint elementBuffer, GLuint numFaces);
+    void finish(void* pixels);
+
+    // RGBA, bottom row first, as read by finish()
+    size_t imageBytes() const { return 4 * size_t(width) * size_t(height); }
+    // Thread-safe; makes no GL calls.
+    bool writePNG(const char* fileName, const unsigned char* pixels) const;
+};
+
+// "dir/model.obj" -> "dir/model-<suffix>.png"
+string previewFileName(const string& modelFileName, const char* suffix);
+
+#endif // MESHPREVIEW_H
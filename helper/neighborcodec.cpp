@@ -0,0 +1,56 @@
+#include "neighborcodec.h"
+
+NeighborCodecStats encodeNeighborDeltas(
+    const vector<GLuint>& spans,
+    const vector<GLuint>& offsets,
+    const vector<GLuint>& neighbors,
+    vector<GLuint>& packed,
+    vector<GLuint>& slotOffsets)
+{
+    NeighborCodecStats stats = { 0, 0, 0 };
+    size_t numVertices = spans.size();
+
+    // Write 16-bit slots first, then pack pairs into words.
+    vector<unsigned short> slots;
+    slots.reserve(neighbors.size() + neighbors.size() / 8);
+    slotOffsets.resize(numVertices);
+
+    for (size_t v = 0; v < numVertices; ++v) {
+        slotOffsets[v] = GLuint(slots.size());
+        for (GLuint i = 0; i < spans[v]; ++i) {
+            GLuint n = neighbors[offsets[v] + i];
+            long long delta = (long long)n - (long long)v;
+            if (delta >= -32767 && delta <= 32767) {
+                slots.push_back((unsigned short)(delta & 0xFFFF));
+            }
+            else {
+                slots.push_back((unsigned short)NEIGHBOR_ESCAPE);
+                slots.push_back((unsigned short)(n & 0xFFFFu));
+                slots.push_back((unsigned short)(n >> 16));
+                stats.escapes++;
+            }
+        }
+        stats.edges += spans[v];
+    }
+
+    packed.assign((slots.size() + 1) / 2, 0u);
+    for (size_t s = 0; s < slots.size(); ++s) {
+        packed[s >> 1] |= GLuint(slots[s]) << ((s & 1) * 16);
+    }
+    stats.bytes = packed.size() * sizeof(GLuint);
+    return stats;
+}
+
+void decodeNeighbors(
+    const vector<GLuint>& packed,
+    const vector<GLuint>& slotOffsets,
+    const vector<GLuint>& spans,
+    GLuint v,
+    vector<GLuint>& out)
+{
+    out.clear();
+    GLuint slot = slotOffsets[v];
+    for (GLuint i = 0; i < spans[v]; ++i) {
+        out.push_back(decodeNeighbor(packed.data(), slot, v));
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef NEIGHBORCODEC_H
+#define NEIGHBORCODEC_H
+
+#include "gldecl.h"
+
+#include <vector>
+using std::vector;
+
+/////////////////////////////////////////////////////////////////////////////
+// Delta encoding of the CSR neighbor indices (FlatNeighborIndices).
+//
+// Each neighbor n of vertex v is stored as a 16-bit slot holding the signed
+// delta n - v. Deltas outside [-32767, 32767] are written as the escape
+// slot NEIGHBOR_ESCAPE followed by the low and high 16 bits of n. Slots are
+// packed two per GLuint (low half first); offsets count slots, not words.
+// The decoder in shader.comp (COMPRESSED_NEIGHBORS) mirrors decodeNeighbor().
+/////////////////////////////////////////////////////////////////////////////
+
+#define NEIGHBOR_ESCAPE 0x8000u
+
+struct NeighborCodecStats
+{
+    size_t edges;              // Directed edges (neighbor entries)
+    size_t escapes;            // Entries that needed the 32-bit escape
+    size_t bytes;              // Size of the packed array
+};
+
+NeighborCodecStats encodeNeighborDeltas(
+    const vector<GLuint>& spans,
+    const vector<GLuint>& offsets,
+    const vector<GLuint>& neighbors,
+    vector<GLuint>& packed,
+    vector<GLuint>& slotOffsets);
+
+inline GLuint readNeighborSlot(const GLuint* packed, GLuint slot)
+{
+    return (packed[slot >> 1] >> ((slot & 1u) * 16u)) & 0xFFFFu;
+}
+
+// Decodes the neighbor at 'slot' of vertex v and advances slot past it.
+inline GLuint decodeNeighbor(const GLuint* packed, GLuint& slot, GLuint v)
+{
+    GLuint code = readNeighborSlot(packed, slot++);
+    if (code == NEIGHBOR_ESCAPE) {
+        GLuint n = readNeighborSlot(packed, slot) | (readNeighborSlot(packed, slot + 1) << 16);
+        slot += 2;
+        return n;
+    }
+    int delta = int(code << 16) >> 16;
+    return GLuint(int(v) + delta);
+}
+
+void decodeNeighbors(
+    const vector<GLuint>& packed,
+    const vector<GLuint>& slotOffsets,
+    const vector<GLuint>& spans,
+    GLuint v,
+    vector<GLuint>& out);
+
+#endif // NEIGHBORCODEC_H
@@ -0,0 +1,227 @@
+#include "partition.h"
+#include "halotransport.h"
+#include "glslprogram.h"
+
+#include <algorithm>
+
+// Compares vertices along one axis, breaking ties by index so every rank
+// sorts identically.
+struct AxisLess
+{
+    const float* positions;
+    int axis;
+
+    bool operator()(GLuint a, GLuint b) const
+    {
+        float pa = positions[3 * size_t(a) + axis];
+        float pb = positions[3 * size_t(b) + axis];
+        return pa < pb || (pa == pb && a < b);
+    }
+};
+
+static void bisect(const float* positions, vector<GLuint>::iterator begin, vector<GLuint>::iterator end,
+    int firstPart, int parts, vector<int>& owner)
+{
+    if (parts <= 1 || end - begin <= 1) {
+        for (vector<GLuint>::iterator it = begin; it != end; ++it) owner[*it] = firstPart;
+        return;
+    }
+
+    vec3 lo(positions[3 * size_t(*begin)], positions[3 * size_t(*begin) + 1], positions[3 * size_t(*begin) + 2]);
+    vec3 hi = lo;
+    for (vector<GLuint>::iterator it = begin; it != end; ++it) {
+        vec3 p(positions[3 * size_t(*it)], positions[3 * size_t(*it) + 1], positions[3 * size_t(*it) + 2]);
+        lo = glm::min(lo, p);
+        hi = glm::max(hi, p);
+    }
+    vec3 extent = hi - lo;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+    int leftParts = parts / 2;
+    vector<GLuint>::iterator mid = begin + (end - begin) * leftParts / parts;
+    AxisLess less = { positions, axis };
+    std::nth_element(begin, mid, end, less);
+
+    bisect(positions, begin, mid, firstPart, leftParts, owner);
+    bisect(positions, mid, end, firstPart + leftParts, parts - leftParts, owner);
+}
+
+void partitionRecursiveBisection(const float* positions, GLuint numVertices, int parts, vector<int>& owner)
+{
+    vector<GLuint> order(numVertices);
+    for (GLuint v = 0; v < numVertices; ++v) order[v] = v;
+    owner.assign(numVertices, 0);
+    bisect(positions, order.begin(), order.end(), 0, std::max(parts, 1), owner);
+}
+
+// Index of rank q in part.peers, adding it on first use.
+static size_t peerSlot(MeshPartition& part, vector<int>& peerIndex, int q)
+{
+    if (q >= int(peerIndex.size())) peerIndex.resize(q + 1, -1);
+    if (peerIndex[q] < 0) {
+        peerIndex[q] = int(part.peers.size());
+        part.peers.push_back(q);
+        part.sendLocal.push_back(vector<GLuint>());
+        part.recvLocal.push_back(vector<GLuint>());
+    }
+    return size_t(peerIndex[q]);
+}
+
+void buildPartition(
+    const vector<int>& owner,
+    int rank,
+    const vector<GLuint>& spans,
+    const vector<GLuint>& offsets,
+    const vector<GLuint>& neighbors,
+    const vector<VertexFlags>& flags,
+    MeshPartition& part)
+{
+    GLuint numVertices = GLuint(owner.size());
+    const GLuint NOT_LOCAL = 0xFFFFFFFFu;
+    vector<GLuint> globalToLocal(numVertices, NOT_LOCAL);
+
+    part.rank = rank;
+    part.localToGlobal.clear();
+    for (GLuint v = 0; v < numVertices; ++v) {
+        if (owner[v] == rank) {
+            globalToLocal[v] = GLuint(part.localToGlobal.size());
+            part.localToGlobal.push_back(v);
+        }
+    }
+    part.numOwned = GLuint(part.localToGlobal.size());
+
+    // Ghosts: the foreign 1-ring of the owned set, in ascending global order
+    vector<GLuint> ghosts;
+    for (GLuint i = 0; i < part.numOwned; ++i) {
+        GLuint v = part.localToGlobal[i];
+        for (GLuint j = 0; j < spans[v]; ++j) {
+            GLuint n = neighbors[offsets[v] + j];
+            if (globalToLocal[n] == NOT_LOCAL) {
+                globalToLocal[n] = 0;
+                ghosts.push_back(n);
+            }
+        }
+    }
+    std::sort(ghosts.begin(), ghosts.end());
+    for (size_t i = 0; i < ghosts.size(); ++i) {
+        globalToLocal[ghosts[i]] = GLuint(part.localToGlobal.size());
+        part.localToGlobal.push_back(ghosts[i]);
+    }
+
+    GLuint count = GLuint(part.localToGlobal.size());
+    part.spans.assign(count, 0);
+    part.offsets.assign(count, 0);
+    part.neighbors.clear();
+    part.flags.resize(count);
+    for (GLuint i = 0; i < count; ++i) {
+        GLuint v = part.localToGlobal[i];
+        part.offsets[i] = GLuint(part.neighbors.size());
+        if (i < part.numOwned) {
+            for (GLuint j = 0; j < spans[v]; ++j) {
+                part.neighbors.push_back(globalToLocal[neighbors[offsets[v] + j]]);
+            }
+            part.spans[i] = spans[v];
+        }
+        part.flags[i] = flags[v];
+    }
+    if (part.neighbors.empty()) part.neighbors.push_back(0);
+
+    // Halo lists per peer rank
+    vector<int> peerIndex;
+    part.peers.clear();
+    part.sendLocal.clear();
+    part.recvLocal.clear();
+    for (GLuint i = 0; i < count; ++i) {
+        GLuint v = part.localToGlobal[i];
+        for (GLuint j = 0; j < (i < part.numOwned ? spans[v] : 0); ++j) {
+            int q = owner[neighbors[offsets[v] + j]];
+            if (q == rank) continue;
+            vector<GLuint>& send = part.sendLocal[peerSlot(part, peerIndex, q)];
+            if (send.empty() || send.back() != i) send.push_back(i);
+        }
+        if (i >= part.numOwned) {
+            part.recvLocal[peerSlot(part, peerIndex, owner[v])].push_back(i);
+        }
+    }
+}
+
+DistributedSmoother::DistributedSmoother(
+    HaloTransport* transport,
+    const vector<GLuint>& spans,
+    const vector<GLuint>& offsets,
+    const vector<GLuint>& neighbors,
+    const vector<VertexFlags>& flags,
+    const float* positions)
+    : transport(transport)
+{
+    vector<int> owner;
+    partitionRecursiveBisection(positions, GLuint(spans.size()), transport->size(), owner);
+    buildPartition(owner, transport->rank(), spans, offsets, neighbors, flags, part);
+
+    // The CSR and flags of this piece never change; positions are uploaded by smooth()
+    glGenBuffers(6, bufferHandle);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferHandle[0]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, part.neighbors.size() * sizeof(GLuint), part.neighbors.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferHandle[1]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, part.spans.size() * sizeof(GLuint), part.spans.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferHandle[2]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, part.offsets.size() * sizeof(GLuint), part.offsets.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferHandle[5]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, part.flags.size() * sizeof(VertexFlags), part.flags.data(), GL_STATIC_DRAW);
+    for (int i = 3; i <= 4; ++i) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferHandle[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 3 * part.localToGlobal.size() * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+DistributedSmoother::~DistributedSmoother()
+{
+    glDeleteBuffers(6, bufferHandle);
+}
+
+void DistributedSmoother::smooth(GLSLProgram* program, GLuint verticesPerGroup, vector<float>& positions, int numIterations)
+{
+    GLuint count = GLuint(part.localToGlobal.size());
+    vector<float> local(3 * size_t(count));
+    for (GLuint i = 0; i < count; ++i) {
+        size_t v = part.localToGlobal[i];
+        local[3 * i] = positions[3 * v];
+        local[3 * i + 1] = positions[3 * v + 1];
+        local[3 * i + 2] = positions[3 * v + 2];
+    }
+    for (int i = 3; i <= 4; ++i) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferHandle[i]);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, local.size() * sizeof(float), local.data());
+    }
+
+    program->setUniform("useActiveList", false);
+    program->setUniform("copyOnly", false);
+    for (int i = 0; i < 3; ++i) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, bufferHandle[i]);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, bufferHandle[5]);
+
+    size_t ownedBytes = 3 * size_t(part.numOwned) * sizeof(float);
+    size_t ghostBytes = 3 * size_t(part.numGhosts()) * sizeof(float);
+    int readIdx = 3;
+    for (int it = 0; it < numIterations; ++it) {
+        int writeIdx = readIdx == 3 ? 4 : 3;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bufferHandle[readIdx]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, bufferHandle[writeIdx]);
+        glDispatchCompute((count + verticesPerGroup - 1) / verticesPerGroup, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // Owned positions out, ghost positions in
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferHandle[writeIdx]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, ownedBytes, local.data());
+        transport->exchange(part, local);
+        if (ghostBytes > 0) {
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, ownedBytes, ghostBytes, local.data() + 3 * size_t(part.numOwned));
+        }
+        readIdx = writeIdx;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    transport->gather(part, local, positions);
+}
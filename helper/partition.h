@@ -0,0 +1,95 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "gldecl.h"
+#include "ssbomesh.h"
+
+#include <vector>
+using std::vector;
+
+class GLSLProgram;
+class HaloTransport;
+
+/////////////////////////////////////////////////////////////////////////////
+// Splits the vertices of a mesh into 'parts' spatially compact pieces by
+// recursive coordinate bisection: each level cuts the current set across the
+// longest axis of its bounding box, in proportion to the parts on each side.
+// owner[v] receives the part of vertex v. The result only depends on the
+// input, so every rank computes the same partition independently.
+/////////////////////////////////////////////////////////////////////////////
+
+void partitionRecursiveBisection(const float* positions, GLuint numVertices, int parts, vector<int>& owner);
+
+/////////////////////////////////////////////////////////////////////////////
+// One rank's piece of the mesh. Local vertices are the owned vertices (in
+// ascending global order) followed by the ghosts, i.e. the 1-ring of the
+// owned set that belongs to other ranks, also in ascending global order.
+// Ghosts have span 0, so shader.comp copies them and only owned vertices are
+// smoothed. Send and receive lists are per peer rank and sorted by global
+// index on both sides, so no indices travel with the halo.
+/////////////////////////////////////////////////////////////////////////////
+
+struct MeshPartition
+{
+    int rank;
+    GLuint numOwned;
+    vector<GLuint> localToGlobal;
+
+    // Local CSR (same neighbor order as the in-core buffers)
+    vector<GLuint> spans;
+    vector<GLuint> offsets;
+    vector<GLuint> neighbors;
+    vector<VertexFlags> flags;
+
+    vector<int> peers;                 // Ranks sharing an edge with this piece
+    vector<vector<GLuint> > sendLocal; // Per peer: owned vertices it holds as ghosts
+    vector<vector<GLuint> > recvLocal; // Per peer: ghosts it owns
+
+    GLuint numGhosts() const { return GLuint(localToGlobal.size()) - numOwned; }
+};
+
+void buildPartition(
+    const vector<int>& owner,
+    int rank,
+    const vector<GLuint>& spans,
+    const vector<GLuint>& offsets,
+    const vector<GLuint>& neighbors,
+    const vector<VertexFlags>& flags,
+    MeshPartition& part);
+
+/////////////////////////////////////////////////////////////////////////////
+// Runs shader.comp on this rank's piece and exchanges the ghost positions
+// through a HaloTransport after every iteration. Each iteration reads back
+// only the owned positions and uploads only the ghosts, and the result is
+// identical to smoothing the whole mesh in one process.
+/////////////////////////////////////////////////////////////////////////////
+
+class DistributedSmoother
+{
+private:
+    HaloTransport* transport;
+    MeshPartition part;
+    GLuint bufferHandle[6];    // Neighbors, spans, offsets, positions x2, flags
+
+    // Make these private in order to make the object non-copyable
+    DistributedSmoother(const DistributedSmoother& other);
+    DistributedSmoother& operator=(const DistributedSmoother& other) { return *this; }
+
+public:
+    DistributedSmoother(
+        HaloTransport* transport,
+        const vector<GLuint>& spans,
+        const vector<GLuint>& offsets,
+        const vector<GLuint>& neighbors,
+        const vector<VertexFlags>& flags,
+        const float* positions);
+    ~DistributedSmoother();
+
+    // 'positions' holds the whole mesh (fp32 xyz); only this rank's owned and
+    // ghost entries are read. On return rank 0 holds the gathered result.
+    void smooth(GLSLProgram* program, GLuint verticesPerGroup, vector<float>& positions, int numIterations);
+
+    const MeshPartition& partition() const { return part; }
+};
+
+#endif // PARTITION_H
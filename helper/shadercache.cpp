@@ -0,0 +1,152 @@
+#include "shadercache.h"
+
+#include <cstdio>
+#include <fstream>
+using std::ifstream;
+using std::ofstream;
+using std::ios;
+#include <sstream>
+#include <iostream>
+using std::cerr;
+using std::endl;
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct ShaderCacheHeader
+{
+    GLuint magic;              // SHADER_CACHE_MAGIC
+    GLuint version;            // SHADER_CACHE_VERSION
+    unsigned long long key;    // Hash of the injected source and driver string
+    GLuint format;             // Binary format from glGetProgramBinary
+    GLuint driverLength;       // Driver string follows the header,
+    GLuint binaryLength;       // then the program binary
+    GLuint reserved;
+};
+
+// 64-bit FNV-1a
+static unsigned long long hashString(const string& text, unsigned long long hash = 14695981039346656037ULL)
+{
+    for (size_t i = 0; i < text.size(); ++i) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static string glString(GLenum name)
+{
+    const GLubyte* value = glGetString(name);
+    return value ? string((const char*)value) : string();
+}
+
+ShaderCache::ShaderCache(const char* directory) : directory(directory), hits(0), misses(0)
+{
+    driver = glString(GL_VENDOR) + "/" + glString(GL_RENDERER) + "/" + glString(GL_VERSION);
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    supported = formats > 0;
+
+#ifdef _WIN32
+    _mkdir(directory);
+#else
+    mkdir(directory, 0755);
+#endif
+}
+
+string ShaderCache::entryPath(unsigned long long key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", key);
+    return directory + "/" + name;
+}
+
+bool ShaderCache::load(GLSLProgram& program, unsigned long long key)
+{
+    ifstream file(entryPath(key).c_str(), ios::in | ios::binary);
+    if (!file) return false;
+
+    ShaderCacheHeader header;
+    if (!file.read((char*)&header, sizeof(header))) return false;
+    if (header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.key != key ||
+        header.driverLength != driver.size()) {
+        return false;
+    }
+
+    string storedDriver(header.driverLength, '\0');
+    vector<unsigned char> binary(header.binaryLength);
+    if (!file.read(&storedDriver[0], storedDriver.size()) || storedDriver != driver) return false;
+    if (binary.empty() || !file.read((char*)&binary[0], binary.size())) return false;
+
+    return program.loadBinary(header.format, &binary[0], GLsizei(binary.size()));
+}
+
+void ShaderCache::store(GLSLProgram& program, unsigned long long key)
+{
+    GLenum format = 0;
+    vector<unsigned char> binary;
+    if (!program.getBinary(format, binary)) return;
+
+    ShaderCacheHeader header = { SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, key, format,
+        GLuint(driver.size()), GLuint(binary.size()), 0 };
+
+    // Write to a temporary name of this process and rename it over the entry,
+    // so a concurrent reader never sees a partial entry and concurrent writers
+    // (forked ranks building the same variant) never share a file.
+    string path = entryPath(key);
+#ifdef _WIN32
+    string temporary = path + "." + std::to_string(_getpid()) + ".tmp";
+#else
+    string temporary = path + "." + std::to_string(getpid()) + ".tmp";
+#endif
+    bool written;
+    {
+        ofstream file(temporary.c_str(), ios::out | ios::binary | ios::trunc);
+        if (!file) {
+            cerr << "Unable to write shader cache entry: " << path << endl;
+            return;
+        }
+        file.write((const char*)&header, sizeof(header));
+        file.write(driver.data(), driver.size());
+        file.write((const char*)&binary[0], binary.size());
+        file.close();
+        written = bool(file);
+    }
+#ifdef _WIN32
+    bool renamed = written && MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool renamed = written && rename(temporary.c_str(), path.c_str()) == 0; // Replaces the entry atomically
+#endif
+    if (!renamed) remove(temporary.c_str());
+}
+
+void ShaderCache::build(GLSLProgram& program, const char* fileName, GLSLShader::GLSLShaderType type,
+    const vector<string>& defines) throw (GLSLProgramException)
+{
+    ifstream inFile(fileName, ios::in);
+    if (!inFile) {
+        throw GLSLProgramException(string("Unable to open: ") + fileName);
+    }
+    std::stringstream code;
+    code << inFile.rdbuf();
+    string source = GLSLProgram::injectDefines(code.str(), defines);
+
+    unsigned long long key = hashString(driver, hashString(source));
+    if (supported && load(program, key)) {
+        hits++;
+        return;
+    }
+
+    misses++;
+    program.compileShader(source, type, fileName);
+    if (supported) program.setBinaryRetrievable();
+    program.link();
+    if (supported) store(program, key);
+}
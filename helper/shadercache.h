@@ -0,0 +1,51 @@
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include "glslprogram.h"
+
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+
+// Identifies a cached program binary file ("LSPB") and its layout revision.
+#define SHADER_CACHE_MAGIC   0x4250534Cu
+#define SHADER_CACHE_VERSION 1u
+
+/////////////////////////////////////////////////////////////////////////////
+// On-disk cache of linked program binaries. A shader variant is keyed by a
+// hash of its source after #define injection, so editing the file or
+// changing a define selects a new entry, and by the GL vendor, renderer and
+// version strings, so a driver update invalidates it. Each entry is stored
+// as <directory>/<key>.bin with a header repeating the key and the driver
+// string; any mismatch, or a binary the driver rejects, falls back to
+// compiling from source and rewriting the entry.
+/////////////////////////////////////////////////////////////////////////////
+
+class ShaderCache
+{
+private:
+    string directory;
+    string driver;             // GL_VENDOR / GL_RENDERER / GL_VERSION
+    bool supported;            // Driver offers at least one binary format
+    int hits;
+    int misses;
+
+    string entryPath(unsigned long long key) const;
+    bool load(GLSLProgram& program, unsigned long long key);
+    void store(GLSLProgram& program, unsigned long long key);
+
+public:
+    // Requires a current GL context.
+    ShaderCache(const char* directory);
+
+    // Builds a linked 'program' from fileName with 'defines' injected (see
+    // GLSLProgram::injectDefines), from the cache when possible.
+    void build(GLSLProgram& program, const char* fileName, GLSLShader::GLSLShaderType type,
+        const vector<string>& defines) throw (GLSLProgramException);
+
+    int cacheHits() const { return hits; }
+    int cacheMisses() const { return misses; }
+};
+
+#endif // SHADERCACHE_H
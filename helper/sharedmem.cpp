@@ -0,0 +1,180 @@
+#include "sharedmem.h"
+
+#include <iostream>
+using std::cerr;
+using std::endl;
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+SharedMemorySegment::SharedMemorySegment() : base(NULL), length(0), owner(false), mapping(NULL) { }
+#else
+SharedMemorySegment::SharedMemorySegment() : base(NULL), length(0), owner(false), fd(-1) { }
+#endif
+
+SharedMemorySegment::~SharedMemorySegment()
+{
+    close();
+}
+
+#ifdef _WIN32
+
+bool SharedMemorySegment::create(const char* name, size_t size)
+{
+    close();
+    HANDLE h = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+        DWORD((unsigned long long)size >> 32), DWORD(size & 0xFFFFFFFFu), name);
+    if (h == NULL) {
+        cerr << "Unable to create shared memory segment: " << name << endl;
+        return false;
+    }
+    base = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (base == NULL) {
+        CloseHandle(h);
+        cerr << "Unable to map shared memory segment: " << name << endl;
+        return false;
+    }
+    mapping = h;
+    length = size;
+    owner = true;
+    segmentName = name;
+    return true;
+}
+
+bool SharedMemorySegment::open(const char* name)
+{
+    close();
+    HANDLE h = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+    if (h == NULL) {
+        cerr << "Unable to open shared memory segment: " << name << endl;
+        return false;
+    }
+    base = MapViewOfFile(h, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+    if (base == NULL) {
+        CloseHandle(h);
+        cerr << "Unable to map shared memory segment: " << name << endl;
+        return false;
+    }
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(base, &info, sizeof(info));
+    mapping = h;
+    length = info.RegionSize;
+    owner = false;
+    segmentName = name;
+    return true;
+}
+
+void SharedMemorySegment::close()
+{
+    if (base) UnmapViewOfFile(base);
+    if (mapping) CloseHandle(mapping);
+    base = NULL;
+    mapping = NULL;
+    length = 0;
+    owner = false;
+}
+
+#else
+
+// POSIX shared memory object names must start with a slash.
+static string posixName(const char* name)
+{
+    return name[0] == '/' ? string(name) : "/" + string(name);
+}
+
+bool SharedMemorySegment::create(const char* name, size_t size)
+{
+    close();
+    string shmName = posixName(name);
+    int h = shm_open(shmName.c_str(), O_CREAT | O_RDWR, 0600);
+    if (h < 0) {
+        cerr << "Unable to create shared memory segment: " << name << endl;
+        return false;
+    }
+    if (ftruncate(h, off_t(size)) != 0) {
+        ::close(h);
+        shm_unlink(shmName.c_str());
+        cerr << "Unable to size shared memory segment: " << name << endl;
+        return false;
+    }
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, h, 0);
+    if (ptr == MAP_FAILED) {
+        ::close(h);
+        shm_unlink(shmName.c_str());
+        cerr << "Unable to map shared memory segment: " << name << endl;
+        return false;
+    }
+    fd = h;
+    base = ptr;
+    length = size;
+    owner = true;
+    segmentName = shmName;
+    return true;
+}
+
+bool SharedMemorySegment::open(const char* name)
+{
+    close();
+    string shmName = posixName(name);
+    int h = shm_open(shmName.c_str(), O_RDWR, 0600);
+    if (h < 0) {
+        cerr << "Unable to open shared memory segment: " << name << endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(h, &info) != 0 || info.st_size <= 0) {
+        ::close(h);
+        cerr << "Shared memory segment is empty: " << name << endl;
+        return false;
+    }
+    void* ptr = mmap(NULL, size_t(info.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, h, 0);
+    if (ptr == MAP_FAILED) {
+        ::close(h);
+        cerr << "Unable to map shared memory segment: " << name << endl;
+        return false;
+    }
+    fd = h;
+    base = ptr;
+    length = size_t(info.st_size);
+    owner = false;
+    segmentName = shmName;
+    return true;
+}
+
+void SharedMemorySegment::close()
+{
+    if (base) munmap(base, length);
+    if (fd >= 0) ::close(fd);
+    if (owner) shm_unlink(segmentName.c_str());
+    base = NULL;
+    fd = -1;
+    length = 0;
+    owner = false;
+}
+
+#endif
+
+SharedMeshHeader* openSharedMesh(SharedMemorySegment& segment, const char* name, bool checkFaces)
+{
+    if (!segment.open(name)) return NULL;
+
+    SharedMeshHeader* header = static_cast<SharedMeshHeader*>(segment.data());
+    bool valid = segment.size() >= sizeof(SharedMeshHeader) && header->magic == SHARED_MESH_MAGIC &&
+        header->version == SHARED_MESH_VERSION && segment.size() >= sharedMeshSize(header->vertices, header->faces);
+    if (valid && checkFaces) {
+        const GLuint* faces = sharedMeshFaces(header);
+        for (size_t i = 0; i < 3 * size_t(header->faces) && valid; ++i) valid = faces[i] < header->vertices;
+    }
+    if (!valid) {
+        cerr << "Not a valid shared mesh segment: " << name << endl;
+        return NULL;
+    }
+    return header;
+}
@@ -0,0 +1,88 @@
+#ifndef SHAREDMEM_H
+#define SHAREDMEM_H
+
+#include "gldecl.h"
+
+#include <cstddef>
+#include <string>
+using std::string;
+
+// Identifies a mesh segment ("LSMS") and the layout revision below.
+#define SHARED_MESH_MAGIC   0x534D534Cu
+#define SHARED_MESH_VERSION 1u
+
+/////////////////////////////////////////////////////////////////////////////
+// Layout of a mesh exchanged through a shared memory segment. The header is
+// followed directly by 3 * vertices floats (xyz positions) and then by
+// 3 * faces GLuints (0-indexed triangle corners), i.e. exactly the arrays
+// uploaded to the position and face SSBOs.
+/////////////////////////////////////////////////////////////////////////////
+
+struct SharedMeshHeader
+{
+    GLuint magic;       // SHARED_MESH_MAGIC
+    GLuint version;     // SHARED_MESH_VERSION
+    GLuint vertices;    // Number of vertices
+    GLuint faces;       // Number of triangle faces
+};
+
+inline size_t sharedMeshSize(GLuint vertices, GLuint faces)
+{
+    return sizeof(SharedMeshHeader) + 3 * size_t(vertices) * sizeof(float) + 3 * size_t(faces) * sizeof(GLuint);
+}
+
+inline float* sharedMeshPositions(SharedMeshHeader* header)
+{
+    return reinterpret_cast<float*>(header + 1);
+}
+
+inline GLuint* sharedMeshFaces(SharedMeshHeader* header)
+{
+    return reinterpret_cast<GLuint*>(sharedMeshPositions(header) + 3 * size_t(header->vertices));
+}
+
+class SharedMemorySegment;
+
+// Opens the segment 'name' and checks the header and the size (and, if
+// 'checkFaces', that every face index is below the vertex count, as the
+// adjacency build relies on). Returns NULL, with a message, if the segment
+// cannot be opened or does not hold a valid mesh.
+SharedMeshHeader* openSharedMesh(SharedMemorySegment& segment, const char* name, bool checkFaces);
+
+/////////////////////////////////////////////////////////////////////////////
+// A named shared memory segment (POSIX shm_open / Win32 file mapping)
+// mapped into this process. The segment is unmapped on destruction and
+// unlinked if this object created it.
+/////////////////////////////////////////////////////////////////////////////
+
+class SharedMemorySegment
+{
+private:
+    string segmentName;
+    void* base;
+    size_t length;
+    bool owner;
+#ifdef _WIN32
+    void* mapping;
+#else
+    int fd;
+#endif
+
+    // Make these private in order to make the object non-copyable
+    SharedMemorySegment(const SharedMemorySegment& other) { }
+    SharedMemorySegment& operator=(const SharedMemorySegment& other) { return *this; }
+
+public:
+    SharedMemorySegment();
+    ~SharedMemorySegment();
+
+    bool create(const char* name, size_t size);
+    bool open(const char* name);
+    void close();
+
+    void* data() const { return base; }
+    size_t size() const { return length; }
+    const string& name() const { return segmentName; }
+};
+
+#endif // SHAREDMEM_H
@@ -0,0 +1,167 @@
+#include "smoothingscene.h"
+#include "ssbomesh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+using std::cerr;
+using std::endl;
+#include <vector>
+using std::vector;
+#include <glm/gtc/matrix_transform.hpp>
+
+SmoothingScene::SmoothingScene(SSBOMesh* smoothedMesh, const char* vertexShaderFileName, const char* fragmentShaderFileName,
+    std::function<void()> reloadMesh) :
+    mesh(smoothedMesh), vertexShaderFile(vertexShaderFileName), fragmentShaderFile(fragmentShaderFileName),
+    reload(reloadMesh), width(1), height(1), azimuth(25.0f), elevation(20.0f), wireframe(false),
+    iterationsPerFrame(8), budgetMs(8.0), lambda(smoothedMesh->getLambda()), iterationsDone(0),
+    lastFrameIterations(0), nextQuery(0), msPerIteration(0.0)
+{
+    std::fill(timerQueries, timerQueries + TIMER_QUERIES, 0u);
+    std::fill(queryIterations, queryIterations + TIMER_QUERIES, 0);
+    std::fill(queryWallMs, queryWallMs + TIMER_QUERIES, 0.0);
+}
+
+SmoothingScene::~SmoothingScene()
+{
+    if (timerQueries[0] != 0) glDeleteQueries(TIMER_QUERIES, timerQueries);
+}
+
+void SmoothingScene::initScene()
+{
+    vector<string> defines(1, SSBOMesh::positionFormatDefine(mesh->getPositionFormat()));
+    try {
+        drawProgram.compileShader(vertexShaderFile.c_str(), GLSLShader::VERTEX, defines);
+        drawProgram.compileShader(fragmentShaderFile.c_str(), GLSLShader::FRAGMENT, defines);
+        drawProgram.link();
+    }
+    catch (GLSLProgramException& e) {
+        cerr << "Viewer program: " << e.what() << endl;
+        exit(EXIT_FAILURE);
+    }
+    glGenQueries(TIMER_QUERIES, timerQueries);
+    glClearColor(0.96f, 0.96f, 0.96f, 1.0f);
+}
+
+void SmoothingScene::collectTimings()
+{
+    for (int q = 0; q < TIMER_QUERIES; ++q) {
+        if (queryIterations[q] == 0) continue;
+        GLint available = 0;
+        glGetQueryObjectiv(timerQueries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) continue;
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(timerQueries[q], GL_QUERY_RESULT, &elapsed);
+
+        // Software renderers may report no GPU time; fall back to wall-clock time.
+        double ms = elapsed > 1000 ? elapsed / 1.0e6 : queryWallMs[q];
+        double sample = ms / queryIterations[q];
+        msPerIteration = msPerIteration > 0.0 ? 0.8 * msPerIteration + 0.2 * sample : sample;
+        queryIterations[q] = 0;
+    }
+}
+
+void SmoothingScene::update(float t)
+{
+    collectTimings();
+    lastFrameIterations = 0;
+    if (!m_animate) return;
+
+    // One iteration until the first timing arrives, then as many as fit the budget
+    int count = 1;
+    if (msPerIteration > 0.0) count = std::max(1, std::min(iterationsPerFrame, int(budgetMs / msPerIteration)));
+
+    // A query still in flight is not reused; the frame then goes untimed
+    bool timed = queryIterations[nextQuery] == 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (timed) glBeginQuery(GL_TIME_ELAPSED, timerQueries[nextQuery]);
+    mesh->smoothVertices(count);
+    if (timed) {
+        glEndQuery(GL_TIME_ELAPSED);
+        queryIterations[nextQuery] = count;
+        queryWallMs[nextQuery] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        nextQuery = (nextQuery + 1) % TIMER_QUERIES;
+    }
+    iterationsDone += count;
+    lastFrameIterations = count;
+}
+
+void SmoothingScene::render()
+{
+    // The smoothing program stays installed between frames (setUniform needs it)
+    GLint smoothingProgram = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &smoothingProgram);
+
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glEnable(GL_DEPTH_TEST);
+    glPolygonMode(GL_FRONT_AND_BACK, wireframe ? GL_LINE : GL_FILL);
+
+    // Orbit around the bounding box as loaded, filling the shorter side
+    vec3 lo, hi;
+    mesh->getBoundingBox(lo, hi);
+    vec3 center = 0.5f * (lo + hi);
+    float radius = 0.5f * glm::length(hi - lo);
+    if (!(radius > 0.0f)) radius = 1.0f;
+    const float fieldOfView = glm::radians(30.0f);
+    float aspect = float(width) / float(height);
+    float distance = radius / std::sin(0.5f * fieldOfView * std::min(aspect, 1.0f));
+    float a = glm::radians(azimuth), e = glm::radians(elevation);
+    vec3 eye = center + distance * vec3(std::cos(e) * std::sin(a), std::sin(e), std::cos(e) * std::cos(a));
+    mat4 view = glm::lookAt(eye, center, vec3(0.0f, 1.0f, 0.0f));
+    mat4 projection = glm::perspective(fieldOfView, aspect, std::max(distance - 1.01f * radius, 1e-3f * distance),
+        distance + 1.01f * radius);
+
+    // Positions were just written by compute dispatches
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    drawProgram.use();
+    drawProgram.setUniform("viewProjection", projection * view);
+    drawProgram.setUniform("eye", eye);
+    drawProgram.setUniform("bboxMin", lo);
+    drawProgram.setUniform("bboxExtent", hi - lo);
+    mesh->render();
+
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(GLuint(smoothingProgram));
+}
+
+void SmoothingScene::resize(int w, int h)
+{
+    width = std::max(w, 1);
+    height = std::max(h, 1);
+}
+
+void SmoothingScene::setLambda(float value)
+{
+    lambda = std::min(std::max(value, 0.0f), 1.0f);
+    mesh->setLambda(lambda);
+}
+
+void SmoothingScene::orbit(float degreesAzimuth, float degreesElevation)
+{
+    azimuth = std::fmod(azimuth + degreesAzimuth, 360.0f);
+    elevation = std::min(std::max(elevation + degreesElevation, -89.0f), 89.0f);
+}
+
+void SmoothingScene::restart()
+{
+    if (!reload) return;
+    GLint smoothingProgram = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &smoothingProgram);
+    reload();
+    glUseProgram(GLuint(smoothingProgram));
+    mesh->setLambda(lambda);
+    iterationsDone = 0;
+}
+
+string SmoothingScene::status() const
+{
+    char line[160];
+    snprintf(line, sizeof(line), "%lld iterations (%d/frame, max %d, %.3f ms each), lambda %.2f%s",
+        iterationsDone, lastFrameIterations, iterationsPerFrame, msPerIteration, lambda, m_animate ? "" : ", paused");
+    return line;
+}
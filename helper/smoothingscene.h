@@ -0,0 +1,87 @@
+#ifndef SMOOTHINGSCENE_H
+#define SMOOTHINGSCENE_H
+
+#include "scene.h"
+#include "gldecl.h"
+#include "glslprogram.h"
+
+#include <functional>
+#include <string>
+using std::string;
+
+class SSBOMesh;
+
+/////////////////////////////////////////////////////////////////////////////
+// Interactive view of a mesh being smoothed. Every frame runs up to
+// iterationsPerFrame smoothing iterations and draws whichever position SSBO
+// holds the latest result (SSBOMesh::render), so positions never go back
+// to the host. The iterations of a frame are capped by a budget of GPU time:
+// the cost of an iteration is measured with GL_TIME_ELAPSED queries that are
+// collected a few frames later, when the GPU has finished them, rather than
+// waited for. The Scene animation flag pauses the smoothing.
+/////////////////////////////////////////////////////////////////////////////
+
+class SmoothingScene : public Scene
+{
+private:
+    static const int TIMER_QUERIES = 4;
+
+    SSBOMesh* mesh;
+    GLSLProgram drawProgram;   // From the two shader files, for the mesh's position format
+    string vertexShaderFile;
+    string fragmentShaderFile;
+    std::function<void()> reload;
+
+    int width;
+    int height;
+    float azimuth;             // Camera orbit around the bounding box, degrees
+    float elevation;
+    bool wireframe;
+
+    int iterationsPerFrame;    // Upper bound set by the user
+    double budgetMs;           // GPU time per frame for smoothing
+    float lambda;
+    long long iterationsDone;
+    int lastFrameIterations;
+
+    // Timer queries in flight (iterations > 0) and the wall time of their
+    // submission, the fallback for renderers that report no GPU time.
+    GLuint timerQueries[TIMER_QUERIES];
+    int queryIterations[TIMER_QUERIES];
+    double queryWallMs[TIMER_QUERIES];
+    int nextQuery;
+    double msPerIteration;     // Moving average, 0 until measured
+
+    void collectTimings();
+
+    // Make these private in order to make the object non-copyable
+    SmoothingScene(const SmoothingScene& other);
+    SmoothingScene& operator=(const SmoothingScene& other) { return *this; }
+
+public:
+    // 'smoothedMesh' must be loaded with its smoothing program set and stay
+    // valid. 'reloadMesh' reloads it from its input for restart() (optional).
+    SmoothingScene(SSBOMesh* smoothedMesh, const char* vertexShaderFileName, const char* fragmentShaderFileName,
+        std::function<void()> reloadMesh);
+    ~SmoothingScene();
+
+    void initScene();
+    void update(float t);
+    void render();
+    void resize(int w, int h);
+
+    // Live controls
+    void setIterationsPerFrame(int count) { iterationsPerFrame = count < 1 ? 1 : count; }
+    int getIterationsPerFrame() const { return iterationsPerFrame; }
+    void setFrameBudget(double ms) { budgetMs = ms; }
+    void setLambda(float value);
+    float getLambda() const { return lambda; }
+    void orbit(float degreesAzimuth, float degreesElevation);
+    void setWireframe(bool enabled) { wireframe = enabled; }
+    void restart();
+
+    // One line for the window title: iterations, cost, lambda
+    string status() const;
+};
+
+#endif // SMOOTHINGSCENE_H
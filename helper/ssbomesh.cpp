@@ -1,10 +1,26 @@
 #include "ssbomesh.h"
 #include "glutils.h"
 #include "gldecl.h"
+#include "sharedmem.h"
+#include "glslprogram.h"
+#include "neighborcodec.h"
+#include "streamsmoother.h"
+#include "blockstore.h"
+#include "partition.h"
+#include "shadercache.h"
+#include "arena.h"
+#include "meshclean.h"
 
 #include <cstdlib>
 #include <iostream>
-#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/packing.hpp>
 using std::cout;
 using std::cerr;
 using std::endl;
@@ -12,259 +28,1699 @@ using std::endl;
 using std::ifstream;
 #include <sstream>
 using std::istringstream;
+#include <cstring>
 
-SSBOMesh::SSBOMesh(const char* fileName)
+// GL_KHR_shader_subgroup (newer than some GLEW releases)
+#ifndef GL_SUBGROUP_SIZE_KHR
+#define GL_SUBGROUP_SIZE_KHR                   0x9532
+#define GL_SUBGROUP_SUPPORTED_STAGES_KHR       0x9533
+#define GL_SUBGROUP_SUPPORTED_FEATURES_KHR     0x9534
+#define GL_SUBGROUP_FEATURE_ARITHMETIC_BIT_KHR 0x00000004
+#endif
+
+// bucketValence entry of the cooperative gather bucket
+static const GLuint GATHER_BUCKET = ~0u;
+
+SSBOMesh::SSBOMesh() : faces(0), vertices(0), vaoHandle(0), currentBuffer(3), buffersInSync(true),
+    program(NULL), flagsHandle(0), lockMask(0), lambda(1.0f), creaseAngle(60.0f), welding(true), weldEpsilon(0.0f),
+    positionFormat(POSITIONS_FP32), bboxMin(0.0f), bboxMax(0.0f), keepReference(false),
+    compressNeighbors(false), gaussSeidel(false), colorHandle(0),
+    shaderCache(NULL), valenceBuckets(false), bucketHandle(0),
+    gatherValence(64), gatherLanes(0), verticesPerGroup(256),
+    persistentGroups(0), persistentChunk(0), persistentIterations(1), queueHandle(0),
+    hcSmoothing(false), hcAlpha(0.1f), hcBeta(0.6f), originalHandle(0), differenceHandle(0),
+    smoothingOperator(OPERATOR_UMBRELLA), timeStep(0.0f), stepClamp(0.5f),
+    bilateral(false), bilateralSettings(), centroidHandle(0), centroidSpacing(1.0f),
+    volumeInterval(0), volumeCaptured(false), profiling(false), timerQuery(0), lastSmoothMs(0.0),
+    streamBlockVertices(0), streamHalo(4), streamCacheBlocks(32), blockStore(NULL), streamer(NULL),
+    transport(NULL), distributed(NULL), hostOnly(false), lastLoad(), activeHandle(0), indirectHandle(0), activeCapacity(0), regionGeneration(0)
+{
+    std::fill(ssboHandle, ssboHandle + 6, 0u);
+    std::fill(faceAdjacencyHandle, faceAdjacencyHandle + 4, 0u);
+    std::fill(normalHandle, normalHandle + 2, 0u);
+    std::fill(volumeHandle, volumeHandle + 2, 0u);
+}
+
+SSBOMesh::~SSBOMesh()
+{
+    // Host-only meshes own no GL objects and may be destroyed off the GL thread
+    if (ssboHandle[0] != 0) glDeleteBuffers(6, ssboHandle);
+    if (faceAdjacencyHandle[0] != 0) glDeleteBuffers(4, faceAdjacencyHandle);
+    if (normalHandle[0] != 0) glDeleteBuffers(2, normalHandle);
+    if (volumeHandle[0] != 0) glDeleteBuffers(2, volumeHandle);
+    const GLuint buffers[] = { flagsHandle, colorHandle, bucketHandle, queueHandle, originalHandle, differenceHandle,
+        centroidHandle, activeHandle, indirectHandle };
+    for (GLuint buffer : buffers) {
+        if (buffer != 0) glDeleteBuffers(1, &buffer);
+    }
+    if (timerQuery != 0) glDeleteQueries(1, &timerQuery);
+    if (vaoHandle != 0) glDeleteVertexArrays(1, &vaoHandle);
+    for (std::map<string, GLSLProgram*>::iterator it = variantPrograms.begin(); it != variantPrograms.end(); ++it) {
+        delete it->second;
+    }
+    delete streamer;
+    delete blockStore;
+    delete distributed;
+}
+
+SSBOMesh::SSBOMesh(const char* fileName) : SSBOMesh()
 {
     loadOBJ(fileName);
 }
 
-void SSBOMesh::loadOBJ(const char* fileName) {
+// OBJ whitespace (the line terminator is replaced by '\0' while parsing)
+static bool isBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static char* skipBlanks(char* p) {
+    while (isBlank(*p)) ++p;
+    return p;
+}
 
-    vector <vec3> points;
-    vector <GLuint> faces;
+static char* skipToken(char* p) {
+    while (*p && !isBlank(*p)) ++p;
+    return p;
+}
 
-    int nFaces = 0;
+// Arena bytes the adjacency build takes per vertex: the corner table sort
+// keys and their merge buffer, 2 * 16 bytes for each of about 6 corners.
+static const size_t ADJACENCY_BYTES_PER_VERTEX = 200;
 
-    ifstream objStream(fileName, std::ios::in);
+// Arena bytes the cleanup takes per vertex: the vertex grid and chains
+// (about 40) and the face buckets and keys for its two faces (about 80).
+static const size_t CLEANUP_BYTES_PER_VERTEX = 120;
+
+static void printCleanup(const CleanupStats& stats, double ms)
+{
+    cout << " Cleanup: welded " << stats.weldedVertices << " vertices, dropped " << stats.degenerateFaces
+        << " degenerate and " << stats.duplicateFaces << " duplicate faces (" << ms << " ms)." << endl;
+}
+
+void SSBOMesh::loadOBJ(const char* fileName) {
+    if (streamBlockVertices > 0) {
+        loadBlockStore(fileName);
+        return;
+    }
+    std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+
+    ifstream objStream(fileName, std::ios::in | std::ios::binary);
 
     if (!objStream) {
         cerr << "Unable to open OBJ file: " << fileName << endl;
         exit(1);
     }
+    objStream.seekg(0, std::ios::end);
+    size_t fileSize = size_t(objStream.tellg());
+    objStream.seekg(0, std::ios::beg);
 
-    string line, token;
-    vector<int> face;
+    // All temporaries of the load (file text, points, faces, adjacency sets)
+    // come from one arena, sized from the file. A vertex takes at least about
+    // 70 bytes of OBJ text (its v line and two f lines), so this rather
+    // overestimates; an underestimate only costs another block.
+    MonotonicArena arena(fileSize + 64 + (fileSize / 70 + 1) * (ADJACENCY_BYTES_PER_VERTEX + CLEANUP_BYTES_PER_VERTEX + 40));
 
-    
-    while (getline(objStream, line)) {
-        trimString(line);
-        if (line.length() > 0 && line.at(0) != '#') {
-            istringstream lineStream(line);
+    char* text = static_cast<char*>(arena.allocate(fileSize + 1, 1));
+    objStream.read(text, fileSize);
+    text[objStream.gcount()] = '\0';
+    objStream.close();
+    char* textEnd = text + objStream.gcount();
 
-            lineStream >> token;
+    // Count vertex and face lines first, so points and faces are reserved once
+    size_t pointLines = 0, faceLines = 0;
+    for (char* line = text; line < textEnd; ) {
+        char* p = skipBlanks(line);
+        if ((p[0] == 'v' || p[0] == 'f') && isBlank(p[1])) (p[0] == 'v' ? pointLines : faceLines)++;
+        char* next = static_cast<char*>(memchr(p, '\n', textEnd - p));
+        line = next ? next + 1 : textEnd;
+    }
 
-            if (token == "v") {
-                float x, y, z;
-                lineStream >> x >> y >> z;
-                points.push_back(vec3(x, y, z));
-            }
-            else if (token == "f") {
-                nFaces++;
-
-                // Process face
-                face.clear();
-                while (lineStream.good()) {
-                    string vertString;
-                    lineStream >> vertString;
-                    int pIndex = -1;
-
-                    pIndex = atoi(vertString.c_str()) - 1;
-                    
-                    if (pIndex == -1) {
-                        printf("Missing point index!!!");
-                    }
-                    else {
-                        face.push_back(pIndex);
-                    }
+    vector<vec3, ArenaAllocator<vec3>> points{ ArenaAllocator<vec3>(arena) };
+    vector<GLuint, ArenaAllocator<GLuint>> faces{ ArenaAllocator<GLuint>(arena) };
+    vector<int, ArenaAllocator<int>> face{ ArenaAllocator<int>(arena) };
+    points.reserve(pointLines);
+    faces.reserve(3 * faceLines);
+    face.reserve(16);
+
+    int nFaces = 0;
+
+    for (char* line = text; line < textEnd; ) {
+        char* next = static_cast<char*>(memchr(line, '\n', textEnd - line));
+        if (next) *next = '\0';
+        char* p = skipBlanks(line);
+        line = next ? next + 1 : textEnd;
+        if (*p == '\0' || *p == '#') continue;
+
+        char* token = p;
+        p = skipBlanks(skipToken(p));
+        size_t tokenLength = skipToken(token) - token;
 
+        if (tokenLength == 1 && token[0] == 'v') {
+            float x = strtof(p, &p);
+            float y = strtof(p, &p);
+            float z = strtof(p, &p);
+            points.push_back(vec3(x, y, z));
+        }
+        else if (tokenLength == 1 && token[0] == 'f') {
+            nFaces++;
+
+            // Process face
+            face.clear();
+            while (*p) {
+                int pIndex = -1;
+
+                pIndex = atoi(p) - 1; // Stops at '/' (texture and normal indices)
+
+                if (pIndex == -1) {
+                    printf("Missing point index!!!");
+                }
+                else {
+                    face.push_back(pIndex);
                 }
-                // If number of edges in face is greater than 3,
-                // decompose into triangles as a triangle fan.
-                if (face.size() > 3) {
-                    int v0 = face[0];
-                    int v1 = face[1];
-                    int v2 = face[2];
-                    // First face
+                p = skipBlanks(skipToken(p));
+            }
+            // If number of edges in face is greater than 3,
+            // decompose into triangles as a triangle fan.
+            if (face.size() > 3) {
+                int v0 = face[0];
+                int v1 = face[1];
+                int v2 = face[2];
+                // First face
+                faces.push_back(v0);
+                faces.push_back(v1);
+                faces.push_back(v2);
+                for (GLuint i = 3; i < face.size(); i++) {
+                    v1 = v2;
+                    v2 = face[i];
                     faces.push_back(v0);
                     faces.push_back(v1);
                     faces.push_back(v2);
-                    for (GLuint i = 3; i < face.size(); i++) {
-                        v1 = v2;
-                        v2 = face[i];
-                        faces.push_back(v0);
-                        faces.push_back(v1);
-                        faces.push_back(v2);
-                    }
-                }
-                else {
-                    faces.push_back(face[0]);
-                    faces.push_back(face[1]);
-                    faces.push_back(face[2]);
                 }
             }
+            else {
+                faces.push_back(face[0]);
+                faces.push_back(face[1]);
+                faces.push_back(face[2]);
+            }
         }
     }
+    std::chrono::steady_clock::time_point parsed = std::chrono::steady_clock::now();
 
-    objStream.close();
+    CleanupStats cleanup = { 0, 0, 0 };
+    if (welding) {
+        GLuint numPoints = GLuint(points.size()), numTriangles = GLuint(faces.size() / 3);
+        cleanup = cleanMesh((float*)points.data(), numPoints, faces.data(), numTriangles, weldEpsilon, arena);
+        points.resize(numPoints);
+        faces.resize(3 * size_t(numTriangles));
+    }
+    std::chrono::steady_clock::time_point cleaned = std::chrono::steady_clock::now();
 
     // Generate adjacency list 
-    vector<vector<GLuint>> adjacencies(points.size());
-    generateAdjacencyList(points, faces, adjacencies);
-    storeSSBO(adjacencies, points, faces);
+    generateAdjacencyList(GLuint(points.size()), (const float*)points.data(), faces.data(), faces.size(), arena);
+    std::chrono::steady_clock::time_point connected = std::chrono::steady_clock::now();
+    // vec3 is tightly packed, so the points can be uploaded as a flat float array.
+    storeSSBO((const float*)points.data(), faces.data(), GLuint(points.size()), GLuint(faces.size() / 3));
+    std::chrono::steady_clock::time_point stored = std::chrono::steady_clock::now();
+
+    lastLoad.parse = std::chrono::duration<double, std::milli>(parsed - loadStart).count();
+    lastLoad.cleanup = std::chrono::duration<double, std::milli>(cleaned - parsed).count();
+    lastLoad.adjacency = std::chrono::duration<double, std::milli>(connected - cleaned).count();
+    lastLoad.upload = std::chrono::duration<double, std::milli>(stored - connected).count();
+    lastLoad.heapAllocations = arena.allocationCount();
 
     cout << "Loaded mesh from: " << fileName << endl;
     cout << " " << points.size() << " points" << endl;
     cout << " " << faces.size() / 3 << " triangles." << endl;
-    cout << " " << adjacencies.size() << " adjacency entries." << endl;
+    cout << " " << hostSpans.size() << " adjacency entries." << endl;
+    if (welding) printCleanup(cleanup, lastLoad.cleanup);
+    printFeatureCounts();
+    cout << " Load: parse " << lastLoad.parse << " ms, adjacency " << lastLoad.adjacency
+        << " ms, upload " << lastLoad.upload << " ms; " << lastLoad.heapAllocations << " temporaries in "
+        << arena.blockCount() << " arena blocks (" << arena.bytesReserved() / 1024 << " KB)." << endl;
+}
+
+void SSBOMesh::loadBlockStore(const char* fileName) {
+    std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+
+    delete streamer;
+    delete blockStore;
+    streamer = NULL;
+    blockStore = new BlockStore();
+    if (!blockStore->build(fileName, streamScratch.c_str(), streamBlockVertices, creaseAngle)) {
+        delete blockStore; // Removes the scratch files
+        blockStore = NULL;
+        exit(1);
+    }
+    if (blockStore->numFaces() > UINT32_MAX) {
+        cerr << "OBJ file has too many triangles for 32-bit counts: " << fileName << endl;
+        exit(1);
+    }
+    vertices = blockStore->numVertices();
+    faces = GLuint(blockStore->numFaces());
+    streamer = new StreamingSmoother(*blockStore, streamCacheBlocks);
+
+    lastLoad = LoadTimings();
+    lastLoad.parse = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+
+    cout << "Loaded mesh from: " << fileName << " into a block file" << endl;
+    cout << " " << vertices << " points" << endl;
+    cout << " " << faces << " triangles." << endl;
+    cout << " " << blockStore->numBlocks() << " blocks of about " << streamBlockVertices << " vertices, streamed with a "
+        << streamHalo << "-ring halo and " << streamCacheBlocks << " cached blocks." << endl;
+    cout << " Load: " << lastLoad.parse << " ms." << endl;
+}
+
+bool SSBOMesh::loadShared(const char* segmentName, bool clean) {
+    SharedMemorySegment segment;
+    SharedMeshHeader* header = openSharedMesh(segment, segmentName, true);
+    if (!header) return false;
+
+    // Positions and faces are consumed in place (copied only if a requested
+    // cleanup welds or drops something); the segment is unmapped once uploaded.
+    loadArrays(sharedMeshPositions(header), sharedMeshFaces(header), header->vertices, header->faces,
+        ("shared memory: " + string(segmentName)).c_str(), clean);
+    return true;
+}
+
+void SSBOMesh::loadArrays(const float* positions, const GLuint* elements, GLuint numVertices, GLuint numFaces, const char* source,
+    bool clean) {
+    std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+
+    MonotonicArena arena(size_t(numVertices) * (ADJACENCY_BYTES_PER_VERTEX + (clean ? CLEANUP_BYTES_PER_VERTEX + 36 : 0)) + 64 * 1024);
+
+    // The arrays are not ours, so the cleanup only reads them; a cleaned copy
+    // goes to the arena if there is anything to weld or drop.
+    CleanupStats cleanup = { 0, 0, 0 };
+    if (clean) {
+        CleanupPlan plan = planCleanup(positions, numVertices, elements, numFaces, weldEpsilon, arena);
+        cleanup = plan.stats;
+        if (cleanupNeeded(cleanup)) {
+            float* cleanPositions = static_cast<float*>(arena.allocate(3 * size_t(numVertices) * sizeof(float), alignof(float)));
+            GLuint* cleanFaces = static_cast<GLuint*>(arena.allocate(3 * size_t(numFaces) * sizeof(GLuint), alignof(GLuint)));
+            applyCleanup(plan, positions, numVertices, elements, numFaces, cleanPositions, cleanFaces, arena);
+            positions = cleanPositions;
+            elements = cleanFaces;
+        }
+    }
+    std::chrono::steady_clock::time_point cleaned = std::chrono::steady_clock::now();
+
+    generateAdjacencyList(numVertices, positions, elements, 3 * size_t(numFaces), arena);
+    std::chrono::steady_clock::time_point connected = std::chrono::steady_clock::now();
+    storeSSBO(positions, elements, numVertices, numFaces);
+    std::chrono::steady_clock::time_point stored = std::chrono::steady_clock::now();
+
+    lastLoad.parse = 0.0;
+    lastLoad.cleanup = std::chrono::duration<double, std::milli>(cleaned - loadStart).count();
+    lastLoad.adjacency = std::chrono::duration<double, std::milli>(connected - cleaned).count();
+    lastLoad.upload = std::chrono::duration<double, std::milli>(stored - connected).count();
+    lastLoad.heapAllocations = arena.allocationCount();
+
+    cout << "Loaded mesh from " << source << endl;
+    cout << " " << vertices << " points" << endl;
+    cout << " " << faces << " triangles." << endl;
+    if (clean) printCleanup(cleanup, lastLoad.cleanup);
+    printFeatureCounts();
+    cout << " Load: adjacency " << lastLoad.adjacency << " ms, upload " << lastLoad.upload << " ms." << endl;
+}
+
+bool SSBOMesh::exportShared(const char* segmentName) {
+    SharedMemorySegment segment;
+    if (!segment.open(segmentName)) return false;
+
+    if (segment.size() < sharedMeshSize(vertices, faces)) {
+        cerr << "Shared memory segment too small for output mesh: " << segmentName << endl;
+        return false;
+    }
+
+    // Read back straight into the caller's segment.
+    SharedMeshHeader* header = (SharedMeshHeader*)segment.data();
+    header->magic = SHARED_MESH_MAGIC;
+    header->version = SHARED_MESH_VERSION;
+    header->vertices = vertices;
+    header->faces = faces;
+
+    readPositions(sharedMeshPositions(header));
+    if (hostResident()) {
+        readFaces(sharedMeshFaces(header));
+    }
+    else {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[5]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 3 * faces * sizeof(GLuint), sharedMeshFaces(header));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    cout << "Smoothing complete. Output written to shared memory: " << segmentName << endl;
+    return true;
 }
 
 void SSBOMesh::generateAdjacencyList(
-    const vector<vec3>& points,
-    const vector<GLuint>& faces,
-    vector<vector<GLuint>>& adjacencies)
+    GLuint numPoints,
+    const float* positions,
+    const GLuint* faces,
+    size_t numIndices,
+    MonotonicArena& arena)
 {
-    // Using unordered_set instead of vector for O(1) lookups
-    vector<std::unordered_set<GLuint>> adjacenciesSet(points.size());
+    // Boundaries, creases and the neighbor lists all come from the corner
+    // table, which stays with the mesh for the kernels that need faces.
+    topology.build(faces, GLuint(numIndices / 3), numPoints, 0, &arena);
 
-    // Optional: Pre-allocate space (typical vertex has 5-8 neighbors)
-    for (auto& adj : adjacenciesSet) {
-        adj.reserve(8);
-    }
+    hostFlags.assign(numPoints, VertexFlags{ 0u, 1.0f });
+    const float cosCrease = cosf(glm::radians(creaseAngle));
 
-    for (size_t i = 0; i < faces.size(); i += 3) {
-        GLuint v0 = faces[i];
-        GLuint v1 = faces[i + 1];
-        GLuint v2 = faces[i + 2];
+    auto faceNormal = [&](size_t f) {
+        vec3 a = glm::make_vec3(positions + 3 * faces[3 * f]);
+        vec3 b = glm::make_vec3(positions + 3 * faces[3 * f + 1]);
+        vec3 c = glm::make_vec3(positions + 3 * faces[3 * f + 2]);
+        vec3 n = glm::cross(b - a, c - a);
+        float len = glm::length(n);
+        return len > 0.0f ? n / len : n;
+    };
 
-        // With unordered_set, insertion only happens if element doesn't exist
-        adjacenciesSet[v0].insert(v1);
-        adjacenciesSet[v0].insert(v2);
-        adjacenciesSet[v1].insert(v0);
-        adjacenciesSet[v1].insert(v2);
-        adjacenciesSet[v2].insert(v0);
-        adjacenciesSet[v2].insert(v1);
+    // Every corner faces the edge between the other two corners of its face
+    for (GLuint c = 0; c < numIndices; ++c) {
+        GLuint a = faces[CornerTable::next(c)];
+        GLuint b = faces[CornerTable::prev(c)];
+        GLuint opposite = topology.opposites[c];
+        if (opposite == CORNER_BOUNDARY) {
+            // Edges used by a single face lie on the mesh boundary
+            hostFlags[a].bits |= VERTEX_BOUNDARY;
+            hostFlags[b].bits |= VERTEX_BOUNDARY;
+        }
+        else if (opposite == CORNER_NON_MANIFOLD) {
+            // Non-manifold edge: treat as a feature
+            hostFlags[a].bits |= VERTEX_CREASE;
+            hostFlags[b].bits |= VERTEX_CREASE;
+        }
+        else if (c < opposite && glm::dot(faceNormal(CornerTable::face(c)), faceNormal(CornerTable::face(opposite))) < cosCrease) {
+            hostFlags[a].bits |= VERTEX_CREASE;
+            hostFlags[b].bits |= VERTEX_CREASE;
+        }
     }
 
-    // Convert to vector<vector<GLuint>> for subsequent reading
-    for (size_t i = 0; i < adjacenciesSet.size(); ++i) {
-        adjacencies[i].reserve(adjacenciesSet[i].size());
-        adjacencies[i].assign(adjacenciesSet[i].begin(), adjacenciesSet[i].end());
+    // Flatten into the host CSR (spans, offsets, neighbors): the other two
+    // vertices of every incident face, ascending and without duplicates
+    hostSpans.assign(numPoints, 0);
+    hostOffsets.assign(numPoints, 0);
+    hostNeighbors.clear();
+    hostNeighbors.reserve(numIndices);
+
+    vector<GLuint> ring;
+    for (GLuint v = 0; v < numPoints; ++v) {
+        ring.clear();
+        for (GLuint k = topology.cornerBegin(v); k < topology.cornerEnd(v); ++k) {
+            GLuint c = topology.vertexCorners[k];
+            GLuint a = faces[CornerTable::next(c)];
+            GLuint b = faces[CornerTable::prev(c)];
+            if (a != v) ring.push_back(a);
+            if (b != v) ring.push_back(b);
+        }
+        std::sort(ring.begin(), ring.end());
+        ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+        hostSpans[v] = GLuint(ring.size());
+        hostOffsets[v] = GLuint(hostNeighbors.size());
+        hostNeighbors.insert(hostNeighbors.end(), ring.begin(), ring.end());
     }
 }
 
-void SSBOMesh::storeSSBO(const vector<vector<GLuint>>& adjacencies,
-    const vector<vec3>& points,
-    const vector<GLuint>& elements)
+void SSBOMesh::storeSSBO(const float* positions,
+    const GLuint* elements,
+    GLuint numVertices,
+    GLuint numFaces)
 {
-    vertices = GLuint(points.size());
-    faces = GLuint(elements.size() / 3);
+    vertices = numVertices;
+    faces = numFaces;
 
     // === SSBO for Neighbor Indices ===
-    float* vertPos = new float[3 * vertices];
-    float* vertPosAlt = new float[3 * vertices];
-    unsigned int* spans = new unsigned int[vertices];
-    unsigned int* offsets = new unsigned int[vertices];
+    // The CSR from generateAdjacencyList(), kept on the host as well for
+    // region expansion in smoothRegion().
+    vector<GLuint>& spans = hostSpans;
+    vector<GLuint>& offsets = hostOffsets;
+    vector<GLuint>& flatNeighbors = hostNeighbors;
 
-    vector<GLuint> flatNeighbors;
+    // Bounding box (quantization frame for POSITIONS_QUANT21)
+    bboxMin = bboxMax = vertices > 0 ? glm::make_vec3(positions) : vec3(0.0f);
+    for (size_t i = 1; i < vertices; ++i) {
+        vec3 p = glm::make_vec3(positions + 3 * i);
+        bboxMin = glm::min(bboxMin, p);
+        bboxMax = glm::max(bboxMax, p);
+    }
 
-    // Calculate total neighbors upfront
-    size_t totalNeighbors = 0;
-    for (const auto& adj : adjacencies) {
-        totalNeighbors += adj.size();
+    if (hostOnly) {
+        hostPositions.assign(positions, positions + 3 * size_t(vertices));
+        hostFaces.assign(elements, elements + 3 * size_t(faces));
+        return;
     }
-    flatNeighbors.reserve(totalNeighbors);
 
-    int idx = 0, counter = 0;
-    unsigned int* el = new unsigned int[elements.size()];
-    for (unsigned int i = 0; i < elements.size(); ++i)
-    {
-        el[i] = elements[i];
+    if (transport) {
+        // Distributed: only this rank's piece is uploaded (by DistributedSmoother).
+        hostPositions.assign(positions, positions + 3 * size_t(vertices));
+        hostFaces.assign(elements, elements + 3 * size_t(faces));
+        delete distributed;
+        distributed = new DistributedSmoother(transport, hostSpans, hostOffsets, hostNeighbors, hostFlags, positions);
+        const MeshPartition& part = distributed->partition();
+        cout << "Rank " << part.rank << ": " << part.numOwned << " owned vertices, " << part.numGhosts()
+            << " ghosts, " << part.peers.size() << " neighboring ranks." << endl;
+        return;
     }
 
-    for (size_t i = 0; i < vertices; ++i) {
-        vertPos[idx] = points[i].x;
-        vertPos[idx + 1] = points[i].y;
-        vertPos[idx + 2] = points[i].z;
-        vertPosAlt[idx] = points[i].x;
-        vertPosAlt[idx + 1] = points[i].y;
-        vertPosAlt[idx + 2] = points[i].z;
-        idx += 3;
-        spans[i] = (unsigned int)adjacencies[i].size();
-        offsets[i] = counter;
-        counter += spans[i];
-        flatNeighbors.insert(flatNeighbors.end(), adjacencies[i].begin(), adjacencies[i].end());
-    }
-
-    glGenBuffers(6, ssboHandle);
+    vector<GLuint> packed;
+    const void* positionData = positions;
+    if (positionFormat != POSITIONS_FP32) {
+        encodePositions(positions, vertices, packed);
+        positionData = packed.data();
+    }
+    if (keepReference) {
+        referencePositions.assign(positions, positions + 3 * size_t(vertices));
+    }
+
+    // Optionally delta-encode the neighbor indices; offsets then count 16-bit slots.
+    vector<GLuint> packedNeighbors, slotOffsets;
+    const vector<GLuint>* neighborData = &flatNeighbors;
+    const vector<GLuint>* offsetData = &offsets;
+    if (compressNeighbors) {
+        NeighborCodecStats stats = encodeNeighborDeltas(spans, offsets, flatNeighbors, packedNeighbors, slotOffsets);
+        neighborData = &packedNeighbors;
+        offsetData = &slotOffsets;
+        cout << "Compressed neighbor indices: " << stats.edges << " edges, "
+            << double(stats.bytes) / std::max<size_t>(stats.edges, 1) << " bytes/edge (uncompressed: 4), "
+            << stats.escapes << " escaped." << endl;
+    }
+
+    if (ssboHandle[0] == 0) glGenBuffers(6, ssboHandle);
     int bufIdx = 0;
 
     // === SSBO for Neighbor Information ===
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[bufIdx++]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, flatNeighbors.size() * sizeof(GLuint), flatNeighbors.data(), GL_STATIC_DRAW);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, neighborData->size() * sizeof(GLuint), neighborData->data(), GL_STATIC_DRAW);
 
     // === SSBO for Vertex Valence === 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[bufIdx++]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, vertices * sizeof(unsigned int), spans, GL_STATIC_DRAW);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, vertices * sizeof(GLuint), spans.data(), GL_STATIC_DRAW);
 
     // === SSBO for Vertex Offset ===
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[bufIdx++]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, vertices * sizeof(unsigned int), offsets, GL_STATIC_DRAW);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, vertices * sizeof(GLuint), offsetData->data(), GL_STATIC_DRAW);
 
     // === SSBO for Vertex Position === 
+    // fp32 positions are uploaded directly from the caller's array (OBJ points
+    // or a mapped shared segment); packed formats from the encoded copy.
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[bufIdx++]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, (3 * vertices) * sizeof(float), vertPos, GL_DYNAMIC_COPY);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, vertices * positionStride(), positionData, GL_DYNAMIC_COPY);
 
     // === Alternate SSBO for Vertex Information (Ping-pong target) === 
+    // Gauss-Seidel updates in place and leaves it empty.
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[bufIdx++]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, (3 * vertices) * sizeof(float), vertPosAlt, GL_DYNAMIC_COPY);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, gaussSeidel ? 0 : vertices * positionStride(), gaussSeidel ? NULL : positionData, GL_DYNAMIC_COPY);
 
     // === SSBO for face information === 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[bufIdx++]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, 3 * faces * sizeof(unsigned int), el, GL_STATIC_COPY);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 3 * faces * sizeof(GLuint), elements, GL_STATIC_COPY);
+
+    // === Vertex array for render(): positions as attribute 0, faces as elements ===
+    if (vaoHandle == 0) glGenVertexArrays(1, &vaoHandle);
+    glBindVertexArray(vaoHandle);
+    setPositionAttribute(0, positionFormat);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ssboHandle[5]);
+    glBindVertexArray(0);
+
+    // === SSBO for vertex feature flags ===
+    if (flagsHandle == 0) glGenBuffers(1, &flagsHandle);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, flagsHandle);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, vertices * sizeof(VertexFlags), hostFlags.data(), GL_DYNAMIC_DRAW);
+
+    // === SSBOs for HC smoothing: original positions (copied on the GPU) and differences ===
+    if (hcSmoothing) {
+        if (originalHandle == 0) glGenBuffers(1, &originalHandle);
+        if (differenceHandle == 0) glGenBuffers(1, &differenceHandle);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, originalHandle);
+        glBufferData(GL_COPY_WRITE_BUFFER, vertices * positionStride(), NULL, GL_STATIC_COPY);
+        glBindBuffer(GL_COPY_READ_BUFFER, ssboHandle[3]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, vertices * positionStride());
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, differenceHandle);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 3 * size_t(vertices) * sizeof(float), NULL, GL_DYNAMIC_COPY);
+    }
+
+    // === SSBOs for bilateral normal filtering (face adjacency, normals,
+    // centroids) and mean curvature flow (faces around every vertex) ===
+    if (bilateral || smoothingOperator == OPERATOR_MEAN_CURVATURE) buildFaceAdjacency(positions, elements);
+
+    // The volume to restore is taken again before the next smoothing (see restoreVolume)
+    volumeCaptured = false;
+
+    // === SSBO for vertices grouped by color (Gauss-Seidel) ===
+    if (gaussSeidel) {
+        vector<GLuint> order;
+        colorVertices(order);
+        if (colorHandle == 0) glGenBuffers(1, &colorHandle);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, colorHandle);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(order.size(), 1) * sizeof(GLuint), order.data(), GL_STATIC_DRAW);
+    }
+
+    // === SSBO for vertices grouped by valence (bucketed dispatch) ===
+    if (valenceBuckets) {
+        vector<GLuint> order;
+        buildValenceBuckets(order);
+        if (bucketHandle == 0) glGenBuffers(1, &bucketHandle);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bucketHandle);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(order.size(), 1) * sizeof(GLuint), order.data(), GL_STATIC_DRAW);
+    }
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    currentBuffer = 3;
+    buffersInSync = true;
+    regionStamp.assign(vertices, 0);
+    regionGeneration = 0;
 }
 
-void SSBOMesh::smoothVertices(const int numIterations, const char outputModelFilename[]) {
+void SSBOMesh::smoothVertices(const int numIterations) {
+    if (hostOnly) {
+        cerr << "smoothVertices: mesh was loaded host-only!" << endl;
+        return;
+    }
+
+    if (distributed) {
+        if (numIterations <= 0) return;
+        if (!program) {
+            cerr << "smoothVertices: no smoothing program set!" << endl;
+            return;
+        }
+        setSmoothingUniforms(program);
+        distributed->smooth(program, verticesPerGroup, hostPositions, numIterations);
+        return;
+    }
+
+    if (streamer) {
+        if (numIterations <= 0) return;
+        if (!program) {
+            cerr << "smoothVertices: no smoothing program set!" << endl;
+            return;
+        }
+        setSmoothingUniforms(program);
+        if (!streamer->smooth(program, verticesPerGroup, numIterations, streamHalo)) {
+            cerr << "Failed to page blocks through the block file: " << streamScratch << ".*.tmp" << endl;
+            exit(1);
+        }
+        cout << "Streamed " << numIterations << " iterations, peak GPU working set "
+            << streamer->peakResident() / 1024 << " KB, peak host block cache " << streamer->peakCached() / 1024
+            << " KB, " << streamer->blocksRead() << " block reads." << endl;
+        return;
+    }
+
+    if (volumeInterval > 0 && program) {
+        if (numIterations > volumeInterval) {
+            // Smooth in runs of volumeInterval iterations, each followed by the rescale
+            for (int done = 0; done < numIterations; done += volumeInterval)
+                smoothVertices(std::min(volumeInterval, numIterations - done));
+            return;
+        }
+        if (!volumeCaptured && numIterations > 0) restoreVolume(true);
+    }
+
     /* BIG QUESTION : To bind buffer first ? */
     for (int i = 0; i < 3; ++i) {
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, ssboHandle[i]); // binds neighbours, vertex valence, vertex offset
     }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, flagsHandle);
+    if (program) {
+        setSmoothingUniforms(program);
+        program->setUniform("useActiveList", gaussSeidel);
+        program->setUniform("copyOnly", false);
+    }
+    bool denoise = bilateral && !gaussSeidel && program;
+    bool hc = hcSmoothing && !gaussSeidel && !denoise && program;
+    bool flow = smoothingOperator != OPERATOR_UMBRELLA && !gaussSeidel && !denoise && !hc && program;
+    bool bucketed = valenceBuckets && !gaussSeidel && !hc && !denoise && !flow && program;
+    GLSLProgram* persistentProg = NULL;
+    if (persistentGroups > 0 && !gaussSeidel && !bucketed && !hc && !denoise && !flow && program) {
+        persistentProg = variantProgram("PERSISTENT_THREADS");
+        if (!persistentProg) cerr << "Persistent threads unavailable, using the regular dispatch." << endl;
+    }
+    if (bucketed) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, bucketHandle);
+        for (size_t b = 0; b < bucketValence.size(); ++b) {
+            GLSLProgram* prog = bucketProgram(b);
+            prog->use();
+            setSmoothingUniforms(prog);
+            prog->setUniform("useActiveList", true);
+            prog->setUniform("copyOnly", false);
+        }
+    }
+
+    if (profiling) {
+        if (timerQuery == 0) glGenQueries(1, &timerQuery);
+        glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+    }
+
+    if (gaussSeidel) {
+        // One dispatch per color, reading and writing the same buffer. No two
+        // vertices of a color are adjacent, so each dispatch only reads
+        // positions that it does not write.
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[3]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboHandle[3]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, colorHandle);
+        for (int i = 0; i < numIterations; i++) {
+            for (GLuint c = 0; c < numColors(); ++c) {
+                GLuint count = colorStart[c + 1] - colorStart[c];
+                if (program) {
+                    program->setUniform("activeOffset", colorStart[c]);
+                    program->setUniform("activeCount", count);
+                }
+                glDispatchCompute(groupsFor(count), 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            }
+        }
+        if (program) {
+            program->setUniform("activeOffset", 0u);
+            program->setUniform("useActiveList", false);
+        }
+    }
+    else if (denoise) {
+        dispatchBilateral(numIterations);
+    }
+    else if (hc) {
+        dispatchHC(numIterations);
+    }
+    else if (flow) {
+        dispatchFlow(numIterations);
+    }
+    else if (persistentProg) {
+        dispatchPersistent(persistentProg, numIterations);
+        if (numIterations > 0) buffersInSync = false;
+    }
+    else {
+        // Perform N iterations of smoothing
+        for (int i = 0; i < numIterations; i++) {
+            // Read from the buffer holding the latest result and write to the other one
+            int readIdx = currentBuffer;
+            int writeIdx = currentBuffer == 3 ? 4 : 3;
+
+            // Bind buffers to specific binding points
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[readIdx]);  // Input
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboHandle[writeIdx]); // Output
+
+            // Dispatch compute shader
+            if (bucketed) dispatchValenceBuckets();
+            else glDispatchCompute(groupsFor(vertices), 1, 1);
+
+            // Ensure write finishes before next iteration reads
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+            // Flip for next iteration
+            currentBuffer = writeIdx;
+        }
+        if (numIterations > 0) buffersInSync = false;
+    }
+    if (bucketed) {
+        program->use();
+        program->setUniform("activeOffset", 0u);
+        program->setUniform("useActiveList", false);
+    }
+    if (volumeInterval > 0 && program && numIterations > 0) restoreVolume(false);
+
+    if (profiling) {
+        glEndQuery(GL_TIME_ELAPSED);
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &elapsed);
+        lastSmoothMs = elapsed / 1.0e6;
+        cout << numIterations << " iterations: " << lastSmoothMs << " ms ("
+            << (numIterations > 0 ? lastSmoothMs / numIterations : 0.0) << " ms/iteration)" << endl;
+    }
+}
+
+void SSBOMesh::colorVertices(vector<GLuint>& order) {
+    // Greedy coloring in vertex order: each vertex takes the smallest color
+    // not used by an already colored neighbor (at most valence + 1 colors).
+    vector<GLuint> color(vertices, 0);
+    vector<GLuint> usedBy;     // usedBy[c] == v + 1 if a neighbor of v has color c
+    GLuint numColorClasses = 0;
+    for (GLuint v = 0; v < vertices; ++v) {
+        for (GLuint j = 0; j < hostSpans[v]; ++j) {
+            GLuint n = hostNeighbors[hostOffsets[v] + j];
+            if (n < v) usedBy[color[n]] = v + 1;
+        }
+        GLuint c = 0;
+        while (c < numColorClasses && usedBy[c] == v + 1) c++;
+        if (c == numColorClasses) {
+            numColorClasses++;
+            usedBy.push_back(0);
+        }
+        color[v] = c;
+    }
+
+    // Counting sort by color, keeping vertex order within a color
+    colorStart.assign(numColorClasses + 1, 0);
+    for (GLuint v = 0; v < vertices; ++v) colorStart[color[v] + 1]++;
+    for (GLuint c = 0; c < numColorClasses; ++c) colorStart[c + 1] += colorStart[c];
+    order.resize(vertices);
+    vector<GLuint> next(colorStart.begin(), colorStart.end() - 1);
+    for (GLuint v = 0; v < vertices; ++v) order[next[color[v]]++] = v;
+
+    cout << " " << numColorClasses << " colors for Gauss-Seidel (";
+    for (GLuint c = 0; c < numColorClasses; ++c) {
+        cout << (c ? ", " : "") << colorStart[c + 1] - colorStart[c];
+    }
+    cout << " vertices), " << (size_t(vertices) * positionStride()) / 1024 << " KB of positions." << endl;
+}
+
+void SSBOMesh::setShaderSource(const char* shaderFileName, const vector<string>& defines) {
+    // Variants built from other defines are rebuilt on their next use
+    for (std::map<string, GLSLProgram*>::iterator it = variantPrograms.begin(); it != variantPrograms.end(); ++it) {
+        delete it->second;
+    }
+    variantPrograms.clear();
+    shaderFile = shaderFileName;
+    shaderDefines = defines;
+}
+
+void SSBOMesh::detectGatherVariant() {
+    // GL_KHR_shader_subgroup is queried like a core feature, but only if listed
+    bool subgroups = false;
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count && !subgroups; ++i) {
+        const GLubyte* name = glGetStringi(GL_EXTENSIONS, i);
+        subgroups = name && !strcmp((const char*)name, "GL_KHR_shader_subgroup");
+    }
+    if (subgroups) {
+        GLint stages = 0, features = 0, size = 0;
+        glGetIntegerv(GL_SUBGROUP_SUPPORTED_STAGES_KHR, &stages);
+        glGetIntegerv(GL_SUBGROUP_SUPPORTED_FEATURES_KHR, &features);
+        glGetIntegerv(GL_SUBGROUP_SIZE_KHR, &size);
+        subgroups = (stages & GL_COMPUTE_SHADER_BIT) && (features & GL_SUBGROUP_FEATURE_ARITHMETIC_BIT_KHR) && size > 0;
+        if (subgroups) gatherLanes = GLuint(size);
+    }
+    if (!subgroups) gatherLanes = 32; // GATHER_LANES in shader.comp
+    gatherDefine = subgroups ? "SUBGROUP_GATHER" : "COOPERATIVE_GATHER";
+}
+
+void SSBOMesh::buildValenceBuckets(vector<GLuint>& order) {
+    // Valences up to MAX_FIXED_VALENCE with enough vertices to fill a few
+    // workgroups get their own bucket; the rest (including isolated
+    // vertices) go to a last bucket run by the generic program. Vertices of
+    // valence gatherValence and up go to a final cooperative gather bucket.
+    const GLuint MAX_FIXED_VALENCE = 16;
+    const GLuint MIN_BUCKET_VERTICES = 1024;
+
+    // The delta-coded neighbor slots can only be walked serially
+    GLuint gatherFrom = compressNeighbors ? 0 : gatherValence;
+    bool gathered = false;
+    vector<GLuint> histogram(MAX_FIXED_VALENCE + 1, 0);
+    for (GLuint v = 0; v < vertices; ++v) {
+        if (gatherFrom > 0 && hostSpans[v] >= gatherFrom) gathered = true;
+        else if (hostSpans[v] <= MAX_FIXED_VALENCE) histogram[hostSpans[v]]++;
+    }
+
+    vector<int> bucketOf(MAX_FIXED_VALENCE + 1, -1);
+    bucketValence.clear();
+    for (GLuint k = 1; k <= MAX_FIXED_VALENCE; ++k) {
+        if (histogram[k] >= MIN_BUCKET_VERTICES) {
+            bucketOf[k] = int(bucketValence.size());
+            bucketValence.push_back(k);
+        }
+    }
+    int generic = int(bucketValence.size());
+    bucketValence.push_back(0);
+
+    int gather = -1;
+    if (gathered) {
+        gather = int(bucketValence.size());
+        bucketValence.push_back(GATHER_BUCKET);
+        detectGatherVariant();
+    }
+
+    // Counting sort by bucket, keeping vertex order within a bucket
+    vector<int> bucket(vertices);
+    bucketStart.assign(bucketValence.size() + 1, 0);
+    for (GLuint v = 0; v < vertices; ++v) {
+        GLuint k = hostSpans[v];
+        if (gather >= 0 && k >= gatherFrom) bucket[v] = gather;
+        else bucket[v] = k <= MAX_FIXED_VALENCE && bucketOf[k] >= 0 ? bucketOf[k] : generic;
+        bucketStart[bucket[v] + 1]++;
+    }
+    for (size_t b = 0; b + 1 < bucketStart.size(); ++b) bucketStart[b + 1] += bucketStart[b];
+    order.resize(vertices);
+    vector<GLuint> next(bucketStart.begin(), bucketStart.end() - 1);
+    for (GLuint v = 0; v < vertices; ++v) order[next[bucket[v]]++] = v;
+
+    cout << " Valence buckets:";
+    for (size_t b = 0; b < bucketValence.size(); ++b) {
+        if (bucketValence[b] == GATHER_BUCKET) cout << " " << gatherValence << "+:";
+        else if (bucketValence[b]) cout << " " << bucketValence[b] << ":";
+        else cout << " other:";
+        cout << bucketStart[b + 1] - bucketStart[b];
+    }
+    cout << endl;
+
+    // Compile the variants now, while loading, rather than on the first dispatch
+    for (size_t b = 0; b < bucketValence.size(); ++b) bucketProgram(b);
+    if (program) program->use();
+}
+
+GLSLProgram* SSBOMesh::variantProgram(const string& define) {
+    return shaderVariant(shaderFile, define);
+}
+
+// Builds 'file' with the defines of 'program' plus 'define' (cached).
+GLSLProgram* SSBOMesh::shaderVariant(const string& file, const string& define) {
+    string key = file == shaderFile ? define : file + ": " + define;
+    std::map<string, GLSLProgram*>::iterator found = variantPrograms.find(key);
+    if (found != variantPrograms.end()) return found->second;
+
+    vector<string> defines = shaderDefines;
+    defines.push_back(define);
+    GLSLProgram* variant = new GLSLProgram();
+    try {
+        if (shaderCache) {
+            shaderCache->build(*variant, file.c_str(), GLSLShader::COMPUTE, defines);
+        }
+        else {
+            variant->compileShader(file.c_str(), GLSLShader::COMPUTE, defines);
+            variant->link();
+        }
+    }
+    catch (GLSLProgramException& e) {
+        cerr << key << " variant: " << e.what() << endl;
+        delete variant;
+        variant = NULL;
+    }
+    variantPrograms[key] = variant;
+    return variant;
+}
+
+GLSLProgram* SSBOMesh::bucketProgram(size_t bucket) {
+    GLuint valence = bucketValence[bucket];
+    if (valence == 0) return program;
+
+    // Fall back to the generic program if the variant does not build
+    GLSLProgram* variant = variantProgram(valence == GATHER_BUCKET ? gatherDefine :
+        "FIXED_VALENCE " + std::to_string(valence) + "u");
+    return variant ? variant : program;
+}
+
+void SSBOMesh::dispatchValenceBuckets() {
+    for (size_t b = 0; b < bucketValence.size(); ++b) {
+        GLuint count = bucketStart[b + 1] - bucketStart[b];
+        if (count == 0) continue;
+        GLSLProgram* prog = bucketProgram(b);
+        prog->use();
+        prog->setUniform("activeOffset", bucketStart[b]);
+        prog->setUniform("activeCount", count);
+        // A gather team covers one vertex with gatherLanes invocations
+        bool teams = bucketValence[b] == GATHER_BUCKET && prog != program;
+        glDispatchCompute(groupsFor(teams ? count * gatherLanes : count), 1, 1);
+    }
+}
+
+void SSBOMesh::dispatchPersistent(GLSLProgram* prog, int numIterations) {
+    GLuint chunk = persistentChunk > 0 ? persistentChunk : verticesPerGroup;
+    GLuint groups = std::min(persistentGroups, (vertices + chunk - 1) / chunk);
+    if (groups == 0) groups = 1;
+    GLuint perDispatch = std::max<GLuint>(persistentIterations, 1);
+
+    // Queue layout: arrival counter, chunks per group, one counter per iteration
+    if (queueHandle == 0) glGenBuffers(1, &queueHandle);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, queueHandle);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (1 + groups + perDispatch) * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, queueHandle);
+
+    prog->use();
+    setSmoothingUniforms(prog);
+    prog->setUniform("useActiveList", false);
+    prog->setUniform("copyOnly", false);
+    prog->setUniform("chunkSize", chunk);
+
+    GLuint zero = 0;
+    for (int done = 0; done < numIterations; ) {
+        GLuint count = std::min<GLuint>(perDispatch, GLuint(numIterations - done));
+        int writeIdx = currentBuffer == 3 ? 4 : 3;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[currentBuffer]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboHandle[writeIdx]);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, queueHandle);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        prog->setUniform("persistentIterations", count);
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // Iterations alternate buffers inside the dispatch
+        if (count & 1u) currentBuffer = writeIdx;
+        done += count;
+    }
+
+    if (profiling && numIterations > 0) {
+        // Chunks taken per group in the last dispatch; a wide spread means
+        // some groups ran slower and the queue balanced them.
+        vector<GLuint> taken(groups);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, queueHandle);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), groups * sizeof(GLuint), taken.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        GLuint least = *std::min_element(taken.begin(), taken.end());
+        GLuint most = *std::max_element(taken.begin(), taken.end());
+        cout << "Persistent threads: " << groups << " groups, " << chunk << " vertices per chunk, "
+            << least << "-" << most << " chunks per group in the last dispatch." << endl;
+    }
 
-    bool evenIteration = true;
+    if (program) program->use();
+}
+
+double SSBOMesh::timeKernel(GLSLProgram* prog, GLuint groupVertices, int repetitions) {
+    if (hostResident() || gaussSeidel || repetitions <= 0) return -1.0;
+
+    // Always read the current buffer and write the other one, so the mesh
+    // itself does not move.
+    int otherBuffer = currentBuffer == 3 ? 4 : 3;
+    for (int i = 0; i < 3; ++i) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, ssboHandle[i]);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[currentBuffer]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboHandle[otherBuffer]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, flagsHandle);
+    prog->use();
+    setSmoothingUniforms(prog);
+    prog->setUniform("useActiveList", false);
+    prog->setUniform("copyOnly", false);
+
+    GLuint groups = (vertices + groupVertices - 1) / groupVertices;
+    glDispatchCompute(groups, 1, 1); // Warm-up
+    glFinish();
+
+    if (timerQuery == 0) glGenQueries(1, &timerQuery);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+    for (int r = 0; r < repetitions; ++r) {
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &elapsed);
+    glFinish();
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    buffersInSync = false;
+    if (program) program->use();
+
+    // Software renderers may report no GPU time; fall back to wall-clock time.
+    double ms = elapsed > 1000 ? elapsed / 1.0e6 : wallMs;
+    return ms / repetitions;
+}
+
+void SSBOMesh::printFeatureCounts() const {
+    GLuint boundary = 0, crease = 0;
+    for (const VertexFlags& f : hostFlags) {
+        if (f.bits & VERTEX_BOUNDARY) boundary++;
+        if (f.bits & VERTEX_CREASE) crease++;
+    }
+    cout << " " << boundary << " boundary vertices, " << crease << " crease vertices." << endl;
+}
+
+// Uniforms apply to the program in use, so 'target' must be current.
+void SSBOMesh::dispatchHC(int numIterations) {
+    GLSLProgram* stages[2] = { variantProgram("HC_STAGE 1"), variantProgram("HC_STAGE 2") };
+    if (!stages[0] || !stages[1]) {
+        cerr << "HC smoothing unavailable: the HC_STAGE variants did not build." << endl;
+        return;
+    }
+    for (GLSLProgram* stage : stages) {
+        stage->use();
+        setSmoothingUniforms(stage);
+        stage->setUniform("useActiveList", false);
+        stage->setUniform("copyOnly", false);
+        stage->setUniform("hcAlpha", hcAlpha);
+        stage->setUniform("hcBeta", hcBeta);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, originalHandle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, differenceHandle);
 
-    // Perform N iterations of smoothing
     for (int i = 0; i < numIterations; i++) {
-        // Input is buffer 0 and output is buffer 1 on even iterations
-        // Input is buffer 1 and output is buffer 0 on odd iterations
-        int readIdx = evenIteration ? 3 : 4;
-        int writeIdx = evenIteration ? 4 : 3;
+        int readIdx = currentBuffer;
+        int writeIdx = currentBuffer == 3 ? 4 : 3;
 
-        // Bind buffers to specific binding points
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[readIdx]);  // Input
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboHandle[writeIdx]); // Output
+        // Umbrella step into the other buffer, recording b
+        stages[0]->use();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[readIdx]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboHandle[writeIdx]);
+        glDispatchCompute(groupsFor(vertices), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-        // Dispatch compute shader
-        glDispatchCompute((vertices + 255) / 256, 1, 1);
+        // Correction in place; a vertex only reads its own position and the b of its neighbours
+        stages[1]->use();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[writeIdx]);
+        glDispatchCompute(groupsFor(vertices), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        currentBuffer = writeIdx;
+    }
+    if (numIterations > 0) buffersInSync = false;
+    program->use();
+}
+
+// Uniforms apply to the program in use, so 'target' must be current.
+void SSBOMesh::dispatchFlow(int numIterations) {
+    GLSLProgram* prog = variantProgram("SMOOTHING_OPERATOR " + std::to_string(int(smoothingOperator)));
+    if (!prog) {
+        cerr << "Smoothing operator unavailable: the SMOOTHING_OPERATOR variant did not build." << endl;
+        return;
+    }
+    vec3 extent = bboxMax - bboxMin;
+    float dt = timeStep > 0.0f ? timeStep : 1e-4f * glm::dot(extent, extent);
+    prog->use();
+    setSmoothingUniforms(prog);
+    prog->setUniform("useActiveList", false);
+    prog->setUniform("copyOnly", false);
+    prog->setUniform("timeStep", dt);
+    prog->setUniform("stepClamp", stepClamp);
+    if (smoothingOperator == OPERATOR_MEAN_CURVATURE) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, ssboHandle[5]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, faceAdjacencyHandle[2]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, faceAdjacencyHandle[3]);
+    }
+
+    for (int i = 0; i < numIterations; i++) {
+        int writeIdx = currentBuffer == 3 ? 4 : 3;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[currentBuffer]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboHandle[writeIdx]);
+        glDispatchCompute(groupsFor(vertices), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        currentBuffer = writeIdx;
+    }
+    if (numIterations > 0) buffersInSync = false;
+    program->use();
+}
+
+// Reduces the enclosed volume of the current positions and either records
+// it as the target or rescales the positions to the target, in place.
+void SSBOMesh::restoreVolume(bool captureTarget) {
+    if (faces == 0) return;
+    GLSLProgram* stages[3];
+    for (int s = 0; s < 3; ++s) {
+        stages[s] = shaderVariant(volumeShaderFile, "VOLUME_STAGE " + std::to_string(s + 1));
+        if (!stages[s]) {
+            cerr << "Volume preservation unavailable: the VOLUME_STAGE variants did not build." << endl;
+            volumeInterval = 0;
+            return;
+        }
+    }
+    GLuint partials = std::max(groupsFor(faces), 1u);
+    if (captureTarget) {
+        if (volumeHandle[0] == 0) glGenBuffers(2, volumeHandle);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, volumeHandle[0]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, partials * sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, volumeHandle[1]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 3 * sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        volumeCaptured = true;
+    }
+    for (GLSLProgram* stage : stages) {
+        stage->use();
+        stage->setUniform("faceCount", faces);
+        stage->setUniform("partialCount", partials);
+        stage->setUniform("origin", 0.5f * (bboxMin + bboxMax));
+        stage->setUniform("captureTarget", captureTarget);
+        stage->setUniform("lockMask", lockMask);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboHandle[5]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, volumeHandle[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, volumeHandle[1]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[currentBuffer]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, flagsHandle);
+
+    stages[0]->use();
+    glDispatchCompute(groupsFor(faces), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    stages[1]->use();
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if (!captureTarget) {
+        stages[2]->use();
+        glDispatchCompute(groupsFor(vertices), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        // Gauss-Seidel updates in place; its second buffer is empty
+        if (!gaussSeidel) buffersInSync = false;
+    }
+
+    // Restore the vertex adjacency bindings of shader.comp
+    for (int i = 0; i < 3; ++i) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, ssboHandle[i]);
+    program->use();
+}
+
+void SSBOMesh::buildFaceAdjacency(const float* positions, const GLuint* elements) {
+    // Corners of every vertex (CSR), straight from the corner table
+    if (faceAdjacencyHandle[0] == 0) glGenBuffers(4, faceAdjacencyHandle);
+    const vector<GLuint>* vertexArrays[2] = { &topology.vertexCornerOffsets, &topology.vertexCorners };
+    for (int i = 0; i < 2; ++i) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, faceAdjacencyHandle[2 + i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(vertexArrays[i]->size(), 1) * sizeof(GLuint), vertexArrays[i]->data(), GL_STATIC_DRAW);
+    }
+    if (!bilateral) return;
+
+    // Faces sharing at least one vertex with every face (CSR), and the mean
+    // distance between their centroids, which scales the spatial Gaussian
+    vector<GLuint> faceOffsets(size_t(faces) + 1, 0), faceNeighbors;
+    faceNeighbors.reserve(12 * size_t(faces));
+    vector<GLuint> stamp(faces, ~0u);
+    auto centroid = [&](GLuint f) {
+        return (glm::make_vec3(&positions[3 * elements[3 * f]]) + glm::make_vec3(&positions[3 * elements[3 * f + 1]]) +
+            glm::make_vec3(&positions[3 * elements[3 * f + 2]])) / 3.0f;
+    };
+    double spacing = 0.0;
+    for (GLuint f = 0; f < faces; ++f) {
+        stamp[f] = f;
+        vec3 c = centroid(f);
+        for (int corner = 0; corner < 3; ++corner) {
+            GLuint v = elements[3 * f + corner];
+            for (GLuint k = topology.cornerBegin(v); k < topology.cornerEnd(v); ++k) {
+                GLuint g = CornerTable::face(topology.vertexCorners[k]);
+                if (stamp[g] == f) continue;
+                stamp[g] = f;
+                faceNeighbors.push_back(g);
+                spacing += glm::length(centroid(g) - c);
+            }
+        }
+        faceOffsets[f + 1] = GLuint(faceNeighbors.size());
+    }
+    centroidSpacing = faceNeighbors.empty() ? 1.0f : float(spacing / faceNeighbors.size());
+
+    const vector<GLuint>* arrays[2] = { &faceOffsets, &faceNeighbors };
+    for (int i = 0; i < 2; ++i) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, faceAdjacencyHandle[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(arrays[i]->size(), 1) * sizeof(GLuint), arrays[i]->data(), GL_STATIC_DRAW);
+    }
+    if (normalHandle[0] == 0) glGenBuffers(2, normalHandle);
+    if (centroidHandle == 0) glGenBuffers(1, &centroidHandle);
+    const GLuint perFace[3] = { normalHandle[0], normalHandle[1], centroidHandle };
+    for (GLuint handle : perFace) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, handle);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(faces, 1) * sizeof(vec4), NULL, GL_DYNAMIC_COPY);
+    }
+
+    cout << " Face adjacency: " << faceNeighbors.size() << " entries (" << (faces ? double(faceNeighbors.size()) / faces : 0.0)
+        << " per face), mean centroid spacing " << centroidSpacing << "." << endl;
+}
+
+void SSBOMesh::dispatchBilateral(int numIterations) {
+    GLSLProgram* stages[3];
+    for (int s = 0; s < 3; ++s) {
+        stages[s] = shaderVariant(bilateralShaderFile, "DENOISE_STAGE " + std::to_string(s + 1));
+        if (!stages[s]) {
+            cerr << "Bilateral filtering unavailable: the DENOISE_STAGE variants did not build." << endl;
+            return;
+        }
+    }
+    for (GLSLProgram* stage : stages) {
+        stage->use();
+        stage->setUniform("faceCount", faces);
+        stage->setUniform("sigmaSpatial", bilateralSettings.sigmaSpatial * centroidSpacing);
+        stage->setUniform("sigmaRange", bilateralSettings.sigmaRange);
+        stage->setUniform("lockMask", lockMask);
+        stage->setUniform("lambda", lambda);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ssboHandle[5]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, faceAdjacencyHandle[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, faceAdjacencyHandle[1]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, faceAdjacencyHandle[2]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, faceAdjacencyHandle[3]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, centroidHandle);
+
+    for (int i = 0; i < numIterations; i++) {
+        // Normals, areas and centroids of the current positions
+        stages[0]->use();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[currentBuffer]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, normalHandle[0]);
+        glDispatchCompute(groupsFor(faces), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        int latest = 0;
+        stages[1]->use();
+        for (int k = 0; k < bilateralSettings.normalIterations; ++k) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, normalHandle[latest]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, normalHandle[1 - latest]);
+            glDispatchCompute(groupsFor(faces), 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            latest = 1 - latest;
+        }
+
+        stages[2]->use();
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, normalHandle[latest]);
+        for (int k = 0; k < bilateralSettings.vertexIterations; ++k) {
+            int writeIdx = currentBuffer == 3 ? 4 : 3;
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[currentBuffer]);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboHandle[writeIdx]);
+            glDispatchCompute(groupsFor(vertices), 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            currentBuffer = writeIdx;
+        }
+        buffersInSync = false;
+    }
+
+    // Restore the vertex adjacency bindings of shader.comp
+    for (int i = 0; i < 3; ++i) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, ssboHandle[i]);
+    program->use();
+}
+
+void SSBOMesh::setSmoothingUniforms(GLSLProgram* target) {
+    target->setUniform("lockMask", lockMask);
+    target->setUniform("lambda", lambda);
+    if (positionFormat == POSITIONS_QUANT21) {
+        target->setUniform("bboxMin", bboxMin);
+        target->setUniform("bboxExtent", bboxMax - bboxMin);
+    }
+}
+
+void SSBOMesh::syncPositionBuffers() {
+    if (buffersInSync || gaussSeidel) return;
+
+    // Vertices outside a smoothed region are never written, so both
+    // ping-pong buffers must agree on them before region updates start.
+    int otherBuffer = currentBuffer == 3 ? 4 : 3;
+    glBindBuffer(GL_COPY_READ_BUFFER, ssboHandle[currentBuffer]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ssboHandle[otherBuffer]);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, vertices * positionStride());
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    buffersInSync = true;
+}
+
+void SSBOMesh::expandRegion(const vector<GLuint>& dirty, int rings, vector<GLuint>& region) {
+    // Breadth-first walk over the host CSR. The generation stamp avoids
+    // clearing a per-vertex visited array on every call.
+    if (++regionGeneration == 0) {
+        std::fill(regionStamp.begin(), regionStamp.end(), 0);
+        regionGeneration = 1;
+    }
+
+    region.clear();
+    for (GLuint v : dirty) {
+        if (v < vertices && regionStamp[v] != regionGeneration) {
+            regionStamp[v] = regionGeneration;
+            region.push_back(v);
+        }
+    }
+
+    size_t ringStart = 0;
+    for (int ring = 0; ring < rings; ++ring) {
+        size_t ringEnd = region.size();
+        for (size_t i = ringStart; i < ringEnd; ++i) {
+            GLuint v = region[i];
+            for (GLuint j = 0; j < hostSpans[v]; ++j) {
+                GLuint n = hostNeighbors[hostOffsets[v] + j];
+                if (regionStamp[n] != regionGeneration) {
+                    regionStamp[n] = regionGeneration;
+                    region.push_back(n);
+                }
+            }
+        }
+        if (ringEnd == region.size()) break;
+        ringStart = ringEnd;
+    }
+}
+
+void SSBOMesh::smoothRegion(const vector<GLuint>& dirty, const int numIterations) {
+    if (!program) {
+        cerr << "smoothRegion: no smoothing program set!" << endl;
+        return;
+    }
+    if (numIterations <= 0 || dirty.empty()) return;
+    if (hostResident()) {
+        cerr << "smoothRegion: not available in streaming or distributed mode!" << endl;
+        return;
+    }
+    if (gaussSeidel) {
+        cerr << "smoothRegion: not available in Gauss-Seidel mode!" << endl;
+        return;
+    }
+
+    syncPositionBuffers();
+
+    vector<GLuint> region;
+    expandRegion(dirty, numIterations, region);
+    GLuint count = GLuint(region.size());
+
+    // === SSBO for the compacted active vertex list ===
+    if (activeHandle == 0) {
+        glGenBuffers(1, &activeHandle);
+        glGenBuffers(1, &indirectHandle);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, indirectHandle);
+        glBufferData(GL_DISPATCH_INDIRECT_BUFFER, 3 * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, activeHandle);
+    if (count > activeCapacity) {
+        activeCapacity = count;
+        glBufferData(GL_SHADER_STORAGE_BUFFER, activeCapacity * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+    }
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(GLuint), region.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    GLuint groups[3] = { groupsFor(count), 1, 1 };
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, indirectHandle);
+    glBufferSubData(GL_DISPATCH_INDIRECT_BUFFER, 0, sizeof(groups), groups);
+
+    for (int i = 0; i < 3; ++i) {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, ssboHandle[i]);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, activeHandle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, flagsHandle);
+    setSmoothingUniforms(program);
+    program->setUniform("useActiveList", true);
+    program->setUniform("activeCount", count);
+    program->setUniform("copyOnly", false);
 
-        // Ensure write finishes before next iteration reads
+    for (int i = 0; i < numIterations; i++) {
+        int readIdx = currentBuffer;
+        int writeIdx = currentBuffer == 3 ? 4 : 3;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[readIdx]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboHandle[writeIdx]);
+        glDispatchComputeIndirect(0);
         glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        currentBuffer = writeIdx;
+    }
+
+    // Copy the region's final positions into the other buffer so both stay in sync.
+    int otherBuffer = currentBuffer == 3 ? 4 : 3;
+    program->setUniform("copyOnly", true);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, ssboHandle[currentBuffer]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, ssboHandle[otherBuffer]);
+    glDispatchComputeIndirect(0);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    program->setUniform("copyOnly", false);
+    program->setUniform("useActiveList", false);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+}
+
+// Calls upload(begin, end) for every run targets[begin..end) of consecutive
+// vertices in the sorted, duplicate-free 'targets', so that a selection goes
+// to the GPU in one call per run rather than one per vertex.
+template <typename Upload>
+static void forEachRun(const vector<GLuint>& targets, Upload upload) {
+    for (size_t begin = 0, end = 0; begin < targets.size(); begin = end) {
+        for (end = begin + 1; end < targets.size() && targets[end] == targets[end - 1] + 1; ++end) { }
+        upload(begin, end);
+    }
+}
+
+void SSBOMesh::updateVertices(const vector<GLuint>& indices, const vector<vec3>& positions) {
+    if (blockStore) {
+        cerr << "updateVertices: not available in streaming mode!" << endl;
+        return;
+    }
+    if (hostResident()) {
+        for (size_t i = 0; i < indices.size() && i < positions.size(); ++i) {
+            hostPositions[3 * size_t(indices[i])] = positions[i].x;
+            hostPositions[3 * size_t(indices[i]) + 1] = positions[i].y;
+            hostPositions[3 * size_t(indices[i]) + 2] = positions[i].z;
+        }
+        return;
+    }
 
-        // Flip for next iteration
-        evenIteration = !evenIteration;
+    syncPositionBuffers();
+
+    // Edits sorted by vertex (the last edit of a vertex wins), so that every
+    // run of consecutive vertices is one upload rather than one per vertex.
+    size_t count = std::min(indices.size(), positions.size());
+    vector<size_t> order;
+    order.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (indices[i] < vertices) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return indices[a] < indices[b]; });
+    vector<GLuint> targets;
+    vector<vec3> edited;
+    targets.reserve(order.size());
+    edited.reserve(order.size());
+    for (size_t k = 0; k < order.size(); ++k) {
+        if (k + 1 < order.size() && indices[order[k + 1]] == indices[order[k]]) continue;
+        targets.push_back(indices[order[k]]);
+        edited.push_back(positions[order[k]]);
+    }
+
+    // Edited positions go into both ping-pong buffers.
+    vector<GLuint> packed;
+    const GLubyte* data = (const GLubyte*)edited.data();
+    if (positionFormat != POSITIONS_FP32) {
+        encodePositions((const float*)edited.data(), GLuint(edited.size()), packed);
+        data = (const GLubyte*)packed.data();
+    }
+    size_t stride = positionStride();
+    for (int b = 3; b <= (gaussSeidel ? 3 : 4); ++b) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[b]);
+        forEachRun(targets, [&](size_t begin, size_t end) {
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, targets[begin] * stride, (end - begin) * stride, data + begin * stride);
+        });
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void SSBOMesh::smoothVertices(const int numIterations, const char outputModelFilename[]) {
+    smoothVertices(numIterations);
+
+    if (blockStore) {
+        // Straight from the block file; the mesh never is in memory at once
+        if (!blockStore->writeOBJ(outputModelFilename)) exit(1);
+        std::cout << "Smoothing complete. Output written to: " << outputModelFilename << std::endl;
+        return;
     }
 
     // Retrieve vertex data from GPU
-    int finalBuffer = evenIteration ? 3 : 4;
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[finalBuffer]);
-    float* vertexData = (float*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    vector<float> vertexData(3 * size_t(vertices));
+    readPositions(vertexData.data());
 
-    if (!vertexData) {
-        std::cerr << "Failed to map SSBO for reading!" << std::endl;
+    if (hostResident()) {
+        writeOBJ(outputModelFilename, vertexData.data(), hostFaces.data());
         return;
     }
 
     // Retrieve face data from GPU
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[5]);
     GLuint* faceData = (GLuint*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
 
     if (!faceData) {
         std::cerr << "Failed to map SSBO for reading!" << std::endl;
+    }
+    else {
+        writeOBJ(outputModelFilename, vertexData.data(), faceData);
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void SSBOMesh::setPositionFormat(PositionFormat format, bool keepReferencePositions) {
+    positionFormat = format;
+    keepReference = keepReferencePositions;
+}
+
+string SSBOMesh::positionFormatDefine(PositionFormat format) {
+    return "POSITION_FORMAT " + std::to_string(int(format));
+}
+
+static const float QUANT_MAX = 2097151.0f; // 2^21 - 1, as in shader.comp
+
+void SSBOMesh::encodePositions(const float* src, GLuint count, vector<GLuint>& dst) const {
+    dst.resize(2 * size_t(count));
+    vec3 extent = glm::max(bboxMax - bboxMin, vec3(1e-30f));
+    for (size_t i = 0; i < count; ++i) {
+        vec3 p = glm::make_vec3(src + 3 * i);
+        if (positionFormat == POSITIONS_FP16) {
+            dst[2 * i] = glm::packHalf2x16(vec2(p.x, p.y));
+            dst[2 * i + 1] = glm::packHalf2x16(vec2(p.z, 0.0f));
+        }
+        else {
+            vec3 t = glm::clamp((p - bboxMin) / extent, 0.0f, 1.0f);
+            glm::uvec3 q = glm::uvec3(t * QUANT_MAX + 0.5f);
+            dst[2 * i] = q.x | (q.y << 21);
+            dst[2 * i + 1] = (q.y >> 11) | (q.z << 10);
+        }
+    }
+}
+
+void SSBOMesh::decodePositions(const GLuint* src, GLuint count, float* dst) const {
+    vec3 scale = (bboxMax - bboxMin) / QUANT_MAX;
+    for (size_t i = 0; i < count; ++i) {
+        GLuint x = src[2 * i], y = src[2 * i + 1];
+        vec3 p;
+        if (positionFormat == POSITIONS_FP16) {
+            vec2 xy = glm::unpackHalf2x16(x);
+            p = vec3(xy.x, xy.y, glm::unpackHalf2x16(y).x);
+        }
+        else {
+            glm::uvec3 q(x & 0x1FFFFFu, (x >> 21) | ((y & 0x3FFu) << 11), y >> 10);
+            p = bboxMin + vec3(q) * scale;
+        }
+        dst[3 * i] = p.x;
+        dst[3 * i + 1] = p.y;
+        dst[3 * i + 2] = p.z;
+    }
+}
+
+void SSBOMesh::readPositions(float* dst) {
+    if (blockStore) {
+        if (!blockStore->readAllPositions(dst)) cerr << "readPositions: failed to read the block file!" << endl;
+        return;
+    }
+    if (hostResident()) {
+        std::copy(hostPositions.begin(), hostPositions.end(), dst);
         return;
     }
 
-    writeOBJ(outputModelFilename, vertexData, faceData);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[currentBuffer]);
+    if (positionFormat == POSITIONS_FP32) {
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (3 * vertices) * sizeof(float), dst);
+    }
+    else {
+        vector<GLuint> packed(2 * size_t(vertices));
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, vertices * positionStride(), packed.data());
+        decodePositions(packed.data(), vertices, dst);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void SSBOMesh::readFaces(GLuint* dst) {
+    if (blockStore) {
+        if (!blockStore->readAllFaces(dst)) cerr << "readFaces: failed to read the block file!" << endl;
+        return;
+    }
+    if (hostResident()) {
+        std::copy(hostFaces.begin(), hostFaces.end(), dst);
+        return;
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssboHandle[5]);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 3 * faces * sizeof(GLuint), dst);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void SSBOMesh::smoothOnHost(vector<float>& positions, const int numIterations) const {
+    // fp32 reference of the full-mesh kernel path (same neighbour order and blend)
+    vector<float> out(positions.size());
+    for (int it = 0; it < numIterations; ++it) {
+        for (size_t v = 0; v < vertices; ++v) {
+            const VertexFlags& flag = hostFlags[v];
+            vec3 pos = glm::make_vec3(&positions[3 * v]);
+            vec3 result = pos;
+            if (hostSpans[v] > 0 && (flag.bits & lockMask) == 0) {
+                vec3 avg(0.0f);
+                for (GLuint i = 0; i < hostSpans[v]; ++i) {
+                    avg += glm::make_vec3(&positions[3 * hostNeighbors[hostOffsets[v] + i]]);
+                }
+                avg /= float(hostSpans[v]);
+                float w = lambda * flag.weight;
+                result = avg * w + pos * (1.0f - w);
+            }
+            out[3 * v] = result.x;
+            out[3 * v + 1] = result.y;
+            out[3 * v + 2] = result.z;
+        }
+        positions.swap(out);
+    }
+}
+
+void SSBOMesh::smoothOnHostHC(vector<float>& positions, const int numIterations, unsigned threads) const {
+    const vector<float> original = positions;
+    vector<float> out(positions.size()), differences(positions.size());
+
+    for (int it = 0; it < numIterations; ++it) {
+        // Stage 1: umbrella step and b = p - (alpha * o + (1 - alpha) * q)
+        parallelRanges(vertices, threads, [&](size_t begin, size_t end) {
+            for (size_t v = begin; v < end; ++v) {
+                const VertexFlags& flag = hostFlags[v];
+                vec3 pos = glm::make_vec3(&positions[3 * v]);
+                vec3 result = pos, b(0.0f);
+                if (hostSpans[v] > 0 && (flag.bits & lockMask) == 0) {
+                    vec3 avg(0.0f);
+                    for (GLuint i = 0; i < hostSpans[v]; ++i) {
+                        avg += glm::make_vec3(&positions[3 * hostNeighbors[hostOffsets[v] + i]]);
+                    }
+                    avg /= float(hostSpans[v]);
+                    float w = lambda * flag.weight;
+                    result = avg * w + pos * (1.0f - w);
+                    b = result - (hcAlpha * glm::make_vec3(&original[3 * v]) + (1.0f - hcAlpha) * pos);
+                }
+                std::copy(&result.x, &result.x + 3, &out[3 * v]);
+                std::copy(&b.x, &b.x + 3, &differences[3 * v]);
+            }
+        });
+        // Stage 2: p -= beta * b + (1 - beta) * (average b of the neighbours)
+        parallelRanges(vertices, threads, [&](size_t begin, size_t end) {
+            for (size_t v = begin; v < end; ++v) {
+                if (hostSpans[v] == 0 || (hostFlags[v].bits & lockMask) != 0) continue;
+                vec3 avg(0.0f);
+                for (GLuint i = 0; i < hostSpans[v]; ++i) {
+                    avg += glm::make_vec3(&differences[3 * hostNeighbors[hostOffsets[v] + i]]);
+                }
+                avg /= float(hostSpans[v]);
+                vec3 result = glm::make_vec3(&out[3 * v]) - (hcBeta * glm::make_vec3(&differences[3 * v]) + (1.0f - hcBeta) * avg);
+                std::copy(&result.x, &result.x + 3, &out[3 * v]);
+            }
+        });
+        positions.swap(out);
+    }
+}
+
+void SSBOMesh::reportStorageError(const int numIterations) {
+    if (referencePositions.size() != 3 * size_t(vertices)) {
+        cerr << "No fp32 reference positions retained; enable them in setPositionFormat()." << endl;
+        return;
+    }
+
+    vector<float> reference = referencePositions;
+    if (hcSmoothing) smoothOnHostHC(reference, numIterations);
+    else smoothOnHost(reference, numIterations);
+    vector<float> result(3 * size_t(vertices));
+    readPositions(result.data());
+
+    double maxError = 0.0, sumSquared = 0.0;
+    for (size_t v = 0; v < vertices; ++v) {
+        double d = glm::length(glm::make_vec3(&result[3 * v]) - glm::make_vec3(&reference[3 * v]));
+        maxError = std::max(maxError, d);
+        sumSquared += d * d;
+    }
+    double diagonal = glm::length(bboxMax - bboxMin);
+    double rms = vertices > 0 ? sqrt(sumSquared / vertices) : 0.0;
+
+    cout << "Position storage error vs fp32 after " << numIterations << " iterations:" << endl;
+    cout << " " << positionStride() << " bytes/vertex (fp32: 12)" << endl;
+    cout << " max " << maxError << " (" << 100.0 * maxError / diagonal << "% of bbox diagonal)" << endl;
+    cout << " rms " << rms << " (" << 100.0 * rms / diagonal << "% of bbox diagonal)" << endl;
+}
+
+void SSBOMesh::lockVertices(const vector<GLuint>& indices, bool locked) {
+    for (GLuint v : indices) {
+        if (v >= vertices) continue;
+        if (locked) hostFlags[v].bits |= VERTEX_LOCKED;
+        else hostFlags[v].bits &= ~GLuint(VERTEX_LOCKED);
+    }
+    updateFlags(indices);
+}
+
+void SSBOMesh::setVertexWeights(const vector<GLuint>& indices, const vector<float>& weights) {
+    for (size_t i = 0; i < indices.size() && i < weights.size(); ++i) {
+        if (indices[i] < vertices) hostFlags[indices[i]].weight = weights[i];
+    }
+    updateFlags(indices);
+}
+
+void SSBOMesh::updateFlags(const vector<GLuint>& indices) {
+    // hostFlags already holds the changes, so runs upload straight from it
+    vector<GLuint> targets;
+    targets.reserve(indices.size());
+    for (GLuint v : indices) {
+        if (v < vertices) targets.push_back(v);
+    }
+    std::sort(targets.begin(), targets.end());
+    targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, flagsHandle);
+    forEachRun(targets, [&](size_t begin, size_t end) {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, targets[begin] * sizeof(VertexFlags), (end - begin) * sizeof(VertexFlags),
+            &hostFlags[targets[begin]]);
+    });
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
 void SSBOMesh::writeOBJ(const char* fileName, const float* vertexData, const GLuint* faceData) {
@@ -292,20 +1748,22 @@ void SSBOMesh::writeOBJ(const char* fileName, const float* vertexData, const GLu
     std::cout << "Smoothing complete. Output written to: " << fileName << std::endl;
 }
 
-
-/////////////////////////////////////////////////////////////////////////////
-// WARNING: IF RENDERING AFTER VERTEX SMOOTHING NEED UPDATE VBO FIRST!
-/////////////////////////////////////////////////////////////////////////////
+void SSBOMesh::setPositionAttribute(GLuint location, PositionFormat format) {
+    if (format == POSITIONS_FP32) glVertexAttribFormat(location, 3, GL_FLOAT, GL_FALSE, 0);
+    else glVertexAttribIFormat(location, 2, GL_UNSIGNED_INT, 0);
+    glVertexAttribBinding(location, 0);
+    glEnableVertexAttribArray(location);
+}
 
 void SSBOMesh::render() const {
-    cout << "Not implemented!" << endl;
-}
+    if (hostResident() || vaoHandle == 0) {
+        cerr << "render: mesh has no GL buffers!" << endl;
+        return;
+    }
 
-void SSBOMesh::trimString(string& str) {
-    const char* whiteSpace = " \t\n\r";
-    size_t location;
-    location = str.find_first_not_of(whiteSpace);
-    str.erase(0, location);
-    location = str.find_last_not_of(whiteSpace);
-    str.erase(location + 1);
+    // No copy into a VBO: whichever position SSBO holds the latest result is the vertex buffer
+    glBindVertexArray(vaoHandle);
+    glBindVertexBuffer(0, ssboHandle[currentBuffer], 0, GLsizei(positionStride()));
+    glDrawElements(GL_TRIANGLES, GLsizei(3 * size_t(faces)), GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
 }
@@ -11,43 +11,447 @@ using glm::vec2;
 using glm::vec4;
 
 #include <string>
+#include <map>
 using std::string;
 
 #include "gldecl.h"
+#include "cornertable.h"
+
+class GLSLProgram;
+class StreamingSmoother;
+class BlockStore;
+class DistributedSmoother;
+class HaloTransport;
+class ShaderCache;
+class MonotonicArena;
+
+// Per-vertex feature bits stored in the flags SSBO (binding 7).
+enum VertexFlagBits
+{
+    VERTEX_BOUNDARY = 1u,      // Lies on an edge used by a single face
+    VERTEX_CREASE = 2u,        // Lies on a sharp (or non-manifold) edge
+    VERTEX_LOCKED = 4u         // Locked by the user
+};
+
+// Storage of the two position SSBOs; must match POSITION_FORMAT in shader.comp.
+enum PositionFormat
+{
+    POSITIONS_FP32 = 0,        // 12 bytes per vertex
+    POSITIONS_FP16 = 1,        // 3 halves packed in a uvec2 (8 bytes)
+    POSITIONS_QUANT21 = 2      // 3 x 21-bit bounding box coordinates in a uvec2 (8 bytes)
+};
+
+// Phases of the last load, in milliseconds (parse is 0 unless loaded from OBJ).
+struct LoadTimings
+{
+    double parse;
+    double cleanup;            // Welding and face cleanup (0 if disabled)
+    double adjacency;
+    double upload;             // Includes host-side preparation (encoding, coloring)
+    size_t heapAllocations;    // Temporaries the load allocated, all carved from its arena
+};
+
+// Bilateral normal filtering (see bilateral.comp).
+struct BilateralSettings
+{
+    int normalIterations;      // Filter passes over the face normals per iteration
+    int vertexIterations;      // Vertex updates towards the filtered normals per iteration
+    float sigmaSpatial;        // Spatial Gaussian width, in mean adjacent-centroid distances
+    float sigmaRange;          // Range Gaussian width on normal differences (0-2)
+};
+
+// Step of every smoothing iteration (SMOOTHING_OPERATOR of shader.comp).
+enum SmoothingOperator
+{
+    OPERATOR_UMBRELLA = 0,         // Towards the neighbour average, scaled by lambda
+    OPERATOR_SCALE_DEPENDENT = 1,  // Desbrun's edge-length normalized umbrella
+    OPERATOR_MEAN_CURVATURE = 2    // Cotangent mean curvature flow
+};
+
+struct VertexFlags
+{
+    GLuint bits;               // VertexFlagBits
+    float weight;              // Scales the umbrella step (1 = move to the average)
+};
 
 class SSBOMesh : public Drawable
 {
 private:
     GLuint faces;              // Number of triangle faces 
     GLuint vertices;           // Number of vertices
-    GLuint vaoHandle;
+    GLuint vaoHandle;          // Draws the position SSBOs as vertex buffers (see render)
     GLuint ssboHandle[6];
+    int currentBuffer;         // Position SSBO (3 or 4) holding the latest result
+    bool buffersInSync;        // Both position SSBOs hold the same positions
+    GLSLProgram* program;      // Smoothing compute program (shader.comp)
+
+    // Host copy of the CSR adjacency uploaded to SSBOs 0-2.
+    vector<GLuint> hostNeighbors;
+    vector<GLuint> hostSpans;
+    vector<GLuint> hostOffsets;
+
+    // Corner table of the faces, from which the CSR, the feature flags and
+    // the per-vertex face lists are derived.
+    CornerTable topology;
+
+    // Feature preservation: per-vertex flags and the bits that hold a vertex fixed.
+    vector<VertexFlags> hostFlags;
+    GLuint flagsHandle;
+    GLuint lockMask;
+    float lambda;              // Global step size multiplied with the vertex weight
+    float creaseAngle;         // Dihedral angle (degrees) above which an edge is a crease
+    bool welding;
+    float weldEpsilon;
+
+    // Position storage format and the quantization frame (mesh bounding box).
+    PositionFormat positionFormat;
+    vec3 bboxMin;
+    vec3 bboxMax;
+    bool keepReference;        // Retain fp32 input positions for error reporting
+    vector<float> referencePositions;
+
+    // Delta-encoded neighbor indices (see neighborcodec.h)
+    bool compressNeighbors;
+
+    // Gauss-Seidel mode: vertices grouped by a greedy graph coloring are
+    // updated in place one color at a time, so only one position buffer exists.
+    bool gaussSeidel;
+    GLuint colorHandle;        // SSBO of vertices sorted by color
+    vector<GLuint> colorStart; // Start of each color in colorHandle (+ end sentinel)
+
+    // Variants of the smoothing program: the same source and defines as
+    // 'program' plus one extra define each, built on first use.
+    string shaderFile;
+    vector<string> shaderDefines;
+    std::map<string, GLSLProgram*> variantPrograms;  // NULL if the build failed
+    ShaderCache* shaderCache;  // Builds the variants when set
+
+    // Valence-bucketed dispatch: vertices sorted by valence, one shader variant
+    // (FIXED_VALENCE) per common valence and the generic program for the rest.
+    bool valenceBuckets;
+    GLuint bucketHandle;       // SSBO of vertices sorted by valence
+    vector<GLuint> bucketStart;    // Start of each bucket (+ end sentinel)
+    vector<GLuint> bucketValence;  // Valence of each bucket, 0 = generic program,
+                                   // GATHER_BUCKET = cooperative gather variant
+    // Vertices of valence gatherValence and up (0 = none) are smoothed by a
+    // team of gatherLanes invocations each (SUBGROUP_GATHER when the driver
+    // has subgroup arithmetic in compute shaders, else COOPERATIVE_GATHER).
+    GLuint gatherValence;
+    GLuint gatherLanes;
+    string gatherDefine;
+    void detectGatherVariant();
+
+    // Vertices covered by one workgroup of the smoothing program
+    // (WORKGROUP_SIZE * VERTS_PER_THREAD in shader.comp)
+    GLuint verticesPerGroup;
+    GLuint groupsFor(GLuint count) const { return (count + verticesPerGroup - 1) / verticesPerGroup; }
+
+    // Persistent-threads dispatch (PERSISTENT_THREADS variant): a fixed number
+    // of workgroups take chunks from the work queue SSBO (binding 8), running
+    // up to persistentIterations iterations per dispatch. Off when 0 groups.
+    GLuint persistentGroups;
+    GLuint persistentChunk;    // Vertices per chunk (0 = verticesPerGroup)
+    GLuint persistentIterations;
+    GLuint queueHandle;
+    void dispatchPersistent(GLSLProgram* prog, int numIterations);
+
+    // HC smoothing (HC_STAGE variants, two dispatches per iteration). The
+    // positions as uploaded stay resident in originalHandle.
+    bool hcSmoothing;
+    float hcAlpha;
+    float hcBeta;
+    GLuint originalHandle;
+    GLuint differenceHandle;   // b of every vertex (3 floats)
+    void dispatchHC(int numIterations);
+
+    // Explicit flow with a SMOOTHING_OPERATOR variant: a vertex moves by
+    // timeStep (0 = derived from the bounding box) times the operator, at most
+    // stepClamp mean edge lengths per iteration.
+    SmoothingOperator smoothingOperator;
+    float timeStep;
+    float stepClamp;
+    void dispatchFlow(int numIterations);
+
+    // Bilateral normal filtering (DENOISE_STAGE variants of bilateralShaderFile)
+    // instead of the umbrella step; its face adjacency is uploaded with the mesh.
+    // Mean curvature flow uses the per-vertex corner lists.
+    bool bilateral;
+    BilateralSettings bilateralSettings;
+    string bilateralShaderFile;
+    GLuint faceAdjacencyHandle[4]; // Face offsets and neighbors (bilateral only), vertex corner offsets and corners (CSR)
+    GLuint normalHandle[2];    // Face normals and areas, ping-pong while filtering
+    GLuint centroidHandle;
+    float centroidSpacing;     // Mean distance between the centroids of adjacent faces
+    void buildFaceAdjacency(const float* positions, const GLuint* elements);
+    void dispatchBilateral(int numIterations);
+
+    // Volume restoring rescale (VOLUME_STAGE variants of volumeShaderFile)
+    // every volumeInterval iterations of smoothVertices(); the target is the
+    // volume before the first smoothing after a load.
+    int volumeInterval;        // 0 = off
+    string volumeShaderFile;
+    GLuint volumeHandle[2];    // Per-workgroup partial sums, reduced state (target, current, scale)
+    bool volumeCaptured;
+    void restoreVolume(bool captureTarget);
+
+    // GPU timing of smoothVertices() with a GL_TIME_ELAPSED query
+    bool profiling;
+    GLuint timerQuery;
+    double lastSmoothMs;
+
+    // Out-of-core mode: loadOBJ converts the mesh into a block file on disk,
+    // which is paged through host and GPU memory in blocks (see
+    // streamsmoother.h). Disabled when streamBlockVertices is 0.
+    GLuint streamBlockVertices;
+    int streamHalo;
+    size_t streamCacheBlocks;
+    string streamScratch;
+    BlockStore* blockStore;
+    StreamingSmoother* streamer;
+    vector<float> hostPositions;
+    vector<GLuint> hostFaces;
+
+    // Distributed mode: this process smooths one piece of the mesh and trades
+    // ghost positions with the other ranks (see partition.h).
+    HaloTransport* transport;
+    DistributedSmoother* distributed;
+
+    // Host-only loading: nothing is uploaded (see setHostOnly).
+    bool hostOnly;
+
+    LoadTimings lastLoad;
+
+    // Make these private in order to make the object non-copyable
+    SSBOMesh(const SSBOMesh& other);
+    SSBOMesh& operator=(const SSBOMesh& other) { return *this; }
+
+    // Positions live in hostPositions (or the block file) rather than in the position SSBOs
+    bool hostResident() const { return streamer || distributed || hostOnly; }
+
+    // loadOBJ in out-of-core mode (see setStreaming)
+    void loadBlockStore(const char* fileName);
+
+    // Dirty region smoothing (see smoothRegion).
+    GLuint activeHandle;       // SSBO of active vertex indices
+    GLuint indirectHandle;     // glDispatchComputeIndirect arguments
+    GLuint activeCapacity;
+    vector<GLuint> regionStamp;
+    GLuint regionGeneration;
 
-    void trimString(string& str);
-    void storeVBO(
-        const vector<vec3>& points,
-        const vector<vec3>& normals,
-        const vector<vec2>& texCoords,
-        const vector<vec4>& tangents,
-        const vector<GLuint>& elements);
     void storeSSBO(
-        const vector<vector<GLuint>>& adjacencies,
-        const vector<vec3>& points,
-        const vector<GLuint>& elements);
+        const float* positions,
+        const GLuint* elements,
+        GLuint numVertices,
+        GLuint numFaces);
     void generateAdjacencyList(
-        const vector<vec3>& points,
-        const vector<GLuint>& faces,
-        vector<vector<GLuint>>& adjacencies
+        GLuint numPoints,
+        const float* positions,
+        const GLuint* faces,
+        size_t numIndices,
+        MonotonicArena& arena
     );
+    void syncPositionBuffers();
+    void setSmoothingUniforms(GLSLProgram* target);
+    size_t positionStride() const { return positionFormat == POSITIONS_FP32 ? 3 * sizeof(float) : 2 * sizeof(GLuint); }
+    void encodePositions(const float* src, GLuint count, vector<GLuint>& dst) const;
+    void decodePositions(const GLuint* src, GLuint count, float* dst) const;
+    void printFeatureCounts() const;
+    void colorVertices(vector<GLuint>& order);
+    void buildValenceBuckets(vector<GLuint>& order);
+    GLSLProgram* variantProgram(const string& define);
+    GLSLProgram* shaderVariant(const string& file, const string& define);
+    GLSLProgram* bucketProgram(size_t bucket);
+    void dispatchValenceBuckets();
+    void updateFlags(const vector<GLuint>& indices);
+    void expandRegion(const vector<GLuint>& dirty, int rings, vector<GLuint>& region);
 
 public:
+    SSBOMesh();
     SSBOMesh(const char* fileName);
+    ~SSBOMesh();
 
+    // Draws the faces from the position SSBO holding the latest result,
+    // bound as vertex attribute 0 (see setPositionAttribute), with the
+    // program in use. In-core meshes only.
     void render() const;
 
+    void setProgram(GLSLProgram* prog) { program = prog; }
+
+    GLuint numVertices() const { return vertices; }
+    GLuint numFaces() const { return faces; }
+
+    void smoothVertices(const int numIterations);
     void smoothVertices(const int numIterations, const char outputModelFilename[]);
 
+    // Re-smooths only the numIterations-ring around the dirty vertices; all
+    // other vertices are held fixed. Cost scales with the region, not the mesh.
+    void smoothRegion(const vector<GLuint>& dirty, const int numIterations);
+    void updateVertices(const vector<GLuint>& indices, const vector<vec3>& positions);
+
+    // Feature preservation. setLockMask() selects which VertexFlagBits hold a
+    // vertex in place; the crease angle must be set before the mesh is loaded.
+    void setLockMask(GLuint mask) { lockMask = mask; }
+    void setLambda(float value) { lambda = value; }
+    float getLambda() const { return lambda; }
+    void setCreaseAngle(float degrees) { creaseAngle = degrees; }
+    void lockVertices(const vector<GLuint>& indices, bool locked);
+
+    // Welds vertices within 'epsilon' (<= 0: 1e-6 of the bounding box
+    // diagonal) and drops degenerate and duplicate faces while loading (see
+    // meshclean.h), so duplicated seams stay connected. On by default for
+    // loadOBJ; loadArrays and loadShared only clean when asked. Must be set
+    // before loading. The mesh then has fewer vertices than its input.
+    void setWelding(bool enabled, float epsilon) { welding = enabled; weldEpsilon = epsilon; }
+
+    // Position storage; must be set before loading and match the program's
+    // POSITION_FORMAT define (see positionFormatDefine()).
+    void setPositionFormat(PositionFormat format, bool keepReferencePositions = false);
+    static string positionFormatDefine(PositionFormat format);
+    // Sets the format of vertex attribute 'location' of the bound vertex
+    // array to read 'format' positions from vertex buffer binding 0: vec3
+    // for fp32, uvec2 for the packed formats (decoded by the shader).
+    static void setPositionAttribute(GLuint location, PositionFormat format);
+    PositionFormat getPositionFormat() const { return positionFormat; }
+    // Bounding box of the positions as loaded (the quantization frame)
+    void getBoundingBox(vec3& lo, vec3& hi) const { lo = bboxMin; hi = bboxMax; }
+    void readPositions(float* dst);
+    void readFaces(GLuint* dst);
+    const LoadTimings& loadTimings() const { return lastLoad; }
+
+    // Neighbor index compression; must be set before loading and match the
+    // program's COMPRESSED_NEIGHBORS define.
+    void setCompressedNeighbors(bool compressed) { compressNeighbors = compressed; }
+
+    void setProfiling(bool enabled) { profiling = enabled; }
+
+    // In-place Gauss-Seidel smoothing over color classes instead of Jacobi
+    // ping-pong; must be set before loading.
+    void setGaussSeidel(bool enabled) { gaussSeidel = enabled; }
+
+    // Source and defines of 'program', for building variants of it. Setting
+    // them again drops the variants built so far.
+    void setShaderSource(const char* shaderFileName, const vector<string>& defines);
+
+    // Dispatch one specialized shader per valence bucket (FIXED_VALENCE
+    // variants); must be set before loading.
+    void setValenceBuckets(bool enabled) { valenceBuckets = enabled; }
+    // Valence from which a bucketed vertex is gathered cooperatively (0 = never);
+    // must be set before loading. Ignored with compressed neighbors.
+    void setGatherValence(GLuint valence) { gatherValence = valence; }
+    void setShaderCache(ShaderCache* cache) { shaderCache = cache; }
+
+    // Must match the WORKGROUP_SIZE and VERTS_PER_THREAD the programs were built with.
+    void setVerticesPerGroup(GLuint count) { verticesPerGroup = count; }
+
+    // Smooths with 'groups' persistent workgroups pulling chunkVertices-sized
+    // chunks from an atomic counter, 'iterations' Jacobi iterations per
+    // dispatch. More than one iteration per dispatch spins on a global
+    // barrier and deadlocks unless all groups are resident on the device at
+    // once. Jacobi only, in core.
+    void setPersistentThreads(GLuint groups, GLuint chunkVertices, GLuint iterations)
+    {
+        persistentGroups = groups;
+        persistentChunk = chunkVertices;
+        persistentIterations = iterations;
+    }
+
+    // HC smoothing (Vollmer et al.): every iteration is an umbrella step
+    // followed by a pull back towards the original (weight alpha) and the
+    // previous positions, mostly undoing the shrinkage. Must be set before
+    // loading; Jacobi only, in core, without valence buckets.
+    void setHCSmoothing(bool enabled, float alpha, float beta)
+    {
+        hcSmoothing = enabled;
+        hcAlpha = alpha;
+        hcBeta = beta;
+    }
+
+    // Replaces the umbrella step by a scale-dependent flow: Desbrun's edge
+    // length normalized umbrella or mean curvature flow, both integrated
+    // explicitly with time step 'dt' (mesh units squared; <= 0 picks 1e-4
+    // times the squared bounding box diagonal) and each step clamped to
+    // 'clamp' mean edge lengths. Must be set before loading; Jacobi only, in
+    // core, without HC, bilateral filtering, buckets or persistent threads.
+    void setSmoothingOperator(SmoothingOperator op, float dt, float clamp)
+    {
+        smoothingOperator = op;
+        timeStep = dt;
+        stepClamp = clamp;
+    }
+
+    // Rescales the mesh about its centroid to the enclosed volume it had
+    // before smoothing, after every 'interval' iterations (and at the end),
+    // with the programs of shaderFileName (NULL = off). Volume and centroid
+    // are reduced on the GPU; positions are never read back. Meant for closed
+    // meshes. Must be set before loading; fp32 positions, in core.
+    void setVolumePreservation(const char* shaderFileName, int interval)
+    {
+        volumeShaderFile = shaderFileName ? shaderFileName : "";
+        volumeInterval = shaderFileName ? (interval > 0 ? interval : 1) : 0;
+    }
+
+    // Denoises by bilateral normal filtering with the programs of
+    // shaderFileName (NULL = off) instead of umbrella smoothing; each
+    // iteration filters the face normals, then moves the vertices to fit them.
+    // Must be set before loading; fp32 positions, Jacobi only, in core.
+    void setBilateralFilter(const char* shaderFileName, const BilateralSettings& settings)
+    {
+        bilateral = shaderFileName != NULL;
+        bilateralShaderFile = shaderFileName ? shaderFileName : "";
+        bilateralSettings = settings;
+    }
+
+    // Times 'repetitions' Jacobi dispatches of 'prog' over the whole mesh
+    // without advancing it (every dispatch reads the current positions).
+    // Returns milliseconds per dispatch; used by the autotuner.
+    double timeKernel(GLSLProgram* prog, GLuint groupVertices, int repetitions);
+    GLuint numColors() const { return colorStart.empty() ? 0 : GLuint(colorStart.size() - 1); }
+
+    // Out-of-core smoothing in blocks of blockVertices with a haloDepth-ring of
+    // ghosts (haloDepth iterations per pass), keeping cacheBlocks blocks in
+    // host memory; must be set before loadOBJ, the only loader it applies to.
+    // The block file and its scratch files are named scratchPrefix + ".*.tmp".
+    // Requires fp32 positions and uncompressed neighbors; OBJ input is not
+    // welded.
+    void setStreaming(GLuint blockVertices, int haloDepth, size_t cacheBlocks, const char* scratchPrefix) {
+        streamBlockVertices = blockVertices; streamHalo = haloDepth; streamCacheBlocks = cacheBlocks; streamScratch = scratchPrefix;
+    }
+    // Smooths only this rank's piece of the mesh, exchanging halos through
+    // 'halo'; must be set before loading. Rank 0 holds the result afterwards.
+    void setDistributed(HaloTransport* halo) { transport = halo; }
+    // Loads into the host arrays below and makes no GL calls, so a mesh can
+    // be loaded on a worker thread (see batchpipeline.h); it cannot be
+    // smoothed itself. Must be set before loading.
+    void setHostOnly(bool enabled) { hostOnly = enabled; }
+    const vector<GLuint>& getHostSpans() const { return hostSpans; }
+    const vector<GLuint>& getHostOffsets() const { return hostOffsets; }
+    const vector<GLuint>& getHostNeighbors() const { return hostNeighbors; }
+    const vector<VertexFlags>& getHostFlags() const { return hostFlags; }
+    const CornerTable& getTopology() const { return topology; }
+    const vector<float>& getHostPositions() const { return hostPositions; }
+    const vector<GLuint>& getHostFaces() const { return hostFaces; }
+
+    double lastSmoothTime() const { return lastSmoothMs; }
+    void smoothOnHost(vector<float>& positions, const int numIterations) const;
+    // HC smoothing of 'positions' (the originals) on 'threads' CPU threads
+    // (0 = one per hardware thread), same arithmetic as the GPU path.
+    void smoothOnHostHC(vector<float>& positions, const int numIterations, unsigned threads = 0) const;
+    void reportStorageError(const int numIterations);
+    void setVertexWeights(const vector<GLuint>& indices, const vector<float>& weights);
+
     void loadOBJ(const char* fileName);
+    // Loads positions (xyz) and 0-indexed triangles already in memory, e.g. a
+    // generated mesh (see meshgen.h); 'source' names them in the load report.
+    // The caller's vertex numbering is kept (for updateVertices, smoothRegion
+    // and exportShared) unless 'clean' asks for the load-time cleanup, with
+    // the epsilon of setWelding().
+    void loadArrays(const float* positions, const GLuint* elements, GLuint numVertices, GLuint numFaces, const char* source,
+        bool clean = false);
+
+    // Zero-copy exchange through a shared memory segment (see sharedmem.h).
+    // The exported mesh has the numbering of the loaded one ('clean' as above).
+    bool loadShared(const char* segmentName, bool clean = false);
+    bool exportShared(const char* segmentName);
 
     void writeOBJ(const char* fileName, const float* vertexData, const GLuint* faceData);
 };
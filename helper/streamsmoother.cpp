@@ -0,0 +1,190 @@
+#include "streamsmoother.h"
+#include "glslprogram.h"
+
+#include <algorithm>
+#include <cstdint>
+
+StreamingSmoother::StreamingSmoother(BlockStore& store, size_t cacheBlocks)
+    : store(store), cacheCapacity(std::max<size_t>(cacheBlocks, 1)), useCount(0), pass(0),
+    blockReads(0), peakCachedBytes(0), readFailed(false), peakResidentBytes(0)
+{
+    for (int i = 0; i < 6; ++i) {
+        bufferHandle[i] = 0;
+        bufferCapacity[i] = 0;
+    }
+}
+
+StreamingSmoother::~StreamingSmoother()
+{
+    if (bufferHandle[0]) glDeleteBuffers(6, bufferHandle);
+}
+
+const StreamingSmoother::CachedBlock& StreamingSmoother::fetch(GLuint block)
+{
+    std::map<GLuint, CachedBlock>::iterator it = cache.find(block);
+    if (it == cache.end()) {
+        if (cache.size() >= cacheCapacity) {
+            std::map<GLuint, CachedBlock>::iterator oldest = cache.begin();
+            for (std::map<GLuint, CachedBlock>::iterator c = cache.begin(); c != cache.end(); ++c) {
+                if (c->second.lastUse < oldest->second.lastUse) oldest = c;
+            }
+            cache.erase(oldest);
+        }
+        it = cache.insert(std::make_pair(block, CachedBlock())).first;
+        readFailed = !store.readTopology(block, it->second.topology) || readFailed;
+        it->second.pass = -1;
+        blockReads++;
+
+        size_t cachedBytes = 0;
+        for (std::map<GLuint, CachedBlock>::iterator c = cache.begin(); c != cache.end(); ++c) {
+            const BlockTopology& t = c->second.topology;
+            cachedBytes += t.ids.size() * (3 * sizeof(GLuint) + sizeof(VertexFlags) + 3 * sizeof(float)) +
+                t.neighbors.size() * 2 * sizeof(GLuint);
+        }
+        peakCachedBytes = std::max(peakCachedBytes, cachedBytes);
+    }
+
+    // Positions of an earlier pass are stale
+    CachedBlock& cached = it->second;
+    if (cached.pass != pass) {
+        cached.positions.resize(3 * size_t(store.blockSize(block)));
+        readFailed = !store.readPositions(block, cached.positions.data()) || readFailed;
+        cached.pass = pass;
+    }
+    cached.lastUse = ++useCount;
+    return cached;
+}
+
+void StreamingSmoother::gatherBlock(GLuint block, int haloDepth)
+{
+    // Interior first, in slot order, then one breadth-first ring of ghosts
+    // per halo level. Neighbor lists carry the owning block, so only the
+    // blocks of expanded vertices are fetched.
+    localVertices.clear();
+    globalToLocal.clear();
+    const vector<GLuint>& ids = fetch(block).topology.ids;
+    for (GLuint s = 0; s < ids.size(); ++s) {
+        globalToLocal[ids[s]] = GLuint(localVertices.size());
+        localVertices.push_back(LocalVertex{ ids[s], block, 0 });
+    }
+
+    size_t ringStart = 0;
+    for (int level = 1; level <= haloDepth; ++level) {
+        size_t ringEnd = localVertices.size();
+        for (size_t i = ringStart; i < ringEnd; ++i) {
+            LocalVertex v = localVertices[i];
+            const BlockTopology& t = fetch(v.block).topology;
+            GLuint s = t.slot(v.id);
+            for (GLuint j = 0; j < t.spans[s]; ++j) {
+                GLuint n = t.neighbors[t.offsets[s] + j];
+                if (globalToLocal.insert(std::make_pair(n, GLuint(localVertices.size()))).second) {
+                    localVertices.push_back(LocalVertex{ n, t.neighborBlocks[t.offsets[s] + j], GLuint(level) });
+                }
+            }
+        }
+        ringStart = ringEnd;
+    }
+}
+
+void StreamingSmoother::uploadBuffer(int index, const void* data, size_t bytes)
+{
+    // Buffers only grow, so the working set is allocated once per mesh.
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferHandle[index]);
+    if (bytes > bufferCapacity[index]) {
+        bufferCapacity[index] = bytes;
+        glBufferData(GL_SHADER_STORAGE_BUFFER, bytes, data, GL_DYNAMIC_DRAW);
+    }
+    else if (bytes > 0) {
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, data);
+    }
+}
+
+bool StreamingSmoother::smooth(GLSLProgram* program, GLuint verticesPerGroup, int numIterations, int haloDepth)
+{
+    if (bufferHandle[0] == 0) glGenBuffers(6, bufferHandle);
+    haloDepth = std::max(haloDepth, 1);
+
+    program->setUniform("useActiveList", false);
+    program->setUniform("copyOnly", false);
+
+    vector<GLuint> localSpans, localOffsets, localNeighbors;
+    vector<float> localPositions;
+    vector<VertexFlags> localFlags;
+
+    for (int done = 0; done < numIterations && !readFailed; ) {
+        int k = std::min(haloDepth, numIterations - done);
+
+        for (GLuint block = 0; block < numBlocks() && !readFailed; ++block) {
+            gatherBlock(block, k);
+            GLuint count = GLuint(localVertices.size());
+            GLuint interior = store.blockSize(block);
+
+            // Local CSR in the same neighbor order as the in-core buffers. The
+            // outermost ghost ring is held fixed; its error cannot reach the
+            // interior within k iterations.
+            localSpans.assign(count, 0);
+            localOffsets.assign(count, 0);
+            localNeighbors.clear();
+            localPositions.resize(3 * size_t(count));
+            localFlags.resize(count);
+            for (GLuint i = 0; i < count; ++i) {
+                const LocalVertex& v = localVertices[i];
+                const CachedBlock& owner = fetch(v.block);
+                const BlockTopology& t = owner.topology;
+                GLuint s = v.ring == 0 ? i : t.slot(v.id);
+                localOffsets[i] = GLuint(localNeighbors.size());
+                if (int(v.ring) < k) {
+                    for (GLuint j = 0; j < t.spans[s]; ++j) {
+                        localNeighbors.push_back(globalToLocal[t.neighbors[t.offsets[s] + j]]);
+                    }
+                    localSpans[i] = t.spans[s];
+                }
+                localPositions[3 * i] = owner.positions[3 * size_t(s)];
+                localPositions[3 * i + 1] = owner.positions[3 * size_t(s) + 1];
+                localPositions[3 * i + 2] = owner.positions[3 * size_t(s) + 2];
+                localFlags[i] = t.flags[s];
+            }
+            if (localNeighbors.empty()) localNeighbors.push_back(0);
+
+            size_t positionBytes = 3 * size_t(count) * sizeof(float);
+            uploadBuffer(0, localNeighbors.data(), localNeighbors.size() * sizeof(GLuint));
+            uploadBuffer(1, localSpans.data(), count * sizeof(GLuint));
+            uploadBuffer(2, localOffsets.data(), count * sizeof(GLuint));
+            uploadBuffer(3, localPositions.data(), positionBytes);
+            uploadBuffer(4, localPositions.data(), positionBytes);
+            uploadBuffer(5, localFlags.data(), count * sizeof(VertexFlags));
+
+            size_t resident = 0;
+            for (int i = 0; i < 6; ++i) resident += bufferCapacity[i];
+            peakResidentBytes = std::max(peakResidentBytes, resident);
+
+            for (int i = 0; i < 3; ++i) {
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, bufferHandle[i]);
+            }
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, bufferHandle[5]);
+
+            // Bind exact ranges so positions.length() is the local vertex count.
+            int readIdx = 3;
+            for (int it = 0; it < k; ++it) {
+                int writeIdx = readIdx == 3 ? 4 : 3;
+                glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, bufferHandle[readIdx], 0, positionBytes);
+                glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, bufferHandle[writeIdx], 0, positionBytes);
+                glDispatchCompute((count + verticesPerGroup - 1) / verticesPerGroup, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                readIdx = writeIdx;
+            }
+
+            // Only the interior (local indices [0, interior), in slot order)
+            // is final; it goes to the store for the next pass.
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, bufferHandle[readIdx]);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 3 * size_t(interior) * sizeof(float), localPositions.data());
+            readFailed = !store.writePositions(block, localPositions.data()) || readFailed;
+        }
+
+        store.swapPositions();
+        pass++;
+        done += k;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return !readFailed;
+}
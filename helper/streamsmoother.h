@@ -0,0 +1,86 @@
+#ifndef STREAMSMOOTHER_H
+#define STREAMSMOOTHER_H
+
+#include "gldecl.h"
+#include "blockstore.h"
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+using std::vector;
+
+class GLSLProgram;
+
+/////////////////////////////////////////////////////////////////////////////
+// Out-of-core smoothing for meshes that fit neither in GPU nor in host
+// memory. The mesh stays in a BlockStore on disk; each pass runs k
+// iterations per block on the block plus a k-ring halo of ghost vertices,
+// paging the blocks it touches through a small LRU cache. After k
+// iterations the block interior matches the in-core result exactly; it is
+// written to the store for the next pass, and the ghosts are discarded.
+/////////////////////////////////////////////////////////////////////////////
+
+class StreamingSmoother
+{
+private:
+    BlockStore& store;
+
+    // Blocks read back from the store. Positions are those of the pass in
+    // which the block was last used; topology does not change.
+    struct CachedBlock
+    {
+        BlockTopology topology;
+        vector<float> positions;
+        int pass;
+        size_t lastUse;
+    };
+    std::map<GLuint, CachedBlock> cache;
+    size_t cacheCapacity;          // Blocks
+    size_t useCount;
+    int pass;
+    size_t blockReads;
+    size_t peakCachedBytes;
+    bool readFailed;
+
+    // Per-block working set (reused between blocks)
+    struct LocalVertex
+    {
+        GLuint id;
+        GLuint block;
+        GLuint ring;               // 0 = interior, else halo level
+    };
+    vector<LocalVertex> localVertices;
+    std::unordered_map<GLuint, GLuint> globalToLocal;
+
+    // Resident GPU buffers: neighbors, spans, offsets, positions x2, flags
+    GLuint bufferHandle[6];
+    size_t bufferCapacity[6];
+    size_t peakResidentBytes;
+
+    // Make these private in order to make the object non-copyable
+    StreamingSmoother(const StreamingSmoother& other);
+    StreamingSmoother& operator=(const StreamingSmoother& other) { return *this; }
+
+    const CachedBlock& fetch(GLuint block);
+    void gatherBlock(GLuint block, int haloDepth);
+    void uploadBuffer(int index, const void* data, size_t bytes);
+
+public:
+    // Keeps up to cacheBlocks blocks in host memory; the halo of a block
+    // should fit, or blocks are read more than once per pass.
+    StreamingSmoother(BlockStore& store, size_t cacheBlocks);
+    ~StreamingSmoother();
+
+    // Runs numIterations umbrella iterations on the positions in the store,
+    // haloDepth iterations per pass. The program must be shader.comp compiled
+    // for fp32 positions and uncompressed neighbors; each of its workgroups
+    // covers verticesPerGroup vertices. Returns false if the store failed.
+    bool smooth(GLSLProgram* program, GLuint verticesPerGroup, int numIterations, int haloDepth);
+
+    size_t numBlocks() const { return store.numBlocks(); }
+    size_t peakResident() const { return peakResidentBytes; }
+    size_t peakCached() const { return peakCachedBytes; }
+    size_t blocksRead() const { return blockReads; }
+};
+
+#endif // STREAMSMOOTHER_H
@@ -1,8 +1,17 @@
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <fstream>
+#include <chrono>
 using namespace std;
 
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
@@ -14,6 +23,15 @@ using namespace std;
 
 #include "helper/glslprogram.h"
 #include "helper/ssbomesh.h"
+#include "helper/sharedmem.h"
+#include "helper/halotransport.h"
+#include "helper/shadercache.h"
+#include "helper/autotune.h"
+#include "helper/batchpipeline.h"
+#include "helper/benchmark.h"
+#include "helper/meshgen.h"
+#include "helper/meshpreview.h"
+#include "helper/smoothingscene.h"
 
 
 /////////////////////////////////////////////////////////////////////////////
@@ -29,10 +47,137 @@ static const char outputModelFilename[] = "models/out.obj";
 
 // Shader's filename.
 const char compShaderFile[] = "shader.comp";
+const char bilateralShaderFile[] = "bilateral.comp";
+const char volumeShaderFile[] = "volume.comp";
+const char previewVertexShaderFile[] = "preview.vert";
+const char previewFragmentShaderFile[] = "preview.frag";
 
 // This value stores how many iterations of Laplacian smoothing is to be performed on the mesh.
 int numIterations = 1;
 
+// Optional shared memory segments (see helper/sharedmem.h). When set, the mesh is
+// imported from / written back to these segments instead of the OBJ files above.
+const char* sharedInputSegment = NULL;
+const char* sharedOutputSegment = NULL;
+
+// Generated input (see helper/meshgen.h), e.g. "sphere:8,shuffle": smoothed
+// from memory instead of the input OBJ file, or only written to generateOutFile.
+const char* generateSpec = NULL;
+const char* generateOutFile = NULL;
+GeneratedMesh generatedInput;
+
+// Batch mode: a list of "input output" OBJ pairs smoothed through the
+// pipelined loader/smoother/writer (see helper/batchpipeline.h).
+const char* batchListFile = NULL;
+
+// Benchmark mode: every phase of every model in the directory and of each
+// generated mesh, written as JSON to benchmarkFile (see helper/benchmark.h).
+// With benchCompareFiles set, two reports are compared instead.
+const char* benchmarkFile = NULL;
+BenchmarkOptions benchOptions = { "models", vector<string>(), 5, 1, "", "" };
+const char* benchCompareFiles[2] = { NULL, NULL };
+double benchThreshold = 10.0;
+
+// Feature preservation: which vertex flags hold a vertex in place (see VertexFlagBits)
+// and the dihedral angle in degrees above which an edge counts as a crease.
+unsigned int lockMask = 0;
+float creaseAngle = 60.0f;
+
+// Load-time welding of vertices within weldEpsilon (0 = 1e-6 of the bounding
+// box diagonal) and removal of degenerate and duplicate faces (see helper/meshclean.h).
+// OBJ input only: --shm-in and --generate meshes keep their vertex numbering.
+bool weldVertices = true;
+float weldEpsilon = 0.0f;
+
+// Storage of the position buffers (fp32, fp16 or 21-bit quantized) and whether to
+// report the error of a compact format against an fp32 reference on the host.
+PositionFormat positionFormat = POSITIONS_FP32;
+bool reportStorageError = false;
+
+// Delta-encode the CSR neighbor indices (16-bit slots) and print GPU timings.
+bool compressNeighbors = false;
+bool profile = false;
+
+// In-place Gauss-Seidel smoothing over graph colors instead of Jacobi ping-pong.
+bool gaussSeidel = false;
+
+// Dispatch vertices grouped by valence with one FIXED_VALENCE shader variant each.
+bool valenceBuckets = false;
+// Valence from which a bucketed vertex is summed by a team of invocations (0 = never).
+unsigned int gatherValence = 64;
+
+// Persistent threads: workgroups launched (0 = regular dispatch), vertices per
+// chunk taken from the work queue (0 = one workgroup's worth) and iterations
+// per dispatch (more than 1 needs all groups resident at once).
+unsigned int persistentGroups = 0;
+unsigned int persistentChunk = 0;
+unsigned int persistentIterations = 1;
+
+// HC smoothing (Vollmer et al.) with its alpha and beta weights; hcOnCpu
+// runs it on hcThreads host threads (0 = all) instead of the GPU.
+bool hcSmoothing = false;
+float hcAlpha = 0.1f;
+float hcBeta = 0.6f;
+bool hcOnCpu = false;
+unsigned int hcThreads = 0;
+
+// Smoothing operator (see SmoothingOperator in helper/ssbomesh.h); the flows
+// take a time step (0 = from the bounding box) and a per-iteration step limit
+// in mean edge lengths.
+SmoothingOperator smoothingOperator = OPERATOR_UMBRELLA;
+float flowTimeStep = 0.0f;
+float flowStepClamp = 0.5f;
+
+// Square preview images of previewSize pixels (0 = none) drawn from the GPU
+// buffers before and after smoothing and written next to each output OBJ as
+// <name>-before.png and <name>-after.png (see helper/meshpreview.h).
+int previewSize = 0;
+
+// Interactive viewer (see helper/smoothingscene.h): up to viewIterationsPerFrame
+// iterations per frame within viewFrameBudget ms of GPU time, drawn straight
+// from the GPU buffers; the output OBJ is written when the window closes.
+bool viewMode = false;
+int viewIterationsPerFrame = 8;
+double viewFrameBudget = 8.0;
+
+// Restore the enclosed volume every volumeInterval iterations (0 = never; see volume.comp).
+int volumeInterval = 0;
+
+// Bilateral normal filtering instead of umbrella smoothing (see bilateral.comp):
+// normal filter passes and vertex updates per iteration, and the Gaussian widths.
+bool bilateralFilter = false;
+BilateralSettings bilateralSettings = { 5, 10, 1.0f, 0.35f };
+
+// Directory of cached program binaries (see helper/shadercache.h); NULL disables it.
+const char* shaderCacheDir = "shadercache";
+ShaderCache* shaderCache = NULL;
+
+// Workgroup shape of shader.comp. Loaded per renderer from tuningFile, or
+// measured on the loaded mesh with --autotune (see helper/autotune.h).
+const char tuningFile[] = "dispatch-tuning.txt";
+DispatchConfig dispatch = defaultDispatchConfig();
+bool autotune = false;
+int autotuneIterations = 20;
+
+// Out-of-core streaming from an on-disk block file next to the output OBJ:
+// vertices per block (0 = in-core), halo depth, i.e. iterations per pass, and
+// blocks kept in host memory. verifyStreaming also runs in-core and compares.
+unsigned int streamBlockVertices = 0;
+int streamHalo = 4;
+unsigned int streamCacheBlocks = 32;
+bool verifyStreaming = false;
+
+// Distributed smoothing over numRanks local processes forked from this one
+// (1 = off), or over MPI ranks with --mpi when built with HAVE_MPI. Rank 0
+// writes the output; verifyRanks also smooths in one process and compares.
+int numRanks = 1;
+bool useMpi = false;
+bool verifyRanks = false;
+HaloTransport* haloTransport = NULL;
+#ifndef _WIN32
+vector<pid_t> rankProcesses;
+#endif
+
 GLSLProgram shaderProg;  // Contains the shader program object.
 
 SSBOMesh* objMesh;     // Contains the 3D mesh.
@@ -61,6 +206,565 @@ static void WaitForEnterKeyBeforeExit(void)
 
 
 
+static void parseCommandLine(int argc, char** argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--iterations") && i + 1 < argc) {
+            numIterations = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--lock-boundary")) {
+            lockMask |= VERTEX_BOUNDARY;
+        }
+        else if (!strcmp(argv[i], "--lock-creases")) {
+            lockMask |= VERTEX_CREASE;
+            if (i + 1 < argc && argv[i + 1][0] != '-') creaseAngle = float(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--no-weld")) {
+            weldVertices = false;
+        }
+        else if (!strcmp(argv[i], "--weld-epsilon") && i + 1 < argc) {
+            weldEpsilon = float(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--positions") && i + 1 < argc) {
+            const char* format = argv[++i];
+            if (!strcmp(format, "fp32")) positionFormat = POSITIONS_FP32;
+            else if (!strcmp(format, "fp16")) positionFormat = POSITIONS_FP16;
+            else if (!strcmp(format, "quant21")) positionFormat = POSITIONS_QUANT21;
+            else {
+                fprintf(stderr, "Unknown position format: %s (fp32, fp16 or quant21)\n", format);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--report-error")) {
+            reportStorageError = true;
+        }
+        else if (!strcmp(argv[i], "--compress-neighbors")) {
+            compressNeighbors = true;
+        }
+        else if (!strcmp(argv[i], "--profile")) {
+            profile = true;
+        }
+        else if (!strcmp(argv[i], "--gauss-seidel")) {
+            gaussSeidel = true;
+        }
+        else if (!strcmp(argv[i], "--valence-buckets")) {
+            valenceBuckets = true;
+        }
+        else if (!strcmp(argv[i], "--gather-valence") && i + 1 < argc) {
+            gatherValence = (unsigned int)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--persistent")) {
+            persistentGroups = 64;
+            if (i + 1 < argc && argv[i + 1][0] != '-') persistentGroups = (unsigned int)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--persistent-chunk") && i + 1 < argc) {
+            persistentChunk = (unsigned int)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--persistent-iterations") && i + 1 < argc) {
+            persistentIterations = (unsigned int)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--hc")) {
+            hcSmoothing = true;
+            if (i + 2 < argc && argv[i + 1][0] != '-' && argv[i + 2][0] != '-') {
+                hcAlpha = float(atof(argv[++i]));
+                hcBeta = float(atof(argv[++i]));
+            }
+        }
+        else if (!strcmp(argv[i], "--hc-cpu")) {
+            hcOnCpu = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') hcThreads = (unsigned int)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--operator") && i + 1 < argc) {
+            ++i;
+            if (!strcmp(argv[i], "umbrella")) smoothingOperator = OPERATOR_UMBRELLA;
+            else if (!strcmp(argv[i], "scale")) smoothingOperator = OPERATOR_SCALE_DEPENDENT;
+            else if (!strcmp(argv[i], "mcf")) smoothingOperator = OPERATOR_MEAN_CURVATURE;
+            else {
+                fprintf(stderr, "Unknown operator: %s (umbrella, scale or mcf)\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (!strcmp(argv[i], "--time-step") && i + 1 < argc) {
+            flowTimeStep = float(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--step-clamp") && i + 1 < argc) {
+            flowStepClamp = float(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--preserve-volume")) {
+            volumeInterval = 1;
+            if (i + 1 < argc && argv[i + 1][0] != '-') volumeInterval = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--bilateral")) {
+            bilateralFilter = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') bilateralSettings.sigmaRange = float(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--bilateral-spatial") && i + 1 < argc) {
+            bilateralSettings.sigmaSpatial = float(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--bilateral-passes") && i + 2 < argc) {
+            bilateralSettings.normalIterations = atoi(argv[++i]);
+            bilateralSettings.vertexIterations = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--preview")) {
+            previewSize = 256;
+            if (i + 1 < argc && argv[i + 1][0] != '-') previewSize = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--view")) {
+            viewMode = true;
+        }
+        else if (!strcmp(argv[i], "--frame-iterations") && i + 1 < argc) {
+            viewIterationsPerFrame = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--frame-budget") && i + 1 < argc) {
+            viewFrameBudget = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--shader-cache") && i + 1 < argc) {
+            shaderCacheDir = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--no-shader-cache")) {
+            shaderCacheDir = NULL;
+        }
+        else if (!strcmp(argv[i], "--autotune")) {
+            autotune = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') autotuneIterations = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--stream") && i + 1 < argc) {
+            streamBlockVertices = (unsigned int)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--halo") && i + 1 < argc) {
+            streamHalo = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--stream-cache") && i + 1 < argc) {
+            streamCacheBlocks = (unsigned int)atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--verify-streaming")) {
+            verifyStreaming = true;
+        }
+        else if (!strcmp(argv[i], "--ranks") && i + 1 < argc) {
+            numRanks = atoi(argv[++i]);
+        }
+#ifdef HAVE_MPI
+        else if (!strcmp(argv[i], "--mpi")) {
+            useMpi = true;
+        }
+#endif
+        else if (!strcmp(argv[i], "--verify-ranks")) {
+            verifyRanks = true;
+        }
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+            batchListFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--generate") && i + 1 < argc) {
+            generateSpec = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--generate-out") && i + 1 < argc) {
+            generateOutFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--benchmark") && i + 1 < argc) {
+            benchmarkFile = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--bench-models") && i + 1 < argc) {
+            benchOptions.modelDirectory = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--bench-mesh") && i + 1 < argc) {
+            benchOptions.synthetic.push_back(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--bench-repetitions") && i + 1 < argc) {
+            benchOptions.repetitions = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--bench-compare") && i + 2 < argc) {
+            benchCompareFiles[0] = argv[++i];
+            benchCompareFiles[1] = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--bench-threshold") && i + 1 < argc) {
+            benchThreshold = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--shm-in") && i + 1 < argc) {
+            sharedInputSegment = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--shm-out") && i + 1 < argc) {
+            sharedOutputSegment = argv[++i];
+        }
+        else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            fprintf(stderr, "Usage: %s [--iterations N] [--lock-boundary] [--lock-creases [DEGREES]]\n"
+                "       [--no-weld | --weld-epsilon E]\n"
+                "       [--positions fp32|fp16|quant21] [--report-error]\n"
+                "       [--compress-neighbors] [--profile] [--gauss-seidel]\n"
+                "       [--valence-buckets [--gather-valence N]]\n"
+                "       [--persistent [GROUPS] [--persistent-chunk N] [--persistent-iterations N]]\n"
+                "       [--hc [ALPHA BETA]] [--hc-cpu [THREADS]]\n"
+                "       [--operator umbrella|scale|mcf [--time-step DT] [--step-clamp C]]\n"
+                "       [--preserve-volume [EVERY_K_ITERATIONS]]\n"
+                "       [--bilateral [SIGMA_RANGE] [--bilateral-spatial SCALE] [--bilateral-passes NORMAL VERTEX]]\n"
+                "       [--preview [SIZE]] [--view [--frame-iterations N] [--frame-budget MS]]\n"
+                "       [--shader-cache DIR | --no-shader-cache] [--autotune [ITERATIONS]]\n"
+                "       [--stream BLOCK_VERTICES [--halo K] [--stream-cache BLOCKS] [--verify-streaming]]\n"
+                "       [--ranks N | --mpi] [--verify-ranks] [--shm-in SEGMENT] [--shm-out SEGMENT]\n"
+                "       [--generate grid:N|noisy:N|random:N|torus:N|sphere:K[,shuffle][,seed=S] [--generate-out FILE]]\n"
+                "       [--batch LIST]\n"
+                "       [--benchmark REPORT [--bench-models DIR] [--bench-mesh grid:N|sphere:K]... [--bench-repetitions R]]\n"
+                "       [--bench-compare BASELINE REPORT [--bench-threshold PERCENT]]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+
+
+// Upper bound on the vertex count of the input mesh, for sizing the halo segment
+// before any rank has loaded it.
+static GLuint countInputVertices()
+{
+    if (sharedInputSegment) {
+        SharedMemorySegment segment;
+        SharedMeshHeader* header = openSharedMesh(segment, sharedInputSegment, false);
+        if (!header) exit(EXIT_FAILURE);
+        return header->vertices;
+    }
+    if (generateSpec) return generatedInput.numVertices();
+
+    ifstream objFile(inputModelFilename);
+    GLuint count = 0;
+    string line;
+    while (getline(objFile, line)) {
+        if (line.size() > 2 && line[0] == 'v' && (line[1] == ' ' || line[1] == '\t')) count++;
+    }
+    return count;
+}
+
+
+
+// Reaps the ranks forked by launchLocalRanks() (rank 0 only) and reports
+// those that failed.
+static int waitForLocalRanks()
+{
+    int status = EXIT_SUCCESS;
+#ifndef _WIN32
+    for (size_t i = 0; i < rankProcesses.size(); ++i) {
+        int rankStatus = 0;
+        if (waitpid(rankProcesses[i], &rankStatus, 0) < 0 || !WIFEXITED(rankStatus) || WEXITSTATUS(rankStatus) != 0) {
+            fprintf(stderr, "Error: rank %d failed.\n", int(i) + 1);
+            status = EXIT_FAILURE;
+        }
+    }
+    rankProcesses.clear();
+#endif
+    return status;
+}
+
+// Runs on any exit() of a local rank. Before the end of main() (the halo
+// transport still exists) that is a failure: the other ranks are released
+// from their barriers, and rank 0 waits for them and reports.
+#ifndef _WIN32
+static void abortLocalRanks()
+{
+    if (!haloTransport) return;
+    static_cast<SharedMemoryTransport*>(haloTransport)->abort();
+    waitForLocalRanks();
+}
+#endif
+
+// Forks numRanks - 1 processes that share a halo segment with this one, which
+// becomes rank 0. Must run before any GL or window state exists.
+static void launchLocalRanks()
+{
+#ifdef _WIN32
+    fprintf(stderr, "Error: --ranks needs fork(); use --mpi on this platform.\n");
+    exit(EXIT_FAILURE);
+#else
+    char segmentName[64];
+    snprintf(segmentName, sizeof(segmentName), "lsmooth-halo-%d", int(getpid()));
+    SharedMemoryTransport* shm = new SharedMemoryTransport();
+    if (!shm->create(segmentName, numRanks, countInputVertices())) exit(EXIT_FAILURE);
+
+    int rank = 0;
+    for (int r = 1; r < numRanks && rank == 0; ++r) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            for (size_t i = 0; i < rankProcesses.size(); ++i) kill(rankProcesses[i], SIGTERM);
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) rank = r;
+        else rankProcesses.push_back(pid);
+    }
+    if (rank != 0) {
+        rankProcesses.clear();
+        freopen("/dev/null", "r", stdin); // Only rank 0 waits for Enter on exit
+    }
+    shm->setRank(rank);
+    haloTransport = shm;
+    atexit(abortLocalRanks);
+#endif
+}
+
+
+
+// Builds shaderProg from compShaderFile with 'defines', through the shader
+// cache when enabled, and makes it current.
+static bool buildSmoothingProgram(const vector<string>& defines)
+{
+    chrono::steady_clock::time_point shaderStart = chrono::steady_clock::now();
+    int cacheHitsBefore = shaderCache ? shaderCache->cacheHits() : 0;
+    try {
+        if (shaderCache) {
+            shaderCache->build(shaderProg, compShaderFile, GLSLShader::COMPUTE, defines);
+        }
+        else {
+            shaderProg.compileShader(compShaderFile, GLSLShader::COMPUTE, defines);
+            shaderProg.link();
+        }
+        //shaderProg.validate();
+        shaderProg.use(); // Install shader program to rendering pipeline.
+    }
+    catch (GLSLProgramException& e) {
+        fprintf(stderr, "Error: %s.\n", e.what());
+        return false;
+    }
+
+    printf("Shader program ready in %.2f ms (%s).\n",
+        chrono::duration<double, milli>(chrono::steady_clock::now() - shaderStart).count(),
+        !shaderCache ? "compiled, cache disabled" : (shaderCache->cacheHits() > cacheHitsBefore ? "from cache" : "compiled"));
+    return true;
+}
+
+
+
+// Smooths every mesh in batchListFile and reports where the time went.
+static int runBatch()
+{
+    vector<BatchJob> jobs;
+    if (!readBatchList(batchListFile, jobs)) return EXIT_FAILURE;
+
+    BatchPipeline pipeline(&shaderProg, dispatch.verticesPerGroup());
+    pipeline.setCreaseAngle(creaseAngle);
+    pipeline.setWelding(weldVertices, weldEpsilon);
+    pipeline.setLockMask(lockMask);
+    MeshPreview* preview = previewSize > 0 ?
+        new MeshPreview(previewVertexShaderFile, previewFragmentShaderFile, previewSize, previewSize) : NULL;
+    pipeline.setPreview(preview);
+    BatchStageTimes t;
+    bool ok = pipeline.run(jobs, numIterations, t);
+    delete preview;
+
+    printf("Batch: %zu meshes in %.1f ms (%.1f ms/mesh).\n", jobs.size(), t.total,
+        jobs.empty() ? 0.0 : t.total / jobs.size());
+    printf(" Stages: parse %.1f, upload %.1f, smooth %.1f, readback %.1f, write %.1f ms (sum %.1f ms).\n",
+        t.parse, t.upload, t.smooth, t.readback, t.write, t.parse + t.upload + t.smooth + t.readback + t.write);
+    printf(" GL thread waited %.1f ms for the parser and %.1f ms for the writer.\n", t.parseStall, t.writeStall);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+
+// Applies the smoothing modes from the command line to a mesh that is not loaded yet.
+static void configureMesh(SSBOMesh* mesh, const vector<string>& defines)
+{
+    mesh->setShaderCache(shaderCache);
+    mesh->setCreaseAngle(creaseAngle);
+    mesh->setWelding(weldVertices, weldEpsilon);
+    mesh->setPositionFormat(positionFormat, reportStorageError && positionFormat != POSITIONS_FP32);
+    mesh->setCompressedNeighbors(compressNeighbors);
+    mesh->setProfiling(profile);
+    mesh->setGaussSeidel(gaussSeidel);
+    mesh->setShaderSource(compShaderFile, defines);
+    mesh->setValenceBuckets(valenceBuckets);
+    mesh->setGatherValence(gatherValence);
+    mesh->setPersistentThreads(persistentGroups, persistentChunk, persistentIterations);
+    mesh->setHCSmoothing(hcSmoothing, hcAlpha, hcBeta);
+    mesh->setSmoothingOperator(smoothingOperator, flowTimeStep, flowStepClamp);
+    mesh->setBilateralFilter(bilateralFilter ? bilateralShaderFile : NULL, bilateralSettings);
+    mesh->setVolumePreservation(volumeInterval > 0 ? volumeShaderFile : NULL, volumeInterval);
+    mesh->setStreaming(streamBlockVertices, streamHalo, streamCacheBlocks, outputModelFilename);
+    mesh->setDistributed(haloTransport);
+}
+
+
+
+// Times every phase on the bundled models and the generated meshes and writes benchmarkFile.
+static int runBenchmarkSuite(const vector<string>& defines)
+{
+    benchOptions.iterations = numIterations;
+    benchOptions.outputFile = benchmarkFile;
+    for (size_t i = 0; i < defines.size(); ++i) benchOptions.config += (i ? ", " : "") + defines[i];
+    if (gaussSeidel) benchOptions.config += ", gauss-seidel";
+    if (valenceBuckets) benchOptions.config += ", valence-buckets";
+    if (persistentGroups > 0) benchOptions.config += ", persistent";
+    if (hcSmoothing) benchOptions.config += ", hc " + to_string(hcAlpha) + " " + to_string(hcBeta);
+    if (smoothingOperator != OPERATOR_UMBRELLA) {
+        benchOptions.config += smoothingOperator == OPERATOR_MEAN_CURVATURE ? ", mcf " : ", scale-dependent ";
+        benchOptions.config += to_string(flowTimeStep) + " " + to_string(flowStepClamp);
+    }
+    if (bilateralFilter) benchOptions.config += ", bilateral";
+    if (volumeInterval > 0) benchOptions.config += ", preserve-volume " + to_string(volumeInterval);
+    if (lockMask) benchOptions.config += ", lock-mask " + to_string(lockMask);
+    if (!weldVertices) benchOptions.config += ", no-weld";
+
+    bool ok = runBenchmark(benchOptions, [&defines]() {
+        SSBOMesh* mesh = new SSBOMesh();
+        configureMesh(mesh, defines);
+        mesh->setLockMask(lockMask);
+        mesh->setProgram(&shaderProg);
+        mesh->setVerticesPerGroup(dispatch.verticesPerGroup());
+        return mesh;
+    });
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+
+// Smooths the input again in a single in-core mesh and compares it with objMesh,
+// which must already be smoothed.
+static void verifyAgainstInCore(const char* label)
+{
+    SSBOMesh inCore;
+    inCore.setCreaseAngle(creaseAngle);
+    inCore.setWelding(weldVertices, weldEpsilon);
+    if (sharedInputSegment) inCore.loadShared(sharedInputSegment);
+    else if (generateSpec) inCore.loadArrays(generatedInput.positions.data(), generatedInput.faces.data(),
+        generatedInput.numVertices(), generatedInput.numFaces(), generateSpec);
+    else inCore.loadOBJ(inputModelFilename);
+    inCore.setProgram(&shaderProg);
+    inCore.setVerticesPerGroup(dispatch.verticesPerGroup());
+    inCore.setLockMask(lockMask);
+    inCore.smoothVertices(numIterations);
+
+    vector<float> expected(3 * size_t(inCore.numVertices())), actual(3 * size_t(objMesh->numVertices()));
+    inCore.readPositions(expected.data());
+    objMesh->readPositions(actual.data());
+    size_t mismatches = 0;
+    float maxDiff = 0.0f;
+    for (size_t i = 0; i < expected.size() && i < actual.size(); ++i) {
+        float d = fabsf(expected[i] - actual[i]);
+        if (d != 0.0f) mismatches++;
+        maxDiff = d > maxDiff ? d : maxDiff;
+    }
+    printf("%s vs in-core: %zu differing coordinates, max difference %g.\n", label, mismatches, maxDiff);
+}
+
+
+
+// Loads the input mesh (shared segment, generated mesh or OBJ file) into 'mesh'.
+static void loadInput(SSBOMesh* mesh)
+{
+    if (sharedInputSegment) {
+        if (!mesh->loadShared(sharedInputSegment)) exit(EXIT_FAILURE);
+    }
+    else if (generateSpec) {
+        mesh->loadArrays(generatedInput.positions.data(), generatedInput.faces.data(),
+            generatedInput.numVertices(), generatedInput.numFaces(), generateSpec);
+    }
+    else {
+        mesh->loadOBJ(inputModelFilename);
+    }
+}
+
+
+
+// Live controls of the viewer (see runViewer).
+static void viewerKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action == GLFW_RELEASE) return;
+    SmoothingScene* scene = static_cast<SmoothingScene*>(glfwGetWindowUserPointer(window));
+    bool pressed = action == GLFW_PRESS; // Not a key repeat
+    switch (key) {
+    case GLFW_KEY_ESCAPE:
+        glfwSetWindowShouldClose(window, GLFW_TRUE);
+        break;
+    case GLFW_KEY_SPACE:
+        if (pressed) scene->animate(!scene->animating());
+        break;
+    case GLFW_KEY_R:
+        if (pressed) scene->restart();
+        break;
+    case GLFW_KEY_W:
+        if (pressed) {
+            wireframeMode = !wireframeMode;
+            scene->setWireframe(wireframeMode);
+        }
+        break;
+    case GLFW_KEY_EQUAL:
+    case GLFW_KEY_KP_ADD:
+        scene->setIterationsPerFrame(2 * scene->getIterationsPerFrame());
+        break;
+    case GLFW_KEY_MINUS:
+    case GLFW_KEY_KP_SUBTRACT:
+        scene->setIterationsPerFrame(scene->getIterationsPerFrame() / 2);
+        break;
+    case GLFW_KEY_UP:
+        scene->setLambda(scene->getLambda() + 0.05f);
+        break;
+    case GLFW_KEY_DOWN:
+        scene->setLambda(scene->getLambda() - 0.05f);
+        break;
+    case GLFW_KEY_LEFT:
+        scene->orbit(-10.0f, 0.0f);
+        break;
+    case GLFW_KEY_RIGHT:
+        scene->orbit(10.0f, 0.0f);
+        break;
+    case GLFW_KEY_PAGE_UP:
+        scene->orbit(0.0f, 10.0f);
+        break;
+    case GLFW_KEY_PAGE_DOWN:
+        scene->orbit(0.0f, -10.0f);
+        break;
+    }
+}
+
+static void viewerResizeCallback(GLFWwindow* window, int width, int height)
+{
+    static_cast<SmoothingScene*>(glfwGetWindowUserPointer(window))->resize(width, height);
+}
+
+
+
+// Smooths objMesh while drawing it, frame by frame, until the window is closed.
+static void runViewer(GLFWwindow* window)
+{
+    SmoothingScene scene(objMesh, previewVertexShaderFile, previewFragmentShaderFile, []() { loadInput(objMesh); });
+    scene.setIterationsPerFrame(viewIterationsPerFrame);
+    scene.setFrameBudget(viewFrameBudget);
+    scene.setWireframe(wireframeMode);
+    scene.initScene();
+    scene.resize(winWidth, winHeight);
+
+    glfwSetWindowUserPointer(window, &scene);
+    glfwSetKeyCallback(window, viewerKeyCallback);
+    glfwSetFramebufferSizeCallback(window, viewerResizeCallback);
+    glfwSwapInterval(1);
+    printf("Viewer: Space pauses, R restarts, +/- change the iterations per frame, Up/Down lambda,\n"
+        "        Left/Right/Page Up/Page Down orbit, W toggles wireframe, Esc quits.\n");
+
+    double titleTime = glfwGetTime();
+    int titleFrames = 0;
+    while (!glfwWindowShouldClose(window)) {
+        scene.update(float(glfwGetTime()));
+        scene.render();
+        glfwSwapBuffers(window);
+        glfwPollEvents();
+
+        // Status in the title bar, four times a second
+        titleFrames++;
+        double now = glfwGetTime();
+        if (now - titleTime >= 0.25) {
+            char fps[32];
+            snprintf(fps, sizeof(fps), ", %.0f fps", titleFrames / (now - titleTime));
+            glfwSetWindowTitle(window, (scene.status() + fps).c_str());
+            titleTime = now;
+            titleFrames = 0;
+        }
+    }
+
+    glfwSetKeyCallback(window, NULL);
+    glfwSetFramebufferSizeCallback(window, NULL);
+    glfwSetWindowUserPointer(window, NULL);
+    printf("Viewer closed after %s.\n", scene.status().c_str());
+}
+
+
+
 /////////////////////////////////////////////////////////////////////////////
 // The main function.
 /////////////////////////////////////////////////////////////////////////////
@@ -70,6 +774,131 @@ int main(int argc, char** argv)
 {
     atexit(WaitForEnterKeyBeforeExit); // std::atexit() is declared in cstdlib
 
+    parseCommandLine(argc, argv);
+    if (benchCompareFiles[0]) {
+        int regressions = compareBenchmarks(benchCompareFiles[0], benchCompareFiles[1], benchThreshold);
+        return regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (streamBlockVertices > 0 && (positionFormat != POSITIONS_FP32 || compressNeighbors)) {
+        fprintf(stderr, "Error: --stream requires fp32 positions and uncompressed neighbors.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (streamBlockVertices > 0 && (sharedInputSegment || generateSpec)) {
+        fprintf(stderr, "Error: --stream converts the OBJ input into a block file on disk; drop --shm-in and --generate.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (streamBlockVertices > 0) {
+        weldVertices = false; // Welding needs the whole mesh in memory
+    }
+    if (gaussSeidel && (streamBlockVertices > 0 || numRanks > 1 || useMpi)) {
+        fprintf(stderr, "Error: --gauss-seidel cannot be combined with --stream or --ranks/--mpi.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (autotune && (gaussSeidel || streamBlockVertices > 0 || numRanks > 1 || useMpi)) {
+        fprintf(stderr, "Error: --autotune times the in-core Jacobi kernel; drop --gauss-seidel, --stream and --ranks/--mpi.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (valenceBuckets && (gaussSeidel || streamBlockVertices > 0 || numRanks > 1 || useMpi)) {
+        fprintf(stderr, "Error: --valence-buckets only applies to the in-core Jacobi path.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (persistentGroups > 0 && (gaussSeidel || valenceBuckets || streamBlockVertices > 0 || numRanks > 1 || useMpi)) {
+        fprintf(stderr, "Error: --persistent only applies to the in-core Jacobi path without --valence-buckets.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (hcSmoothing && (gaussSeidel || valenceBuckets || persistentGroups > 0 || streamBlockVertices > 0 ||
+        numRanks > 1 || useMpi || batchListFile)) {
+        fprintf(stderr, "Error: --hc runs its own in-core Jacobi dispatches; drop --gauss-seidel, --valence-buckets,\n"
+            "       --persistent, --stream, --ranks/--mpi and --batch.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (bilateralFilter && (hcSmoothing || positionFormat != POSITIONS_FP32 || gaussSeidel || valenceBuckets ||
+        persistentGroups > 0 || streamBlockVertices > 0 || numRanks > 1 || useMpi || batchListFile || reportStorageError)) {
+        fprintf(stderr, "Error: --bilateral runs in core on fp32 positions; drop --hc, --positions, --gauss-seidel,\n"
+            "       --valence-buckets, --persistent, --stream, --ranks/--mpi, --batch and --report-error.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (smoothingOperator != OPERATOR_UMBRELLA && (hcSmoothing || bilateralFilter || gaussSeidel || valenceBuckets ||
+        persistentGroups > 0 || streamBlockVertices > 0 || numRanks > 1 || useMpi || batchListFile || reportStorageError)) {
+        fprintf(stderr, "Error: --operator scale|mcf runs in-core Jacobi iterations; drop --hc, --bilateral, --gauss-seidel,\n"
+            "       --valence-buckets, --persistent, --stream, --ranks/--mpi, --batch and --report-error.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (volumeInterval > 0 && (positionFormat != POSITIONS_FP32 || streamBlockVertices > 0 || numRanks > 1 || useMpi ||
+        batchListFile || reportStorageError || hcOnCpu)) {
+        fprintf(stderr, "Error: --preserve-volume rescales fp32 positions in core; drop --positions, --stream, --ranks/--mpi,\n"
+            "       --batch, --report-error and --hc-cpu.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (flowStepClamp <= 0.0f) {
+        fprintf(stderr, "Error: --step-clamp must be positive.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (hcOnCpu && (!hcSmoothing || benchmarkFile || sharedOutputSegment || reportStorageError)) {
+        fprintf(stderr, "Error: --hc-cpu needs --hc and writes the output OBJ; drop --benchmark, --shm-out and --report-error.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (persistentGroups > 1 && persistentIterations > 1) {
+        fprintf(stderr, "Warning: --persistent-iterations %u spins on a global barrier; it hangs unless all %u groups\n"
+            "         are resident on the device at once.\n", persistentIterations, persistentGroups);
+    }
+    if (batchListFile && (positionFormat != POSITIONS_FP32 || compressNeighbors || gaussSeidel || valenceBuckets ||
+        persistentGroups > 0 || autotune || streamBlockVertices > 0 || numRanks > 1 || useMpi ||
+        sharedInputSegment || sharedOutputSegment || reportStorageError)) {
+        fprintf(stderr, "Error: --batch runs plain fp32 Jacobi smoothing; it takes --iterations, --lock-*, --no-weld,\n"
+            "       --weld-epsilon, --preview and --no-shader-cache.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (benchmarkFile && (batchListFile || autotune || streamBlockVertices > 0 || numRanks > 1 || useMpi ||
+        sharedInputSegment || sharedOutputSegment || reportStorageError || benchOptions.repetitions < 1)) {
+        fprintf(stderr, "Error: --benchmark runs in-core smoothing on OBJ files; drop --batch, --autotune, --stream,\n"
+            "       --ranks/--mpi, --shm-* and --report-error, and use at least one repetition.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (previewSize > 0 && (streamBlockVertices > 0 || numRanks > 1 || useMpi || benchmarkFile || hcOnCpu ||
+        sharedOutputSegment)) {
+        fprintf(stderr, "Error: --preview draws the in-core mesh next to the output OBJ; drop --stream, --ranks/--mpi,\n"
+            "       --benchmark, --hc-cpu and --shm-out.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (viewMode && (streamBlockVertices > 0 || numRanks > 1 || useMpi || batchListFile || benchmarkFile || hcOnCpu ||
+        sharedOutputSegment || reportStorageError || verifyStreaming || verifyRanks || profile || viewIterationsPerFrame < 1)) {
+        fprintf(stderr, "Error: --view smooths in core while drawing; drop --stream, --ranks/--mpi, --batch, --benchmark,\n"
+            "       --hc-cpu, --shm-out, --report-error, --verify-* and --profile, and use at least one iteration per frame.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (generateOutFile && !generateSpec) {
+        fprintf(stderr, "Error: --generate-out needs --generate.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (generateSpec && (sharedInputSegment || batchListFile || benchmarkFile)) {
+        fprintf(stderr, "Error: --generate replaces the input mesh; drop --shm-in, --batch and --benchmark (use --bench-mesh).\n");
+        exit(EXIT_FAILURE);
+    }
+    if (generateSpec) {
+        chrono::steady_clock::time_point generateStart = chrono::steady_clock::now();
+        if (!generateFromSpec(generateSpec, generatedInput)) exit(EXIT_FAILURE);
+        printf("Generated %s: %u vertices, %u triangles in %.1f ms.\n", generateSpec, generatedInput.numVertices(),
+            generatedInput.numFaces(), chrono::duration<double, milli>(chrono::steady_clock::now() - generateStart).count());
+        if (generateOutFile) {
+            if (!writeGeneratedOBJ(generateOutFile, generatedInput)) exit(EXIT_FAILURE);
+            printf("Wrote %s.\n", generateOutFile);
+            return EXIT_SUCCESS;
+        }
+    }
+    if ((numRanks > 1 || useMpi) && (positionFormat != POSITIONS_FP32 || compressNeighbors || streamBlockVertices > 0)) {
+        fprintf(stderr, "Error: --ranks/--mpi require fp32 positions, uncompressed neighbors and no --stream.\n");
+        exit(EXIT_FAILURE);
+    }
+#ifdef HAVE_MPI
+    if (useMpi) {
+        MPI_Init(&argc, &argv);
+        haloTransport = new MpiTransport();
+    }
+    else
+#endif
+    if (numRanks > 1) launchLocalRanks();
+
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit()) exit(EXIT_FAILURE);
 
@@ -77,8 +906,8 @@ int main(int argc, char** argv)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE); // Creates a hidden dummy window (we just need a context)
-    GLFWwindow* window = glfwCreateWindow(winWidth, winHeight, "main", NULL, NULL);
+    glfwWindowHint(GLFW_VISIBLE, viewMode ? GLFW_TRUE : GLFW_FALSE); // Hidden dummy window unless viewing (we just need a context)
+    GLFWwindow* window = glfwCreateWindow(winWidth, winHeight, viewMode ? "Laplacian smoothing" : "main", NULL, NULL);
     glfwGetFramebufferSize(window, &winWidth, &winHeight); // Required for macOS.
 
     if (!window) {
@@ -100,23 +929,118 @@ int main(int argc, char** argv)
     printf("System supports OpenGL %s.\n", glGetString(GL_VERSION));
 
     /* Laplacian smoothing program runs */
-    try {
-        shaderProg.compileShader(compShaderFile, GLSLShader::COMPUTE);
-        shaderProg.link();
-        //shaderProg.validate();
-        shaderProg.use(); // Install shader program to rendering pipeline.
+    vector<string> baseDefines;
+    baseDefines.push_back(SSBOMesh::positionFormatDefine(positionFormat));
+    if (compressNeighbors) baseDefines.push_back("COMPRESSED_NEIGHBORS");
+    if (shaderCacheDir) shaderCache = new ShaderCache(shaderCacheDir);
+
+    // Dispatch shape tuned earlier for this renderer, if any
+    string tuningKey = dispatchConfigKey(baseDefines);
+    if (loadDispatchConfig(tuningFile, tuningKey, dispatch)) {
+        printf("Using tuned dispatch: workgroup size %u, %u vertices per thread.\n",
+            dispatch.workgroupSize, dispatch.vertsPerThread);
     }
-    catch (GLSLProgramException& e) {
-        fprintf(stderr, "Error: %s.\n", e.what());
+    vector<string> defines = baseDefines;
+    appendDispatchDefines(dispatch, defines);
+
+    if (batchListFile) {
+        int status = buildSmoothingProgram(defines) ? runBatch() : EXIT_FAILURE;
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return status;
+    }
+
+    if (benchmarkFile) {
+        int status = buildSmoothingProgram(defines) ? runBenchmarkSuite(defines) : EXIT_FAILURE;
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return status;
+    }
+
+    objMesh = new SSBOMesh();
+    configureMesh(objMesh, defines);
+    loadInput(objMesh);
+    objMesh->setLockMask(lockMask);
+
+    if (autotune) {
+        dispatch = tuneDispatch(*objMesh, compShaderFile, baseDefines, shaderCache, autotuneIterations);
+        saveDispatchConfig(tuningFile, tuningKey, dispatch);
+        defines = baseDefines;
+        appendDispatchDefines(dispatch, defines);
+        objMesh->setShaderSource(compShaderFile, defines);
+    }
+
+    if (!buildSmoothingProgram(defines)) {
         glfwDestroyWindow(window);
         glfwTerminate();
         exit(EXIT_FAILURE);
     }
 
-    objMesh = new SSBOMesh(inputModelFilename);
-    objMesh->smoothVertices(numIterations, outputModelFilename);
+    objMesh->setProgram(&shaderProg);
+    objMesh->setVerticesPerGroup(dispatch.verticesPerGroup());
+
+    MeshPreview* preview = NULL;
+    if (previewSize > 0) {
+        preview = new MeshPreview(previewVertexShaderFile, previewFragmentShaderFile, previewSize, previewSize);
+        preview->capture(*objMesh, previewFileName(outputModelFilename, "before").c_str());
+    }
+
+    if ((verifyStreaming && streamBlockVertices > 0) || (verifyRanks && haloTransport)) {
+        // Compare against the in-core path on the same input (on rank 0 only).
+        objMesh->smoothVertices(numIterations);
+        if (!haloTransport) verifyAgainstInCore("Streaming");
+        else if (haloTransport->rank() == 0) verifyAgainstInCore("Distributed");
+        numIterations = 0; // Already smoothed; only write the result below
+    }
+
+    if (reportStorageError && positionFormat != POSITIONS_FP32) {
+        objMesh->smoothVertices(numIterations);
+        objMesh->reportStorageError(numIterations);
+        numIterations = 0; // Already smoothed; only write the result below
+    }
+
+    if (haloTransport && haloTransport->rank() != 0) {
+        objMesh->smoothVertices(numIterations); // Rank 0 writes the result
+    }
+    else if (hcOnCpu) {
+        vector<float> positions(3 * size_t(objMesh->numVertices()));
+        vector<GLuint> faces(3 * size_t(objMesh->numFaces()));
+        objMesh->readPositions(positions.data());
+        objMesh->readFaces(faces.data());
+        chrono::steady_clock::time_point hcStart = chrono::steady_clock::now();
+        objMesh->smoothOnHostHC(positions, numIterations, hcThreads);
+        printf("HC smoothing on the CPU: %d iterations in %.2f ms.\n", numIterations,
+            chrono::duration<double, milli>(chrono::steady_clock::now() - hcStart).count());
+        objMesh->writeOBJ(outputModelFilename, positions.data(), faces.data());
+    }
+    else if (viewMode) {
+        runViewer(window);
+        objMesh->smoothVertices(0, outputModelFilename); // Only reads back and writes the result
+    }
+    else if (sharedOutputSegment) {
+        objMesh->smoothVertices(numIterations);
+        if (!objMesh->exportShared(sharedOutputSegment)) exit(EXIT_FAILURE);
+    }
+    else {
+        objMesh->smoothVertices(numIterations, outputModelFilename);
+    }
+
+    if (preview) {
+        string before = previewFileName(outputModelFilename, "before"), after = previewFileName(outputModelFilename, "after");
+        if (preview->capture(*objMesh, after.c_str())) printf("Previews written to %s and %s.\n", before.c_str(), after.c_str());
+        delete preview;
+    }
+    delete objMesh; // Also removes the block file of --stream
+    objMesh = NULL;
 
     glfwDestroyWindow(window);
     glfwTerminate();
-    return EXIT_SUCCESS;
+
+    int status = waitForLocalRanks();
+    delete haloTransport;
+    haloTransport = NULL;
+#ifdef HAVE_MPI
+    if (useMpi) MPI_Finalize();
+#endif
+    return status;
 }
@@ -0,0 +1,20 @@
+#version 430 core
+
+// Flat shaded preview with a headlight. The face normal comes from the
+// screen-space derivatives of the position, so no normal buffer is needed;
+// back faces (open meshes, inconsistent winding) are lit too but tinted.
+// Lines (wireframe) have no such normal and are drawn unlit.
+
+in vec3 position;
+
+uniform vec3 eye;                   // Camera position, model space
+
+layout (location = 0) out vec4 fragColor;
+
+void main() {
+    vec3 n = cross(dFdx(position), dFdy(position));
+    float area = length(n);
+    float diffuse = area > 0.0 ? abs(dot(n / area, normalize(eye - position))) : 0.5;
+    vec3 base = gl_FrontFacing ? vec3(0.78, 0.80, 0.84) : vec3(0.84, 0.68, 0.56);
+    fragColor = vec4(base * (0.2 + 0.8 * diffuse), 1.0);
+}
@@ -0,0 +1,40 @@
+#version 430 core
+
+// Preview of a mesh drawn straight from its position SSBO, which is bound as
+// the vertex buffer (see helper/meshpreview.h). POSITION_FORMAT as in
+// shader.comp: 0 = fp32 xyz, 1 = fp16 xyz packed in uvec2, 2 = 21-bit
+// coordinates quantized to the mesh bounding box, packed in uvec2.
+#ifndef POSITION_FORMAT
+#define POSITION_FORMAT 0
+#endif
+
+#if POSITION_FORMAT == 0
+layout (location = 0) in vec3 vertexPosition;
+#else
+layout (location = 0) in uvec2 vertexPosition;
+#endif
+
+uniform mat4 viewProjection;
+uniform vec3 bboxMin;               // Quantization frame (POSITION_FORMAT 2)
+uniform vec3 bboxExtent;
+
+out vec3 position;                  // Model space, for the face normal
+
+const float QUANT_MAX = 2097151.0;  // 2^21 - 1
+
+vec3 unpackPos() {
+#if POSITION_FORMAT == 0
+    return vertexPosition;
+#elif POSITION_FORMAT == 1
+    return vec3(unpackHalf2x16(vertexPosition.x), unpackHalf2x16(vertexPosition.y).x);
+#else
+    uvec2 p = vertexPosition;
+    uvec3 q = uvec3(p.x & 0x1FFFFFu, (p.x >> 21) | ((p.y & 0x3FFu) << 11), p.y >> 10);
+    return bboxMin + vec3(q) * (bboxExtent / QUANT_MAX);
+#endif
+}
+
+void main() {
+    position = unpackPos();
+    gl_Position = viewProjection * vec4(position, 1.0);
+}